@@ -0,0 +1,776 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ClusteredLighting.h"
+#include "DeferredShading.h"
+#include "GLUtils.h"
+#include "GpuProfiler.h"
+#include "Instancing.h"
+#include "LightingFeatures.h"
+#include "Materials.h"
+#include "Mesh.h"
+#include "ObjLoader.h"
+#include "SceneGenerator.h"
+#include "TransformStore.h"
+#include "UniformBlocks.h"
+#include "VertexFormats.h"
+
+// Timing of one benchmark case, averaged over the measured frames
+struct BenchmarkResult
+{
+	std::string name;
+	size_t objectCount;
+	int frameCount;
+
+	// Time spent on the CPU issuing the GL calls of a frame
+	double submitMs;
+
+	// Time until the GPU finished the frame (includes the submit time)
+	double frameMs;
+};
+
+// Gets the current time in milliseconds from a monotonic clock
+double BenchmarkNowMs()
+{
+	using namespace std::chrono;
+	return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Prints the header of the benchmark result table
+void PrintBenchmarkHeader()
+{
+	std::cout << std::left << std::setw(24) << "case"
+		<< std::right << std::setw(10) << "objects"
+		<< std::setw(8) << "frames"
+		<< std::setw(14) << "submit ms"
+		<< std::setw(14) << "frame ms"
+		<< std::setw(16) << "ns/object" << std::endl;
+}
+
+// Prints a row of the benchmark result table
+void PrintBenchmarkResult(const BenchmarkResult& result)
+{
+	std::cout << std::left << std::setw(24) << result.name
+		<< std::right << std::setw(10) << result.objectCount
+		<< std::setw(8) << result.frameCount
+		<< std::fixed << std::setprecision(3)
+		<< std::setw(14) << result.submitMs
+		<< std::setw(14) << result.frameMs
+		<< std::setw(16) << result.frameMs * 1.0e6 / result.objectCount
+		<< std::defaultfloat << std::endl;
+}
+
+// Runs a frame function a number of times and measures how long it takes
+// to submit and to finish. One extra warm-up frame is run first.
+// @param	name			Name of the benchmark case
+// @param	objectCount		Number of objects drawn per frame
+// @param	frameCount		Number of frames to measure
+// @param	renderFrame		Function issuing the GL calls of one frame
+// @return	Returns the averaged timings
+template <typename RenderFrame>
+BenchmarkResult MeasureFrames(const std::string& name, size_t objectCount, int frameCount, RenderFrame renderFrame)
+{
+	renderFrame();
+	glFinish();
+
+	BenchmarkResult result = { name, objectCount, frameCount, 0.0, 0.0 };
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		double start = BenchmarkNowMs();
+		renderFrame();
+		double submitted = BenchmarkNowMs();
+		glFinish();
+		double finished = BenchmarkNowMs();
+
+		result.submitMs += submitted - start;
+		result.frameMs += finished - start;
+	}
+	result.submitMs /= frameCount;
+	result.frameMs /= frameCount;
+
+	return result;
+}
+
+// Pose of the camera at one point of a scripted camera path
+struct CameraPose
+{
+	glm::vec3 position;
+
+	// Pitch and yaw in degrees, as used by the interactive camera
+	float pitch;
+	float yaw;
+};
+
+// Gets the pose of the scripted benchmark camera, which circles the scene
+// once while bobbing up and down, always looking at the scene center
+// @param	t	Progress along the path, from 0 to 1
+// @return	Returns the camera pose
+CameraPose ScriptedCameraPose(float t)
+{
+	const glm::vec3 center(0.0f, 0.0f, -6.0f);
+	const float radius = 12.0f;
+	float angle = t * glm::two_pi<float>();
+
+	CameraPose pose;
+	pose.position = center + glm::vec3(radius * std::sin(angle), 2.0f * std::sin(2.0f * angle), radius * std::cos(angle));
+
+	glm::vec3 lookDir = glm::normalize(center - pose.position);
+	pose.pitch = glm::degrees(std::asin(lookDir.y));
+	pose.yaw = glm::degrees(std::atan2(lookDir.z, lookDir.x));
+	return pose;
+}
+
+// Summary of a series of frame times, in milliseconds
+struct FrameTimeSummary
+{
+	size_t frameCount;
+	double minMs;
+	double avgMs;
+	double p50Ms;
+	double p90Ms;
+	double p99Ms;
+	double maxMs;
+};
+
+// Computes the average and percentiles of a series of frame times
+// @param	frameTimesMs	Frame times in milliseconds
+// @return	Returns the summary (all zero if there are no frame times)
+FrameTimeSummary SummarizeFrameTimes(std::vector<double> frameTimesMs)
+{
+	FrameTimeSummary summary = { frameTimesMs.size(), 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	if (frameTimesMs.empty())
+	{
+		return summary;
+	}
+
+	std::sort(frameTimesMs.begin(), frameTimesMs.end());
+	auto percentile = [&](double p)
+	{
+		return frameTimesMs[std::min(frameTimesMs.size() - 1, static_cast<size_t>(frameTimesMs.size() * p))];
+	};
+
+	double sum = 0.0;
+	for (double frameTime : frameTimesMs)
+	{
+		sum += frameTime;
+	}
+
+	summary.minMs = frameTimesMs.front();
+	summary.avgMs = sum / frameTimesMs.size();
+	summary.p50Ms = percentile(0.50);
+	summary.p90Ms = percentile(0.90);
+	summary.p99Ms = percentile(0.99);
+	summary.maxMs = frameTimesMs.back();
+	return summary;
+}
+
+// Writes the results of a headless benchmark run as JSON
+// @param	out				Stream to write to
+// @param	width			Width of the offscreen framebuffer
+// @param	height			Height of the offscreen framebuffer
+// @param	cpuFrameTimes	Summary of the CPU frame times
+// @param	gpuProfiler		Profiler holding the GPU times of the run
+void WriteHeadlessReport(std::ostream& out, int width, int height, const FrameTimeSummary& cpuFrameTimes, const GpuProfiler& gpuProfiler)
+{
+	out << "{" << std::endl;
+	out << "  \"renderer\": \"" << reinterpret_cast<const char*>(glGetString(GL_RENDERER)) << "\"," << std::endl;
+	out << "  \"resolution\": [" << width << ", " << height << "]," << std::endl;
+	out << "  \"frames\": " << cpuFrameTimes.frameCount << "," << std::endl;
+	out << "  \"cpuFrameMs\": { \"min\": " << cpuFrameTimes.minMs << ", \"avg\": " << cpuFrameTimes.avgMs
+		<< ", \"p50\": " << cpuFrameTimes.p50Ms << ", \"p90\": " << cpuFrameTimes.p90Ms
+		<< ", \"p99\": " << cpuFrameTimes.p99Ms << ", \"max\": " << cpuFrameTimes.maxMs << " }," << std::endl;
+	out << "  \"gpu\": ";
+	gpuProfiler.WriteJson(out);
+	out << "}" << std::endl;
+}
+
+// Compares drawing cubes with one draw call per cube against drawing all of
+// them with a single instanced draw call, at 10, 10k and 1M cubes.
+// The camera/lights uniform blocks must already be uploaded, and the material table bound
+// with the cubes' material first, since every draw uses material 0.
+// @param	mesh			Mesh of the objects, with the instance buffer attached to its VAO
+// @param	instanceBuffer	Instance buffer attached to the cube VAO
+// @param	transformBuffer	Object transform buffer read by the cube shader
+// @param	program			Shader program used to draw the cubes
+void RunInstancingBenchmark(const GpuMesh& mesh, InstanceBuffer& instanceBuffer, ObjectTransformBuffer& transformBuffer, const ShaderProgram& program)
+{
+	std::cout << "--- Instancing benchmark ---" << std::endl;
+	PrintBenchmarkHeader();
+
+	glUseProgram(program.id);
+	glBindVertexArray(mesh.vao);
+	transformBuffer.Bind();
+
+	TransformStore store;
+	std::vector<uint32_t> objectIndices;
+
+	const size_t objectCounts[] = { 10, 10000, 1000000 };
+	for (size_t objectCount : objectCounts)
+	{
+		SceneDesc scene;
+		scene.objectCount = objectCount;
+		scene.spacing = 1.5f;
+		GenerateScene(scene, store);
+		store.Update();
+		transformBuffer.Upload(store);
+
+		objectIndices.resize(objectCount);
+		for (size_t i = 0; i < objectCount; ++i)
+		{
+			objectIndices[i] = static_cast<uint32_t>(i);
+		}
+
+		int frameCount = objectCount >= 1000000 ? 3 : 20;
+
+		// One draw call per cube, with the object index set in between.
+		// The instance arrays are switched off so the generic attribute values are used.
+		SetInstanceArraysEnabled(false);
+		PrintBenchmarkResult(MeasureFrames("per-draw", objectCount, frameCount, [&]()
+		{
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			for (uint32_t objectIndex : objectIndices)
+			{
+				DrawSingleInstance(objectIndex, mesh.indexCount, mesh.indexType);
+			}
+		}));
+		SetInstanceArraysEnabled(true);
+
+		// All cubes in one draw call, with the object indices streamed through the instance buffer
+		PrintBenchmarkResult(MeasureFrames("instanced", objectCount, frameCount, [&]()
+		{
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			instanceBuffer.Upload(objectIndices);
+			glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, mesh.indexType, 0, objectIndices.size());
+		}));
+	}
+}
+
+// Timing and memory use of one object count of the scaling benchmark
+struct ScalingResult
+{
+	size_t objectCount;
+	size_t visibleCount;
+
+	// Time to generate the scene and compute all of its transforms
+	double generateMs;
+
+	// Time to upload all of the transforms to the GPU
+	double uploadMs;
+
+	// Time spent on the CPU per frame, in total and for frustum culling alone
+	double submitMs;
+	double cullMs;
+
+	// GPU time per frame
+	double gpuMs;
+
+	// Time until the GPU finished the frame (includes the submit time)
+	double frameMs;
+
+	// Bytes held by the scene on the CPU and on the GPU
+	size_t cpuBytes;
+	size_t gpuBytes;
+};
+
+void PrintScalingHeader()
+{
+	std::cout << std::right << std::setw(10) << "objects"
+		<< std::setw(10) << "visible"
+		<< std::setw(12) << "gen ms"
+		<< std::setw(12) << "upload ms"
+		<< std::setw(12) << "submit ms"
+		<< std::setw(12) << "cull ms"
+		<< std::setw(12) << "gpu ms"
+		<< std::setw(12) << "frame ms"
+		<< std::setw(12) << "cpu MB"
+		<< std::setw(12) << "gpu MB" << std::endl;
+}
+
+void PrintScalingResult(const ScalingResult& result)
+{
+	std::cout << std::right << std::setw(10) << result.objectCount
+		<< std::setw(10) << result.visibleCount
+		<< std::fixed << std::setprecision(3)
+		<< std::setw(12) << result.generateMs
+		<< std::setw(12) << result.uploadMs
+		<< std::setw(12) << result.submitMs
+		<< std::setw(12) << result.cullMs
+		<< std::setw(12) << result.gpuMs
+		<< std::setw(12) << result.frameMs
+		<< std::setw(12) << result.cpuBytes / 1048576.0
+		<< std::setw(12) << result.gpuBytes / 1048576.0
+		<< std::defaultfloat << std::endl;
+}
+
+// Measures how the render loop scales with the number of objects, by generating
+// scenes of 10, 100, 1000, ... objects up to a maximum and rendering each of them
+// the way the main loop does (update, upload, light binning, cull, one instanced draw call).
+// The camera is placed so that it sees the whole scene. The material table must
+// already be bound with the cubes' material first, since every draw uses material 0.
+// @param	layout			Layout of the generated scenes
+// @param	seed			Seed of the generated scenes
+// @param	maxObjectCount	Largest object count to measure
+// @param	mesh			Mesh of the objects, with the instance buffer attached to its VAO
+// @param	instanceBuffer	Instance buffer attached to the cube VAO
+// @param	transformBuffer	Object transform buffer read by the cube shader
+// @param	sharedUniforms	Uniform buffer of the camera and lights blocks
+// @param	lighting		Cluster grid of the point and spot lights
+// @param	spotLightIndex	Index of the spot light that follows the camera
+// @param	program			Shader program used to draw the cubes
+// @param	aspectRatio		Aspect ratio of the framebuffer
+// @param	csvPath			Path of a CSV file receiving the results, empty to write none
+void RunScalingBenchmark(SceneLayout layout, uint32_t seed, size_t maxObjectCount, const GpuMesh& mesh,
+	InstanceBuffer& instanceBuffer, ObjectTransformBuffer& transformBuffer, SharedUniformBuffer& sharedUniforms,
+	ClusteredLighting& lighting, size_t spotLightIndex, const ShaderProgram& program, float aspectRatio, const std::string& csvPath)
+{
+	std::cout << "--- Scaling benchmark (" << GetSceneLayoutName(layout) << ", seed " << seed << ") ---" << std::endl;
+	PrintScalingHeader();
+
+	std::ofstream csv;
+	if (!csvPath.empty())
+	{
+		csv.open(csvPath);
+		csv << "layout,seed,objects,visible,generate_ms,upload_ms,submit_ms,cull_ms,gpu_ms,frame_ms,cpu_bytes,gpu_bytes" << std::endl;
+	}
+
+	glUseProgram(program.id);
+	glBindVertexArray(mesh.vao);
+	transformBuffer.Bind();
+	lighting.Bind();
+
+	GLint viewport[4] = {};
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	for (size_t objectCount = 10; objectCount <= maxObjectCount; objectCount *= 10)
+	{
+		ScalingResult result = {};
+		result.objectCount = objectCount;
+
+		// A fresh store per count, so its memory use is not inflated by the previous one
+		TransformStore store;
+		std::vector<uint32_t> visibleIndices;
+
+		SceneDesc scene;
+		scene.layout = layout;
+		scene.objectCount = objectCount;
+		scene.seed = seed;
+
+		double start = BenchmarkNowMs();
+		GenerateScene(scene, store);
+		store.Update();
+		result.generateMs = BenchmarkNowMs() - start;
+
+		start = BenchmarkNowMs();
+		transformBuffer.Upload(store);
+		glFinish();
+		result.uploadMs = BenchmarkNowMs() - start;
+
+		// Look at the whole scene from a bit above its front
+		glm::vec3 boundsMin(FLT_MAX);
+		glm::vec3 boundsMax(-FLT_MAX);
+		for (const glm::vec4& sphere : store.GetWorldBounds())
+		{
+			boundsMin = glm::min(boundsMin, glm::vec3(sphere) - sphere.w);
+			boundsMax = glm::max(boundsMax, glm::vec3(sphere) + sphere.w);
+		}
+		glm::vec3 sceneCenter = (boundsMin + boundsMax) * 0.5f;
+		float sceneRadius = glm::length(boundsMax - boundsMin) * 0.5f;
+
+		glm::vec3 eyePosition = sceneCenter + glm::vec3(0.0f, 0.5f, 2.5f) * sceneRadius;
+		glm::vec3 lookDir = glm::normalize(sceneCenter - eyePosition);
+		glm::mat4 projMatrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, sceneRadius * 5.0f);
+		glm::mat4 viewMatrix = glm::lookAt(eyePosition, sceneCenter, glm::vec3(0.0f, 1.0f, 0.0f));
+
+		sharedUniforms.camera.projMatrix = projMatrix;
+		sharedUniforms.camera.viewMatrix = viewMatrix;
+		sharedUniforms.camera.eyePos = eyePosition;
+		lighting.SetProjection(glm::radians(45.0f), aspectRatio, 0.1f, sceneRadius * 5.0f, viewport[2], viewport[3]);
+		lighting.lights[spotLightIndex].position = eyePosition;
+		lighting.lights[spotLightIndex].direction = lookDir;
+		Frustum viewFrustum = ExtractFrustum(projMatrix * viewMatrix);
+
+		GpuProfiler gpuProfiler;
+		gpuProfiler.historySize = SIZE_MAX;
+
+		int frameCount = objectCount >= 10000000 ? 3 : objectCount >= 1000000 ? 5 : 20;
+		for (int frame = -1; frame < frameCount; ++frame)
+		{
+			// Frame -1 is a warm-up frame and isn't measured
+			if (frame >= 0)
+			{
+				gpuProfiler.BeginFrame();
+				gpuProfiler.BeginScope("frame");
+			}
+
+			start = BenchmarkNowMs();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			sharedUniforms.Upload();
+			lighting.Update(viewMatrix);
+			store.Update();
+			transformBuffer.Upload(store);
+
+			double cullStart = BenchmarkNowMs();
+			const std::vector<glm::vec4>& bounds = store.GetWorldBounds();
+			CullSpheres(viewFrustum, bounds.data(), bounds.size(), visibleIndices);
+			double cullEnd = BenchmarkNowMs();
+
+			instanceBuffer.Upload(visibleIndices);
+			glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, mesh.indexType, 0, visibleIndices.size());
+			double submitted = BenchmarkNowMs();
+
+			if (frame >= 0)
+			{
+				gpuProfiler.EndScope();
+			}
+			glFinish();
+			double finished = BenchmarkNowMs();
+
+			if (frame >= 0)
+			{
+				result.submitMs += submitted - start;
+				result.cullMs += cullEnd - cullStart;
+				result.frameMs += finished - start;
+			}
+		}
+		gpuProfiler.Flush();
+
+		result.submitMs /= frameCount;
+		result.cullMs /= frameCount;
+		result.frameMs /= frameCount;
+		result.gpuMs = gpuProfiler.GetStats()[0].avgMs;
+		result.visibleCount = visibleIndices.size();
+		result.cpuBytes = store.GetMemoryBytes() + visibleIndices.capacity() * sizeof(uint32_t);
+		result.gpuBytes = transformBuffer.GetSizeBytes() + instanceBuffer.capacity;
+		gpuProfiler.Destroy();
+
+		PrintScalingResult(result);
+		if (csv.is_open())
+		{
+			csv << GetSceneLayoutName(layout) << "," << seed << "," << result.objectCount << "," << result.visibleCount << ","
+				<< result.generateMs << "," << result.uploadMs << "," << result.submitMs << "," << result.cullMs << ","
+				<< result.gpuMs << "," << result.frameMs << "," << result.cpuBytes << "," << result.gpuBytes << std::endl;
+		}
+	}
+}
+
+// Compares forward shading, with the lights binned into clusters, against
+// deferred shading with light volumes, on a grid of 10k cubes lit by 16, 256
+// and 4096 point lights. Both paths draw every cube, so the only difference
+// is where the lighting is done.
+// The camera uniform block must already be uploaded, and the material table bound
+// with the cubes' material first, since every draw uses material 0.
+// @param	mesh			Mesh of the objects, with the instance buffer attached to its VAO
+// @param	instanceBuffer	Instance buffer attached to the cube VAO
+// @param	transformBuffer	Object transform buffer read by the cube shaders
+// @param	forwardVariants	Variants of the shader program shading the cubes on the forward path
+// @param	sharedUniforms	Uniform buffer of the camera and lights blocks
+// @param	material		Material of the cubes, first in the material table
+// @param	deferred		Deferred renderer, sized like the target framebuffer
+// @param	lighting		Clustered lighting, whose lights get replaced
+// @param	targetFbo		Framebuffer to render to
+// @param	projMatrix		Projection matrix of the camera
+// @param	viewMatrix		View matrix of the camera
+void RunDeferredBenchmark(const GpuMesh& mesh, InstanceBuffer& instanceBuffer, ObjectTransformBuffer& transformBuffer,
+	ShaderVariantCache& forwardVariants, const SharedUniformBuffer& sharedUniforms, const Material& material, DeferredRenderer& deferred, ClusteredLighting& lighting, GLuint targetFbo,
+	const glm::mat4& projMatrix, const glm::mat4& viewMatrix)
+{
+	std::cout << "--- Deferred shading benchmark ---" << std::endl;
+	PrintBenchmarkHeader();
+
+	TransformStore store;
+	SceneDesc scene;
+	scene.objectCount = 10000;
+	scene.spacing = 1.5f;
+	GenerateScene(scene, store);
+	store.Update();
+	transformBuffer.Upload(store);
+	transformBuffer.Bind();
+
+	std::vector<uint32_t> objectIndices(scene.objectCount);
+	for (size_t i = 0; i < objectIndices.size(); ++i)
+	{
+		objectIndices[i] = static_cast<uint32_t>(i);
+	}
+
+	const size_t lightCounts[] = { 16, 256, 4096 };
+	for (size_t lightCount : lightCounts)
+	{
+		lighting.lights.clear();
+		ScatterPointLights(store.GetWorldBounds(), lightCount, scene.seed, DefaultLightCutoff, lighting.lights);
+		std::string suffix = " " + std::to_string(lightCount) + " lights";
+		const ShaderProgram& forwardProgram = forwardVariants.Get(SelectLightingFeatures(sharedUniforms.lights, material, lighting.lights));
+
+		PrintBenchmarkResult(MeasureFrames("forward" + suffix, scene.objectCount, 20, [&]()
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			lighting.binLights = true;
+			lighting.Update(viewMatrix);
+			lighting.Bind();
+
+			glUseProgram(forwardProgram.id);
+			glBindVertexArray(mesh.vao);
+			instanceBuffer.Upload(objectIndices);
+			glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, mesh.indexType, 0, objectIndices.size());
+		}));
+
+		PrintBenchmarkResult(MeasureFrames("deferred" + suffix, scene.objectCount, 20, [&]()
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			lighting.binLights = false;
+			lighting.Update(viewMatrix);
+			lighting.Bind();
+
+			deferred.BeginGeometryPass();
+			glBindVertexArray(mesh.vao);
+			instanceBuffer.Upload(objectIndices);
+			glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, mesh.indexType, 0, objectIndices.size());
+			deferred.ShadeLights(targetFbo, projMatrix, viewMatrix, lighting);
+		}));
+	}
+	lighting.binLights = true;
+}
+
+// Generates the OBJ text of a UV sphere, for benchmarking the mesh loader without an asset.
+// Every position has its own normal, and the quads between rings are written as such.
+// @param	rings		Number of rings from pole to pole
+// @param	segments	Number of segments around the axis
+// @return	Returns the text of the file
+std::string GenerateSphereObj(int rings, int segments)
+{
+	std::ostringstream obj;
+	obj << std::fixed << std::setprecision(6);
+	for (int ring = 0; ring <= rings; ++ring)
+	{
+		float theta = glm::pi<float>() * ring / rings;
+		for (int segment = 0; segment < segments; ++segment)
+		{
+			float phi = glm::two_pi<float>() * segment / segments;
+			glm::vec3 normal(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			obj << "v " << normal.x << " " << normal.y << " " << normal.z << "\n";
+			obj << "vn " << normal.x << " " << normal.y << " " << normal.z << "\n";
+		}
+	}
+	for (int ring = 0; ring < rings; ++ring)
+	{
+		for (int segment = 0; segment < segments; ++segment)
+		{
+			int a = ring * segments + segment + 1;
+			int b = ring * segments + (segment + 1) % segments + 1;
+			int c = b + segments;
+			int d = a + segments;
+			obj << "f " << a << "//" << a << " " << b << "//" << b << " " << c << "//" << c << " " << d << "//" << d << "\n";
+		}
+	}
+	return obj.str();
+}
+
+// Measures the throughput of the OBJ loader at increasing thread counts, up to
+// one thread per hardware thread. Each count is loaded a few times, keeping the fastest.
+// @param	path	OBJ file to load, or empty to parse a generated sphere of about half a million triangles
+void RunMeshLoaderBenchmark(const std::string& path)
+{
+	std::cout << "--- Mesh loader benchmark ---" << std::endl;
+
+	// Read the file once up front, so every run parses from memory and only the loader itself is measured
+	std::string text;
+	if (path.empty())
+	{
+		text = GenerateSphereObj(512, 512);
+	}
+	else
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (file.fail())
+		{
+			std::cerr << "Cannot open mesh file " << path << std::endl;
+			return;
+		}
+		std::ostringstream contents;
+		contents << file.rdbuf();
+		text = contents.str();
+	}
+
+	std::cout << std::right << std::setw(10) << "threads"
+		<< std::setw(12) << "MB"
+		<< std::setw(12) << "parse ms"
+		<< std::setw(12) << "merge ms"
+		<< std::setw(12) << "total ms"
+		<< std::setw(12) << "MB/s"
+		<< std::setw(14) << "Mtris/s"
+		<< std::setw(12) << "vertices" << std::endl;
+
+	int maxThreadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	for (int threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreadCount))
+	{
+		MeshLoadStats best;
+		for (int run = 0; run < 3; ++run)
+		{
+			MeshLoadStats stats;
+			try
+			{
+				ParseObjMesh(text, threadCount, &stats);
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << "Cannot parse mesh: " << e.what() << std::endl;
+				return;
+			}
+			if (run == 0 || stats.totalMs < best.totalMs)
+			{
+				best = stats;
+			}
+		}
+
+		std::cout << std::right << std::setw(10) << best.threadCount
+			<< std::fixed << std::setprecision(3)
+			<< std::setw(12) << best.fileBytes / 1048576.0
+			<< std::setw(12) << best.parseMs
+			<< std::setw(12) << best.mergeMs
+			<< std::setw(12) << best.totalMs
+			<< std::setw(12) << best.GetMegabytesPerSecond()
+			<< std::setw(14) << best.GetTrianglesPerSecond() / 1.0e6
+			<< std::defaultfloat
+			<< std::setw(12) << best.vertexCount << std::endl;
+
+		if (threadCount == maxThreadCount)
+		{
+			break;
+		}
+	}
+}
+
+// Checks the error of every compact vertex format against its theoretical bound, and
+// reports how much smaller it makes the vertex buffer. The mesh is fitted to the cube's
+// bounding sphere first, like the scene meshes are. Run the other benchmarks with
+// --vertex-format to compare what the formats cost to draw.
+// @param	path	OBJ file to measure, or empty to use a generated sphere
+// @return	Returns true if every format stayed within its bounds
+bool RunVertexFormatBenchmark(const std::string& path)
+{
+	std::cout << "--- Vertex format benchmark ---" << std::endl;
+
+	MeshData mesh;
+	try
+	{
+		mesh = path.empty() ? ParseObjMesh(GenerateSphereObj(256, 256)) : LoadObjMesh(path);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Cannot load mesh: " << e.what() << std::endl;
+		return false;
+	}
+	FitMeshToSphere(mesh, glm::vec3(0.0f), std::sqrt(3.0f));
+
+	float maxAbs = 0.0f;
+	for (const Vertex& vertex : mesh.vertices)
+	{
+		maxAbs = std::max(maxAbs, std::max(std::abs(vertex.x), std::max(std::abs(vertex.y), std::abs(vertex.z))));
+	}
+
+	std::cout << std::right << std::setw(12) << "format"
+		<< std::setw(8) << "bytes"
+		<< std::setw(10) << "MB"
+		<< std::setw(8) << "size"
+		<< std::setw(12) << "encode ms"
+		<< std::setw(14) << "pos error"
+		<< std::setw(14) << "pos bound"
+		<< std::setw(14) << "normal deg"
+		<< std::setw(14) << "normal bound"
+		<< std::setw(10) << "result" << std::endl;
+
+	const VertexFormat formats[] = { VertexFormat::Float, VertexFormat::Half, VertexFormat::Quantized, VertexFormat::Octahedral };
+	bool allWithinBounds = true;
+	for (VertexFormat format : formats)
+	{
+		double start = BenchmarkNowMs();
+		std::vector<char> encoded = EncodeVertices(mesh.vertices.data(), mesh.vertices.size(), format);
+		double encodeMs = BenchmarkNowMs() - start;
+
+		// Positions: half floats round to 11 significant bits, quantized ones to half a step, per component
+		double positionBound = 0.0;
+		if (format == VertexFormat::Half)
+		{
+			positionBound = std::sqrt(3.0) * std::ldexp(maxAbs, -11);
+		}
+		else if (format != VertexFormat::Float)
+		{
+			positionBound = std::sqrt(3.0) * std::ldexp(1.0, GetPositionExponent(mesh.vertices.data(), mesh.vertices.size()) - 1);
+		}
+
+		// Normals: snorm rounding moves each component by at most half a step. Unfolding the
+		// octahedron stretches its coordinates by at most sqrt(18) in angle.
+		const double componentError = format == VertexFormat::Octahedral ? 0.5 / 32767.0 : 0.5 / 511.0;
+		double normalBound = 0.0;
+		if (format == VertexFormat::Octahedral)
+		{
+			normalBound = glm::degrees(std::sqrt(18.0) * componentError);
+		}
+		else if (format != VertexFormat::Float)
+		{
+			double offset = std::sqrt(3.0) * componentError;
+			normalBound = glm::degrees(std::atan(offset / (1.0 - offset)));
+		}
+
+		// Allow for the float rounding of the decoding itself
+		positionBound += maxAbs * 1.0e-6;
+		normalBound += 1.0e-3;
+
+		double maxPositionError = 0.0;
+		double maxNormalError = 0.0;
+		const size_t stride = GetVertexStride(format);
+		for (size_t i = 0; i < mesh.vertices.size(); ++i)
+		{
+			const Vertex& original = mesh.vertices[i];
+			Vertex decoded = DecodeVertex(encoded.data() + i * stride, format);
+			glm::dvec3 positionError(decoded.x - original.x, decoded.y - original.y, decoded.z - original.z);
+			maxPositionError = std::max(maxPositionError, glm::length(positionError));
+
+			glm::dvec3 originalNormal(original.nx, original.ny, original.nz);
+			glm::dvec3 decodedNormal(decoded.nx, decoded.ny, decoded.nz);
+			if (glm::length(originalNormal) > 0.0 && glm::length(decodedNormal) > 0.0)
+			{
+				double cosine = glm::clamp(glm::dot(glm::normalize(originalNormal), glm::normalize(decodedNormal)), -1.0, 1.0);
+				maxNormalError = std::max(maxNormalError, glm::degrees(std::acos(cosine)));
+			}
+		}
+
+		bool withinBounds = maxPositionError <= positionBound && maxNormalError <= normalBound;
+		allWithinBounds = allWithinBounds && withinBounds;
+
+		std::cout << std::right << std::setw(12) << GetVertexFormatName(format)
+			<< std::setw(8) << stride
+			<< std::fixed << std::setprecision(3)
+			<< std::setw(10) << encoded.size() / 1048576.0
+			<< std::setw(8) << static_cast<double>(stride) / sizeof(Vertex)
+			<< std::setw(12) << encodeMs
+			<< std::scientific << std::setprecision(2)
+			<< std::setw(14) << maxPositionError
+			<< std::setw(14) << positionBound
+			<< std::setw(14) << maxNormalError
+			<< std::setw(14) << normalBound
+			<< std::defaultfloat
+			<< std::setw(10) << (withinBounds ? "ok" : "EXCEEDED") << std::endl;
+	}
+	return allWithinBounds;
+}
@@ -0,0 +1,668 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "GLUtils.h"
+#include "SceneGenerator.h"
+#include "UniformBlocks.h"
+
+// Texture units of the clustered lighting buffers
+const GLint LocalLightsTextureUnit = 1;
+const GLint ClusterGridTextureUnit = 2;
+const GLint ClusterLightIndicesTextureUnit = 3;
+
+// Number of RGBA32F texels taken up by one light in the light buffer
+const GLint TexelsPerLocalLight = 5;
+
+// GLSL helpers for reading and shading the lights of the light buffer,
+// pulled into shaders with #include "LocalLights.glsl"
+const char* const LocalLightsSource = R"(
+// Shaders that aren't built as lighting variants (see LightingFeatures.h) get every feature
+#ifndef SHADER_VARIANT
+#define HAS_SPOT
+#define SPECULAR
+#define HAS_SHADOWS
+#endif
+
+#include "Shadows.glsl"
+
+// Per light: position and range, direction and cosine of the cutoff angle,
+// then ambient, diffuse and specular colors with the attenuation factors in w
+uniform samplerBuffer localLights;
+
+// Gets the position and range of a light
+vec4 FetchLocalLightSphere(int lightIndex)
+{
+	return texelFetch(localLights, lightIndex * 5);
+}
+
+// Computes the contribution of a single point or spot light to a surface
+// @param	lightIndex	Index of the light in the light buffer
+// @param	ambientColor, diffuseColor, specularColor, shininess	Material of the surface
+vec3 ShadeLocalLight(int lightIndex, vec3 fragPos, vec3 normal, vec3 viewDir,
+	vec3 ambientColor, vec3 diffuseColor, vec3 specularColor, float shininess)
+{
+	int base = lightIndex * 5;
+	vec4 positionRange = texelFetch(localLights, base);
+	vec4 directionCutOff = texelFetch(localLights, base + 1);
+	vec4 ambientConstant = texelFetch(localLights, base + 2);
+	vec4 diffuseLinear = texelFetch(localLights, base + 3);
+	vec4 specularQuadratic = texelFetch(localLights, base + 4);
+
+	vec3 lightToFragDir = normalize(fragPos - positionRange.xyz);
+	vec3 fragToLightDir = -lightToFragDir;
+
+	vec3 ambient = ambientConstant.rgb * ambientColor;
+	vec3 diffuse = vec3(0.0, 0.0, 0.0);
+	vec3 specular = vec3(0.0, 0.0, 0.0);
+
+#ifdef HAS_SPOT
+	// Point lights have a cutoff below -1, so they pass for every direction
+	float cosTheta = dot(lightToFragDir, directionCutOff.xyz);
+	if (cosTheta > directionCutOff.w)
+#endif
+	{
+		float diffuseCoefficient = max(dot(normal, fragToLightDir), 0.0);
+		diffuse = diffuseLinear.rgb * (diffuseCoefficient * diffuseColor);
+
+#ifdef SPECULAR
+		if (diffuseCoefficient > 0.0)
+		{
+			vec3 reflectDir = reflect(lightToFragDir, normal);
+			float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+			specular = specularQuadratic.rgb * (spec * specularColor);
+		}
+#endif
+
+#ifdef HAS_SHADOWS
+		float shadow = SpotShadow(lightIndex, fragPos);
+		diffuse *= shadow;
+		specular *= shadow;
+#endif
+	}
+
+	float lightToFragDist = length(fragPos - positionRange.xyz);
+	float attenuation = 1.0 / (ambientConstant.w + diffuseLinear.w * lightToFragDist + specularQuadratic.w * lightToFragDist * lightToFragDist);
+
+	// Fade the light out towards its range, so it doesn't end in a hard edge at the cluster boundaries
+	float rangeFactor = clamp(1.0 - pow(lightToFragDist / positionRange.w, 4.0), 0.0, 1.0);
+	attenuation *= rangeFactor * rangeFactor;
+
+	return (ambient + diffuse + specular) * attenuation;
+}
+)";
+
+// GLSL side of clustered lighting, pulled into fragment shaders with
+// #include "ClusteredLighting.glsl" (after "Materials.glsl", for the material).
+// Every cluster of the view frustum has a list of the lights that reach into it,
+// so a fragment only loops over the lights of its own cluster.
+const char* const ClusteredLightingSource = R"(
+#include "LocalLights.glsl"
+
+layout(std140) uniform ClusterGrid
+{
+	// Number of clusters along x, y and z, and the total number of lights
+	uvec4 clusterGridSize;
+
+	// Tile width and height in pixels, then the scale and bias mapping log(view depth) to a slice
+	vec4 clusterParams;
+};
+
+// Per cluster: offset and count of its lights in clusterLightIndices
+uniform usamplerBuffer clusterGrid;
+
+uniform usamplerBuffer clusterLightIndices;
+
+// Gets the index of the cluster containing a fragment
+// @param	viewDepth	Distance of the fragment from the camera plane
+uint GetClusterIndex(float viewDepth)
+{
+	uvec2 tile = uvec2(gl_FragCoord.xy / clusterParams.xy);
+	tile = min(tile, clusterGridSize.xy - 1u);
+	int slice = int(floor(log(viewDepth) * clusterParams.z + clusterParams.w));
+	uint z = uint(clamp(slice, 0, int(clusterGridSize.z) - 1));
+	return (z * clusterGridSize.y + tile.y) * clusterGridSize.x + tile.x;
+}
+
+// Sums the contributions of the point and spot lights reaching a fragment
+vec3 ShadeLocalLights(vec3 fragPos, vec3 normal, vec3 viewDir, float viewDepth)
+{
+	uvec2 cluster = texelFetch(clusterGrid, int(GetClusterIndex(viewDepth))).xy;
+
+	vec3 result = vec3(0.0);
+	for (uint i = 0u; i < cluster.y; ++i)
+	{
+		int lightIndex = int(texelFetch(clusterLightIndices, int(cluster.x + i)).x);
+		result += ShadeLocalLight(lightIndex, fragPos, normal, viewDir,
+			material.ambient, material.diffuse, material.specular, material.shininess);
+	}
+	return result;
+}
+)";
+
+// Point or spot light lit through the cluster grid
+struct LocalLight
+{
+	glm::vec3 position = glm::vec3(0.0f);
+
+	// Distance past which the light is ignored
+	float range = 10.0f;
+
+	// Spot lights only: direction of the cone and angle between its axis and its edge, in radians
+	glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+	float cutOffAngle = 0.0f;
+	bool isSpot = false;
+
+	glm::vec3 ambient = glm::vec3(0.0f);
+	glm::vec3 diffuse = glm::vec3(1.0f);
+	glm::vec3 specular = glm::vec3(1.0f);
+
+	float kConstant = 1.0f;
+	float kLinear = 0.09f;
+	float kQuadratic = 0.032f;
+};
+
+// Intensity below which a light counts as having faded out, unless told otherwise
+const float DefaultLightCutoff = 0.05f;
+
+// Range given to the lights that never fade out, well past the far plane of the view,
+// so that the cluster binning and the light volumes of the deferred path get finite bounds
+// (the light grid of the per-object lists keeps those lights aside, see LightGrid)
+const float MaxLightRange = 1000.0f;
+
+// Computes the distance at which a light's attenuation brings its brightest
+// color channel down to a cutoff intensity, past which it can be ignored
+// @param	light			Light to compute the range of
+// @param	cutoffIntensity	Intensity below which the light counts as faded out
+// @return	Returns the range of the light, at most MaxLightRange
+float ComputeLightRange(const LocalLight& light, float cutoffIntensity)
+{
+	auto maxChannel = [](const glm::vec3& color) { return std::max(color.r, std::max(color.g, color.b)); };
+	float peak = std::max(maxChannel(light.ambient), std::max(maxChannel(light.diffuse), maxChannel(light.specular)));
+
+	// Solve peak / (kConstant + kLinear * d + kQuadratic * d^2) = cutoffIntensity for d
+	float c = light.kConstant - peak / cutoffIntensity;
+	if (c >= 0.0f)
+	{
+		return 0.0f;
+	}
+	if (light.kQuadratic > 0.0f)
+	{
+		return std::min((-light.kLinear + std::sqrt(light.kLinear * light.kLinear - 4.0f * light.kQuadratic * c)) / (2.0f * light.kQuadratic), MaxLightRange);
+	}
+	if (light.kLinear > 0.0f)
+	{
+		return std::min(-c / light.kLinear, MaxLightRange);
+	}
+	return MaxLightRange;
+}
+
+// Light as laid out in the light buffer
+struct GpuLocalLight
+{
+	glm::vec3 position;
+	float range;
+	glm::vec3 direction;
+	float cosCutOff;
+	glm::vec3 ambient;
+	float kConstant;
+	glm::vec3 diffuse;
+	float kLinear;
+	glm::vec3 specular;
+	float kQuadratic;
+};
+
+static_assert(sizeof(GpuLocalLight) == TexelsPerLocalLight * sizeof(glm::vec4), "GpuLocalLight does not fill whole texels");
+
+// std140 mirror of the ClusterGrid block
+struct ClusterGridBlock
+{
+	glm::uvec4 gridSize;
+	glm::vec4 params;
+};
+
+static_assert(sizeof(ClusterGridBlock) == 32, "ClusterGridBlock does not match the std140 layout");
+
+// Counters of the last light binning
+struct ClusterStats
+{
+	size_t lightCount = 0;
+	size_t occupiedClusters = 0;
+	size_t lightIndexCount = 0;
+	size_t maxLightsPerCluster = 0;
+	double binningMs = 0.0;
+};
+
+// Texture buffer that grows as needed, for data uploaded every frame
+struct TextureBuffer
+{
+	GLuint tbo = 0;
+	GLuint texture = 0;
+	GLenum format = GL_NONE;
+	size_t capacity = 0;
+
+	void Create(GLenum textureFormat)
+	{
+		format = textureFormat;
+		glGenBuffers(1, &tbo);
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, tbo);
+	}
+
+	void Upload(const void* data, size_t size)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, tbo);
+		if (size > capacity || capacity == 0)
+		{
+			// Grow by half again, so a slowly growing light count doesn't reallocate every frame
+			capacity = std::max<size_t>(size + size / 2, 64);
+			glBufferData(GL_TEXTURE_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+			glBindTexture(GL_TEXTURE_BUFFER, texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, format, tbo);
+		}
+		else
+		{
+			// Orphan the old storage so we don't wait for draws still reading from it
+			glBufferData(GL_TEXTURE_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+		}
+		if (size > 0)
+		{
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+		}
+	}
+
+	void Bind(GLint textureUnit) const
+	{
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+	}
+
+	void Destroy()
+	{
+		glDeleteTextures(1, &texture);
+		glDeleteBuffers(1, &tbo);
+		texture = 0;
+		tbo = 0;
+		capacity = 0;
+	}
+};
+
+// Registers the clustered lighting buffers with the shaders, so that they can
+// include the GLSL side and get the buffers' texture units and block binding assigned.
+// Must be called before creating any shader program that uses them.
+void RegisterClusteredLighting()
+{
+	RegisterShaderInclude("LocalLights.glsl", LocalLightsSource);
+	RegisterShaderInclude("ClusteredLighting.glsl", ClusteredLightingSource);
+	RegisterUniformBlockBinding("ClusterGrid", ClusterGridBlockBinding);
+	RegisterSamplerBinding("localLights", LocalLightsTextureUnit);
+	RegisterSamplerBinding("clusterGrid", ClusterGridTextureUnit);
+	RegisterSamplerBinding("clusterLightIndices", ClusterLightIndicesTextureUnit);
+}
+
+// Clustered forward lighting. The view frustum is split into a grid of clusters,
+// tiled in screen space and sliced exponentially in depth. Every frame the lights
+// are binned into the clusters their range reaches on the CPU, and the light data,
+// per-cluster (offset, count) pairs and the flat light index list are uploaded
+// into texture buffers for the fragment shader.
+class ClusteredLighting
+{
+public:
+	static const int GridWidth = 16;
+	static const int GridHeight = 9;
+	static const int GridDepth = 24;
+	static const int ClusterCount = GridWidth * GridHeight * GridDepth;
+
+	// Point and spot lights of the scene
+	std::vector<LocalLight> lights;
+
+	// Whether Update bins the lights into the clusters. Renderers that only read
+	// the light buffer (like the deferred light volumes) can turn it off.
+	bool binLights = true;
+
+	void Create()
+	{
+		glGenBuffers(1, &ubo);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterGridBlock), nullptr, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, ClusterGridBlockBinding, ubo);
+
+		lightBuffer.Create(GL_RGBA32F);
+		gridBuffer.Create(GL_RG32UI);
+		indexBuffer.Create(GL_R32UI);
+	}
+
+	// Sets up the cluster grid for a perspective projection.
+	// Must be called again whenever the projection or the framebuffer size changes.
+	// @param	fovY				Vertical field of view in radians
+	// @param	aspectRatio			Width of the view divided by its height
+	// @param	zNear				Distance of the near plane
+	// @param	zFar				Distance of the far plane
+	// @param	framebufferWidth	Width of the framebuffer in pixels
+	// @param	framebufferHeight	Height of the framebuffer in pixels
+	void SetProjection(float fovY, float aspectRatio, float zNear, float zFar, int framebufferWidth, int framebufferHeight)
+	{
+		nearPlane = zNear;
+		farPlane = zFar;
+		tanHalfFovY = std::tan(fovY * 0.5f);
+		tanHalfFovX = tanHalfFovY * aspectRatio;
+
+		float tileWidth = std::ceil(framebufferWidth * 1.0f / GridWidth);
+		float tileHeight = std::ceil(framebufferHeight * 1.0f / GridHeight);
+		float logDepthRange = std::log(zFar / zNear);
+
+		ClusterGridBlock block;
+		block.gridSize = glm::uvec4(GridWidth, GridHeight, GridDepth, 0);
+		block.params = glm::vec4(tileWidth, tileHeight, GridDepth / logDepthRange, -GridDepth * std::log(zNear) / logDepthRange);
+		gridBlock = block;
+
+		// NDC edges of the tiles. The last tiles may be cut off by the framebuffer edge.
+		for (int x = 0; x <= GridWidth; ++x)
+		{
+			tileEdgesX[x] = std::min(-1.0f + 2.0f * x * tileWidth / framebufferWidth, 1.0f);
+		}
+		for (int y = 0; y <= GridHeight; ++y)
+		{
+			tileEdgesY[y] = std::min(-1.0f + 2.0f * y * tileHeight / framebufferHeight, 1.0f);
+		}
+		for (int z = 0; z <= GridDepth; ++z)
+		{
+			sliceDepths[z] = zNear * std::pow(zFar / zNear, z * 1.0f / GridDepth);
+		}
+
+		// View space bounding box of every cluster
+		for (int z = 0; z < GridDepth; ++z)
+		{
+			for (int y = 0; y < GridHeight; ++y)
+			{
+				for (int x = 0; x < GridWidth; ++x)
+				{
+					glm::vec3 boxMin(FLT_MAX);
+					glm::vec3 boxMax(-FLT_MAX);
+					for (int corner = 0; corner < 8; ++corner)
+					{
+						float depth = sliceDepths[z + ((corner >> 2) & 1)];
+						glm::vec3 p(
+							tileEdgesX[x + (corner & 1)] * tanHalfFovX * depth,
+							tileEdgesY[y + ((corner >> 1) & 1)] * tanHalfFovY * depth,
+							-depth);
+						boxMin = glm::min(boxMin, p);
+						boxMax = glm::max(boxMax, p);
+					}
+					clusterBoxes[GetClusterIndex(x, y, z)] = { boxMin, boxMax };
+				}
+			}
+		}
+	}
+
+	// Bins the lights into the clusters and uploads the light buffers
+	// @param	viewMatrix	View matrix of the camera
+	void Update(const glm::mat4& viewMatrix)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		gpuLights.resize(lights.size());
+		clusterLightPairs.clear();
+
+		for (size_t i = 0; i < lights.size(); ++i)
+		{
+			const LocalLight& light = lights[i];
+			GpuLocalLight& gpuLight = gpuLights[i];
+			gpuLight.position = light.position;
+			gpuLight.range = light.range;
+			gpuLight.direction = glm::normalize(light.direction);
+			gpuLight.cosCutOff = light.isSpot ? std::cos(light.cutOffAngle) : -2.0f;
+			gpuLight.ambient = light.ambient;
+			gpuLight.kConstant = light.kConstant;
+			gpuLight.diffuse = light.diffuse;
+			gpuLight.kLinear = light.kLinear;
+			gpuLight.specular = light.specular;
+			gpuLight.kQuadratic = light.kQuadratic;
+
+			// Spot lights are binned by the sphere around their whole range, which is
+			// conservative but keeps them in every cluster their ambient term reaches
+			if (binLights)
+			{
+				glm::vec3 center = glm::vec3(viewMatrix * glm::vec4(light.position, 1.0f));
+				BinSphere(static_cast<uint32_t>(i), center, light.range);
+			}
+		}
+
+		// Counting sort of the (cluster, light) pairs into per-cluster lists
+		std::fill(clusterRanges.begin(), clusterRanges.end(), glm::uvec2(0));
+		for (const glm::uvec2& pair : clusterLightPairs)
+		{
+			++clusterRanges[pair.x].y;
+		}
+
+		stats = ClusterStats();
+		uint32_t offset = 0;
+		for (glm::uvec2& range : clusterRanges)
+		{
+			range.x = offset;
+			offset += range.y;
+			stats.occupiedClusters += range.y > 0 ? 1 : 0;
+			stats.maxLightsPerCluster = std::max<size_t>(stats.maxLightsPerCluster, range.y);
+			range.y = 0;
+		}
+
+		lightIndices.resize(clusterLightPairs.size());
+		for (const glm::uvec2& pair : clusterLightPairs)
+		{
+			glm::uvec2& range = clusterRanges[pair.x];
+			lightIndices[range.x + range.y++] = pair.y;
+		}
+
+		stats.lightCount = lights.size();
+		stats.lightIndexCount = lightIndices.size();
+
+		gridBlock.gridSize.w = static_cast<uint32_t>(lights.size());
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ClusterGridBlock), &gridBlock);
+
+		lightBuffer.Upload(gpuLights.data(), gpuLights.size() * sizeof(GpuLocalLight));
+		gridBuffer.Upload(clusterRanges.data(), clusterRanges.size() * sizeof(glm::uvec2));
+		indexBuffer.Upload(lightIndices.data(), lightIndices.size() * sizeof(uint32_t));
+
+		stats.binningMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Gets the world space bounding spheres of the lights, as of the last update
+	// @param	spheres		Receives the position and range of every light
+	void GetLightSpheres(std::vector<glm::vec4>& spheres) const
+	{
+		spheres.resize(gpuLights.size());
+		for (size_t i = 0; i < gpuLights.size(); ++i)
+		{
+			spheres[i] = glm::vec4(gpuLights[i].position, gpuLights[i].range);
+		}
+	}
+
+	// Binds the light buffers to their texture units
+	void Bind() const
+	{
+		lightBuffer.Bind(LocalLightsTextureUnit);
+		gridBuffer.Bind(ClusterGridTextureUnit);
+		indexBuffer.Bind(ClusterLightIndicesTextureUnit);
+	}
+
+	// Gets the counters of the last update
+	const ClusterStats& GetStats() const
+	{
+		return stats;
+	}
+
+	void Destroy()
+	{
+		glDeleteBuffers(1, &ubo);
+		ubo = 0;
+		lightBuffer.Destroy();
+		gridBuffer.Destroy();
+		indexBuffer.Destroy();
+	}
+
+private:
+	// View space bounding box of a cluster
+	struct ClusterBox
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	static int GetClusterIndex(int x, int y, int z)
+	{
+		return (z * GridHeight + y) * GridWidth + x;
+	}
+
+	// Adds a light to every cluster its view space bounding sphere touches
+	void BinSphere(uint32_t lightIndex, const glm::vec3& center, float radius)
+	{
+		// Range of slices the sphere covers in depth
+		float minDepth = -center.z - radius;
+		float maxDepth = -center.z + radius;
+		if (maxDepth < nearPlane || minDepth > farPlane)
+		{
+			return;
+		}
+		int minZ = static_cast<int>(std::upper_bound(sliceDepths, sliceDepths + GridDepth + 1, minDepth) - sliceDepths) - 1;
+		int maxZ = static_cast<int>(std::upper_bound(sliceDepths, sliceDepths + GridDepth + 1, maxDepth) - sliceDepths) - 1;
+		minZ = glm::clamp(minZ, 0, GridDepth - 1);
+		maxZ = glm::clamp(maxZ, 0, GridDepth - 1);
+
+		// Range of tiles the sphere covers on screen, from the projection of its bounding box.
+		// When the box reaches behind the near plane its projection is unbounded, so all tiles are candidates.
+		int minX = 0;
+		int maxX = GridWidth - 1;
+		int minY = 0;
+		int maxY = GridHeight - 1;
+		if (minDepth > nearPlane)
+		{
+			glm::vec2 ndcMin(FLT_MAX);
+			glm::vec2 ndcMax(-FLT_MAX);
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				glm::vec3 p = center + radius * glm::vec3((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+				glm::vec2 ndc(p.x / (-p.z * tanHalfFovX), p.y / (-p.z * tanHalfFovY));
+				ndcMin = glm::min(ndcMin, ndc);
+				ndcMax = glm::max(ndcMax, ndc);
+			}
+			if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+			{
+				return;
+			}
+			minX = FindTile(tileEdgesX, GridWidth, ndcMin.x);
+			maxX = FindTile(tileEdgesX, GridWidth, ndcMax.x);
+			minY = FindTile(tileEdgesY, GridHeight, ndcMin.y);
+			maxY = FindTile(tileEdgesY, GridHeight, ndcMax.y);
+		}
+
+		// Exact sphere/box test for the candidate clusters
+		float radiusSq = radius * radius;
+		for (int z = minZ; z <= maxZ; ++z)
+		{
+			for (int y = minY; y <= maxY; ++y)
+			{
+				for (int x = minX; x <= maxX; ++x)
+				{
+					int cluster = GetClusterIndex(x, y, z);
+					const ClusterBox& box = clusterBoxes[cluster];
+					glm::vec3 closest = glm::clamp(center, box.min, box.max);
+					glm::vec3 d = closest - center;
+					if (glm::dot(d, d) <= radiusSq)
+					{
+						clusterLightPairs.push_back(glm::uvec2(cluster, lightIndex));
+					}
+				}
+			}
+		}
+	}
+
+	// Finds the tile containing an NDC coordinate, clamped to the grid
+	static int FindTile(const float* edges, int tileCount, float ndc)
+	{
+		int tile = static_cast<int>(std::upper_bound(edges, edges + tileCount + 1, ndc) - edges) - 1;
+		return glm::clamp(tile, 0, tileCount - 1);
+	}
+
+	GLuint ubo = 0;
+	TextureBuffer lightBuffer;
+	TextureBuffer gridBuffer;
+	TextureBuffer indexBuffer;
+
+	ClusterGridBlock gridBlock = {};
+	float nearPlane = 0.1f;
+	float farPlane = 100.0f;
+	float tanHalfFovX = 1.0f;
+	float tanHalfFovY = 1.0f;
+	float tileEdgesX[GridWidth + 1] = {};
+	float tileEdgesY[GridHeight + 1] = {};
+	float sliceDepths[GridDepth + 1] = {};
+	ClusterBox clusterBoxes[ClusterCount];
+
+	std::vector<GpuLocalLight> gpuLights;
+	std::vector<glm::uvec2> clusterLightPairs;
+	std::vector<glm::uvec2> clusterRanges = std::vector<glm::uvec2>(ClusterCount);
+	std::vector<uint32_t> lightIndices;
+
+	ClusterStats stats;
+};
+
+// Scatters colored point lights at random over the bounding box of a scene
+// @param	bounds			World space bounding spheres of the scene objects
+// @param	lightCount		Number of lights to add
+// @param	seed			Seed of the random positions and colors
+// @param	cutoffIntensity	Intensity at which the lights count as faded out (see ComputeLightRange)
+// @param	lights			Lights the new lights are appended to
+void ScatterPointLights(const std::vector<glm::vec4>& bounds, size_t lightCount, uint32_t seed, float cutoffIntensity,
+	std::vector<LocalLight>& lights)
+{
+	if (bounds.empty() || lightCount == 0)
+	{
+		return;
+	}
+
+	glm::vec3 boundsMin(FLT_MAX);
+	glm::vec3 boundsMax(-FLT_MAX);
+	for (const glm::vec4& sphere : bounds)
+	{
+		boundsMin = glm::min(boundsMin, glm::vec3(sphere) - sphere.w);
+		boundsMax = glm::max(boundsMax, glm::vec3(sphere) + sphere.w);
+	}
+
+	// Size the ranges so that every light overlaps a handful of its neighbors,
+	// whatever the light density
+	glm::vec3 extent = boundsMax - boundsMin;
+	float spacing = std::cbrt(extent.x * extent.y * extent.z / lightCount);
+	float range = glm::clamp(spacing * 2.0f, 1.0f, 10.0f);
+
+	SceneRandom random(seed);
+	lights.reserve(lights.size() + lightCount);
+	for (size_t i = 0; i < lightCount; ++i)
+	{
+		LocalLight light;
+		light.position = boundsMin + extent * glm::vec3(random.Uniform(), random.Uniform(), random.Uniform());
+
+		glm::vec3 color(random.Uniform(0.2f, 1.0f), random.Uniform(0.2f, 1.0f), random.Uniform(0.2f, 1.0f));
+		light.ambient = color * 0.01f;
+		light.diffuse = color;
+		light.specular = color;
+
+		// Steepen the falloff so that the light fades out right at its range,
+		// rather than getting cut off while still bright
+		float peak = std::max(color.r, std::max(color.g, color.b));
+		light.kQuadratic = std::max((peak / cutoffIntensity - light.kConstant - light.kLinear * range) / (range * range), 0.0f);
+		light.range = ComputeLightRange(light, cutoffIntensity);
+		lights.push_back(light);
+	}
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "ClusteredLighting.h"
+#include "GLUtils.h"
+#include "Instancing.h"
+#include "Mesh.h"
+#include "SceneMath.h"
+#include "VertexFormats.h"
+
+// Texture units the G-buffer attachments are bound to during the light passes
+const GLint GBufferNormalTextureUnit = 4;
+const GLint GBufferDiffuseTextureUnit = 5;
+const GLint GBufferSpecularTextureUnit = 6;
+const GLint GBufferAmbientTextureUnit = 7;
+const GLint GBufferDepthTextureUnit = 8;
+
+// GLSL helpers for reading back the G-buffer in the light passes,
+// pulled into shaders with #include "GBuffer.glsl"
+const char* const GBufferSource = R"(
+uniform sampler2D gNormal;
+uniform sampler2D gDiffuse;
+uniform sampler2D gSpecular;
+uniform sampler2D gAmbient;
+uniform sampler2D gDepth;
+
+// Inverse of the view projection matrix, to get world positions back from the depth buffer
+uniform mat4 invViewProjMatrix;
+
+// Surface attributes stored in the G-buffer for one pixel
+struct GBufferSample
+{
+	vec3 position;
+	float depth;
+	vec3 normal;
+	float shininess;
+	vec3 diffuse;
+	vec3 specular;
+	vec3 ambient;
+};
+
+GBufferSample SampleGBuffer(ivec2 pixel)
+{
+	GBufferSample surface;
+	surface.depth = texelFetch(gDepth, pixel, 0).r;
+
+	vec2 ndc = (vec2(pixel) + 0.5) / vec2(textureSize(gDepth, 0)) * 2.0 - 1.0;
+	vec4 position = invViewProjMatrix * vec4(ndc, surface.depth * 2.0 - 1.0, 1.0);
+	surface.position = position.xyz / position.w;
+
+	vec4 normalShininess = texelFetch(gNormal, pixel, 0);
+	surface.normal = normalize(normalShininess.xyz);
+	surface.shininess = normalShininess.w;
+
+	surface.diffuse = texelFetch(gDiffuse, pixel, 0).rgb;
+	surface.specular = texelFetch(gSpecular, pixel, 0).rgb;
+	surface.ambient = texelFetch(gAmbient, pixel, 0).rgb;
+	return surface;
+}
+)";
+
+// Registers the G-buffer with the shaders, so that they can include the
+// sampling helpers and get the attachments' texture units assigned.
+// Must be called before creating any shader program that uses them.
+void RegisterDeferredShading()
+{
+	RegisterShaderInclude("GBuffer.glsl", GBufferSource);
+	RegisterSamplerBinding("gNormal", GBufferNormalTextureUnit);
+	RegisterSamplerBinding("gDiffuse", GBufferDiffuseTextureUnit);
+	RegisterSamplerBinding("gSpecular", GBufferSpecularTextureUnit);
+	RegisterSamplerBinding("gAmbient", GBufferAmbientTextureUnit);
+	RegisterSamplerBinding("gDepth", GBufferDepthTextureUnit);
+}
+
+// Framebuffer with one texture per surface attribute (see GBuffer.fsh) and a
+// sampled depth texture, which the light passes read the positions back from
+class GBuffer
+{
+public:
+	static const int ColorAttachmentCount = 4;
+
+	// Creates the framebuffer and its attachments
+	// @param	bufferWidth		Width of the framebuffer in pixels
+	// @param	bufferHeight	Height of the framebuffer in pixels
+	void Create(int bufferWidth, int bufferHeight)
+	{
+		width = bufferWidth;
+		height = bufferHeight;
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+		// Normal and shininess, diffuse, specular and ambient color
+		const GLenum formats[ColorAttachmentCount] = { GL_RGBA16F, GL_RGBA8, GL_RGBA8, GL_RGBA8 };
+		GLenum drawBuffers[ColorAttachmentCount];
+		for (int i = 0; i < ColorAttachmentCount; ++i)
+		{
+			colorTextures[i] = CreateTexture(formats[i], GL_RGBA, GL_FLOAT);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorTextures[i], 0);
+			drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+		}
+		glDrawBuffers(ColorAttachmentCount, drawBuffers);
+
+		// Floating point depth, so positions reconstructed far from the camera stay accurate
+		depthTexture = CreateTexture(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			throw std::runtime_error("G-buffer framebuffer is incomplete");
+		}
+	}
+
+	// Makes the G-buffer the target of subsequent draws
+	void Bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, width, height);
+	}
+
+	// Binds the attachments to their texture units, for reading in the light passes
+	void BindTextures() const
+	{
+		const GLint textureUnits[ColorAttachmentCount] = { GBufferNormalTextureUnit, GBufferDiffuseTextureUnit, GBufferSpecularTextureUnit, GBufferAmbientTextureUnit };
+		for (int i = 0; i < ColorAttachmentCount; ++i)
+		{
+			glActiveTexture(GL_TEXTURE0 + textureUnits[i]);
+			glBindTexture(GL_TEXTURE_2D, colorTextures[i]);
+		}
+		glActiveTexture(GL_TEXTURE0 + GBufferDepthTextureUnit);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+	}
+
+	void Destroy()
+	{
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(ColorAttachmentCount, colorTextures);
+		glDeleteTextures(1, &depthTexture);
+		fbo = depthTexture = 0;
+	}
+
+	GLuint fbo = 0;
+	GLuint colorTextures[ColorAttachmentCount] = {};
+	GLuint depthTexture = 0;
+	int width = 0;
+	int height = 0;
+
+private:
+	GLuint CreateTexture(GLenum internalFormat, GLenum format, GLenum type) const
+	{
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+
+		// Only ever read with texelFetch, but a texture without mipmaps must not ask for them
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		return texture;
+	}
+};
+
+// Deferred shading. A geometry pass writes the surface attributes of the
+// nearest fragments into the G-buffer, then the light passes shade every
+// covered pixel once: the directional light over the whole screen, and each
+// point and spot light only over the pixels inside its bounding volume.
+// Light data comes from the light buffer of the clustered lighting, so both
+// paths light the scene the same way.
+class DeferredRenderer
+{
+public:
+	// Creates the G-buffer and the shader programs of the passes
+	// @param	bufferWidth		Width of the framebuffer being rendered to, in pixels
+	// @param	bufferHeight	Height of the framebuffer being rendered to, in pixels
+	// @param	cube			Cube mesh, used as the light volume proxy
+	// @param	programs		Batch to build the programs in, which must be finished before rendering
+	void Create(int bufferWidth, int bufferHeight, const GpuMesh& cube, ShaderProgramBatch& programs)
+	{
+		gBuffer.Create(bufferWidth, bufferHeight);
+		volumeIndexCount = cube.indexCount;
+		volumeIndexType = cube.indexType;
+
+		programs.Add(geometryProgram, "BasicLighting.vsh", "GBuffer.fsh");
+		programs.Add(directionalProgram, "DeferredDirectional.vsh", "DeferredDirectional.fsh");
+		programs.Add(volumeProgram, "DeferredLightVolume.vsh", "DeferredLightVolume.fsh");
+
+		// The full-screen triangle has no vertex data, but core profiles still need a VAO bound
+		glGenVertexArrays(1, &fullScreenVao);
+
+		// Construct VAO for the light volumes, reusing the cube's VBO and EBO
+		glGenVertexArrays(1, &volumeVao);
+		glBindVertexArray(volumeVao);
+		glBindBuffer(GL_ARRAY_BUFFER, cube.vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube.ebo);
+		SetupVertexAttributes(cube.vertexFormat, true);
+
+		// The light index of every volume is fed through the instance attribute
+		volumeInstances.Create(volumeVao);
+		glBindVertexArray(0);
+	}
+
+	// Clears the G-buffer and makes it the target of the geometry pass.
+	// The geometry is then drawn as usual, with its VAO bound.
+	void BeginGeometryPass()
+	{
+		gBuffer.Bind();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glUseProgram(geometryProgram.id);
+	}
+
+	// Gets the program of the geometry pass, which takes the material index of each draw
+	const ShaderProgram& GetGeometryProgram() const
+	{
+		return geometryProgram;
+	}
+
+	// Shades the pixels covered by the geometry pass into the target framebuffer,
+	// which must be the same size as the G-buffer. The scene depth is written
+	// to the target too, so forward passes drawn afterwards are still occluded.
+	// @param	targetFbo	Framebuffer receiving the shaded image
+	// @param	projMatrix	Projection matrix of the camera
+	// @param	viewMatrix	View matrix of the camera
+	// @param	lighting	Lights of the scene, updated and bound for this frame
+	void ShadeLights(GLuint targetFbo, const glm::mat4& projMatrix, const glm::mat4& viewMatrix, const ClusteredLighting& lighting)
+	{
+		glm::mat4 viewProjMatrix = projMatrix * viewMatrix;
+		glm::mat4 invViewProjMatrix = glm::inverse(viewProjMatrix);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+		glViewport(0, 0, gBuffer.width, gBuffer.height);
+		gBuffer.BindTextures();
+
+		// Directional light over every pixel. The depth test always passes,
+		// so that the shader can copy the scene depth into the target.
+		glDepthFunc(GL_ALWAYS);
+		glUseProgram(directionalProgram.id);
+		glUniformMatrix4fv(directionalProgram.GetUniformLocation(InvViewProjHash), 1, GL_FALSE, glm::value_ptr(invViewProjMatrix));
+		glBindVertexArray(fullScreenVao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		// Only the lights whose sphere is in view get a volume
+		lighting.GetLightSpheres(lightSpheres);
+		Frustum viewFrustum = ExtractFrustum(viewProjMatrix);
+		CullSpheres(viewFrustum, lightSpheres.data(), lightSpheres.size(), visibleLights);
+
+		if (!visibleLights.empty())
+		{
+			// Draw the back faces of the volumes where the scene is in front of them, so that
+			// a volume still covers its pixels with the camera inside it. Depth clamping keeps
+			// back faces beyond the far plane from being clipped away.
+			glDepthMask(GL_FALSE);
+			glDepthFunc(GL_GEQUAL);
+			glEnable(GL_DEPTH_CLAMP);
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_FRONT);
+
+			// Add up the contributions of all lights
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_ONE, GL_ONE);
+
+			glUseProgram(volumeProgram.id);
+			glUniformMatrix4fv(volumeProgram.GetUniformLocation(InvViewProjHash), 1, GL_FALSE, glm::value_ptr(invViewProjMatrix));
+			glBindVertexArray(volumeVao);
+			volumeInstances.Upload(visibleLights);
+			glDrawElementsInstanced(GL_TRIANGLES, volumeIndexCount, volumeIndexType, 0, visibleLights.size());
+
+			glDisable(GL_BLEND);
+			glCullFace(GL_BACK);
+			glDisable(GL_CULL_FACE);
+			glDisable(GL_DEPTH_CLAMP);
+			glDepthMask(GL_TRUE);
+		}
+
+		glDepthFunc(GL_LESS);
+	}
+
+	// Gets the number of light volumes drawn by the last ShadeLights
+	size_t GetVisibleLightCount() const
+	{
+		return visibleLights.size();
+	}
+
+	void Destroy()
+	{
+		volumeInstances.Destroy();
+		glDeleteVertexArrays(1, &volumeVao);
+		glDeleteVertexArrays(1, &fullScreenVao);
+		volumeVao = fullScreenVao = 0;
+		glDeleteProgram(geometryProgram.id);
+		glDeleteProgram(directionalProgram.id);
+		glDeleteProgram(volumeProgram.id);
+		gBuffer.Destroy();
+	}
+
+private:
+	GBuffer gBuffer;
+
+	ShaderProgram geometryProgram;
+	ShaderProgram directionalProgram;
+	ShaderProgram volumeProgram;
+
+	// Hash of the uniform both lighting passes take, looked up by hash since the
+	// programs are only built once the batch they were added to is finished
+	static constexpr uint32_t InvViewProjHash = HashName("invViewProjMatrix");
+
+	GLuint fullScreenVao = 0;
+	GLuint volumeVao = 0;
+	GLsizei volumeIndexCount = 0;
+	GLenum volumeIndexType = GL_UNSIGNED_INT;
+	InstanceBuffer volumeInstances;
+
+	std::vector<glm::vec4> lightSpheres;
+	std::vector<uint32_t> visibleLights;
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "GLUtils.h"
+
+// Fragment counts of the opaque geometry, as of the last collected frame
+struct OverdrawStats
+{
+	// Whether that frame ran the depth pre-pass
+	bool prepassEnabled = false;
+
+	// Fragments that passed the depth test in the shading pass, i.e. that ran the lighting shader
+	uint64_t shadedFragments = 0;
+
+	// Fragments that passed the depth test in the pre-pass. The pre-pass draws the
+	// same geometry in the same order with GL_LESS, so this is what the shading
+	// pass would have shaded without it.
+	uint64_t prepassFragments = 0;
+
+	// Number of frames summed up in the totals
+	size_t frameCount = 0;
+	uint64_t totalShadedFragments = 0;
+	uint64_t totalPrepassFragments = 0;
+};
+
+// Depth pre-pass for the forward path. The geometry is drawn once with a
+// position-only program and color writes off, laying down the depth of the
+// nearest surfaces. The shading pass then runs with GL_EQUAL and depth writes
+// off, so the lighting shader only runs for the fragments that end up visible.
+// GL_SAMPLES_PASSED queries count the fragments of both passes, read back a few
+// frames later like the GPU profiler's timestamps, so that counting never stalls.
+class DepthPrepass
+{
+public:
+	// Number of frames in flight before a frame's queries are read back
+	static const int FrameLatency = 3;
+
+	// Whether to run the pre-pass. Can be changed between frames.
+	bool enabled = false;
+
+	// Creates the depth-only program and the queries
+	// @param	programs	Batch to build the program in, which must be finished before rendering
+	void Create(ShaderProgramBatch& programs)
+	{
+		programs.Add(depthProgram, "DepthOnly.vsh", "DepthOnly.fsh");
+		for (FrameQueries& frame : frames)
+		{
+			glGenQueries(1, &frame.prepassQuery);
+			glGenQueries(1, &frame.shadingQuery);
+		}
+	}
+
+	// Starts a new frame, collecting the counts of the frame that used this slot before
+	void BeginFrame()
+	{
+		currentFrame = (currentFrame + 1) % FrameLatency;
+		CollectFrame(frames[currentFrame]);
+		frames[currentFrame].prepassUsed = false;
+		frames[currentFrame].shadingUsed = false;
+	}
+
+	// Switches to the depth-only program with color writes off.
+	// The geometry is then drawn as usual, with its VAO bound.
+	void BeginDepthPass()
+	{
+		FrameQueries& frame = frames[currentFrame];
+		frame.prepassUsed = true;
+
+		glUseProgram(depthProgram.id);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glBeginQuery(GL_SAMPLES_PASSED, frame.prepassQuery);
+	}
+
+	void EndDepthPass()
+	{
+		glEndQuery(GL_SAMPLES_PASSED);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+
+	// Sets up the depth test for the shading pass, which must draw exactly the
+	// same geometry as the pre-pass. Without the pre-pass, only counts the fragments.
+	void BeginShadingPass()
+	{
+		FrameQueries& frame = frames[currentFrame];
+		frame.shadingUsed = true;
+
+		if (frame.prepassUsed)
+		{
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
+		}
+		glBeginQuery(GL_SAMPLES_PASSED, frame.shadingQuery);
+	}
+
+	void EndShadingPass()
+	{
+		glEndQuery(GL_SAMPLES_PASSED);
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+	}
+
+	// Gets the fragment counts of the last collected frame
+	const OverdrawStats& GetStats() const
+	{
+		return stats;
+	}
+
+	void Destroy()
+	{
+		for (FrameQueries& frame : frames)
+		{
+			glDeleteQueries(1, &frame.prepassQuery);
+			glDeleteQueries(1, &frame.shadingQuery);
+			frame.prepassQuery = frame.shadingQuery = 0;
+		}
+		glDeleteProgram(depthProgram.id);
+		depthProgram.id = 0;
+	}
+
+private:
+	// Queries of one frame slot in the ring
+	struct FrameQueries
+	{
+		GLuint prepassQuery = 0;
+		GLuint shadingQuery = 0;
+		bool prepassUsed = false;
+		bool shadingUsed = false;
+	};
+
+	void CollectFrame(const FrameQueries& frame)
+	{
+		if (!frame.shadingUsed)
+		{
+			return;
+		}
+
+		// The shading query ends last, so if it is done, the pre-pass query is too
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(frame.shadingQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+		{
+			return;
+		}
+
+		GLuint64 shaded = 0;
+		GLuint64 prepass = 0;
+		glGetQueryObjectui64v(frame.shadingQuery, GL_QUERY_RESULT, &shaded);
+		if (frame.prepassUsed)
+		{
+			glGetQueryObjectui64v(frame.prepassQuery, GL_QUERY_RESULT, &prepass);
+		}
+
+		stats.prepassEnabled = frame.prepassUsed;
+		stats.shadedFragments = shaded;
+		stats.prepassFragments = prepass;
+		++stats.frameCount;
+		stats.totalShadedFragments += shaded;
+		stats.totalPrepassFragments += prepass;
+	}
+
+	ShaderProgram depthProgram;
+	FrameQueries frames[FrameLatency];
+	int currentFrame = 0;
+	OverdrawStats stats;
+};
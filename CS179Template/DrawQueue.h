@@ -0,0 +1,279 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "GLUtils.h"
+#include "Instancing.h"
+
+// Mesh that objects can be drawn with, with the instance buffer attached to its VAO.
+// Levels of detail of a mesh are meshes of their own, sharing its VAO.
+struct DrawMesh
+{
+	GLuint vao = 0;
+	GLsizei indexCount = 0;
+	GLenum indexType = GL_UNSIGNED_INT;
+
+	// Offset of the first index in the index buffer, in bytes
+	size_t indexOffset = 0;
+};
+
+// State changes and draw calls of the submissions since the last Clear
+struct DrawStats
+{
+	size_t instanceCount = 0;
+	size_t triangleCount = 0;
+	size_t drawCalls = 0;
+	size_t programChanges = 0;
+	size_t materialChanges = 0;
+	size_t meshChanges = 0;
+
+	// Changes of program, material and mesh an unsorted submission of the same objects would make
+	size_t unsortedStateChanges = 0;
+
+	// Gets the program, material and mesh changes made
+	size_t GetStateChanges() const
+	{
+		return programChanges + materialChanges + meshChanges;
+	}
+};
+
+// Objects to draw in a frame, submitted sorted by program, then material, then
+// mesh, so that the most expensive state changes happen the least often. The
+// object indices are uploaded to the instance buffer once in that order, and
+// every run of objects sharing a program, material and mesh becomes a single
+// instanced draw over its slice of the buffer.
+class DrawQueue
+{
+public:
+	// Empties the queue and resets the counters, at the start of a frame
+	void Clear()
+	{
+		entries.clear();
+		batches.clear();
+		programs.clear();
+		stats = DrawStats();
+	}
+
+	// Queues an object
+	// @param	program		Program to draw the object with
+	// @param	material	Index of the object's material in the material table
+	// @param	mesh		Index of the object's mesh in the meshes passed to Submit
+	// @param	objectIndex	Index of the object in the object transform buffer
+	void Add(const ShaderProgram& program, uint32_t material, uint32_t mesh, uint32_t objectIndex)
+	{
+		// Programs get a slot in the order they are first seen, which only takes a few
+		// comparisons since consecutive objects mostly share their program
+		if (programs.empty() || programs[lastProgramSlot] != &program)
+		{
+			auto it = std::find(programs.begin(), programs.end(), &program);
+			lastProgramSlot = it - programs.begin();
+			if (it == programs.end())
+			{
+				programs.push_back(&program);
+			}
+		}
+
+		uint64_t key = (static_cast<uint64_t>(lastProgramSlot) << ProgramShift)
+			| (static_cast<uint64_t>(material & FieldMask) << MaterialShift) | (mesh & FieldMask);
+		entries.push_back(std::make_pair(key, objectIndex));
+	}
+
+	// Sorts the queued objects and uploads their indices to the instance buffer
+	// @param	instances	Instance buffer attached to the VAO of every mesh
+	void Prepare(InstanceBuffer& instances)
+	{
+		// Count what drawing the objects in the order they were queued would change
+		stats.unsortedStateChanges = 0;
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			uint64_t changed = i == 0 ? ~0ull : entries[i].first ^ entries[i - 1].first;
+			stats.unsortedStateChanges += (changed >> ProgramShift != 0) + ((changed >> MaterialShift & FieldMask) != 0) + ((changed & FieldMask) != 0);
+		}
+
+		// Sorting by object index within a batch too keeps the transform fetches coherent
+		std::sort(entries.begin(), entries.end());
+
+		objectIndices.resize(entries.size());
+		batches.clear();
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			objectIndices[i] = entries[i].second;
+			if (batches.empty() || batches.back().key != entries[i].first)
+			{
+				Batch batch;
+				batch.key = entries[i].first;
+				batch.first = i;
+				batches.push_back(batch);
+			}
+			++batches.back().count;
+		}
+		instances.Upload(objectIndices);
+	}
+
+	// Draws the queued objects with their own programs and materials
+	// @param	meshes		Meshes the objects were queued with
+	// @param	instances	Instance buffer the objects were prepared into
+	void Submit(const std::vector<DrawMesh>& meshes, InstanceBuffer& instances)
+	{
+		Draw(meshes, instances, true, nullptr);
+	}
+
+	// Draws the queued objects with the program in use instead of their own, e.g. for a G-buffer pass
+	// @param	meshes		Meshes the objects were queued with
+	// @param	instances	Instance buffer the objects were prepared into
+	// @param	program		Program in use, taking the material index of each draw
+	void SubmitWithProgram(const std::vector<DrawMesh>& meshes, InstanceBuffer& instances, const ShaderProgram& program)
+	{
+		Draw(meshes, instances, false, &program);
+	}
+
+	// Draws the queued objects with the program in use, ignoring their materials, e.g. for a
+	// depth-only pass. Consecutive objects of the same mesh are drawn together.
+	// @param	meshes		Meshes the objects were queued with
+	// @param	instances	Instance buffer the objects were prepared into
+	void SubmitGeometry(const std::vector<DrawMesh>& meshes, InstanceBuffer& instances)
+	{
+		Draw(meshes, instances, false, nullptr);
+	}
+
+	// Gets the indices of the queued objects in the order Prepare put them in the instance buffer.
+	// Shaders get the position of their object in it as firstInstance + gl_InstanceID.
+	const std::vector<uint32_t>& GetObjectIndices() const
+	{
+		return objectIndices;
+	}
+
+	// Gets the counters of the submissions since the last Clear
+	const DrawStats& GetStats() const
+	{
+		return stats;
+	}
+
+private:
+	// Layout of the sort key: program slot, then material, then mesh
+	static const int ProgramShift = 48;
+	static const int MaterialShift = 24;
+	static const uint64_t FieldMask = (1ull << 24) - 1;
+
+	// Run of sorted objects sharing a program, material and mesh
+	struct Batch
+	{
+		uint64_t key = 0;
+		size_t first = 0;
+		size_t count = 0;
+	};
+
+	// Draws the batches, switching programs only if usePrograms, and setting materials only if there is a program to take them
+	void Draw(const std::vector<DrawMesh>& meshes, InstanceBuffer& instances, bool usePrograms, const ShaderProgram* fixedProgram)
+	{
+		const bool setMaterials = usePrograms || fixedProgram != nullptr;
+		const ShaderProgram* currentProgram = fixedProgram;
+		GLint materialLoc = fixedProgram ? fixedProgram->GetUniformLocation(MaterialIndexHash) : -1;
+		GLint firstInstanceLoc = fixedProgram ? fixedProgram->GetUniformLocation(FirstInstanceHash) : -1;
+		uint64_t currentMaterial = ~0ull;
+		GLuint currentVao = 0;
+		size_t currentFirst = 0;
+		size_t programFirst = ~size_t(0);
+
+		for (size_t i = 0; i < batches.size(); ++i)
+		{
+			const Batch& batch = batches[i];
+			uint64_t material = batch.key >> MaterialShift & FieldMask;
+			uint64_t mesh = batch.key & FieldMask;
+
+			// Without programs to switch, merge the following batches that only differ by program,
+			// or by material too if materials aren't set
+			size_t count = batch.count;
+			if (!usePrograms)
+			{
+				const uint64_t sharedMask = setMaterials ? (FieldMask << MaterialShift) | FieldMask : FieldMask;
+				while (i + 1 < batches.size() && (batches[i + 1].key & sharedMask) == (batch.key & sharedMask))
+				{
+					count += batches[++i].count;
+				}
+			}
+
+			if (usePrograms)
+			{
+				const ShaderProgram* program = programs[batch.key >> ProgramShift];
+				if (program != currentProgram)
+				{
+					glUseProgram(program->id);
+					currentProgram = program;
+					materialLoc = program->GetUniformLocation(MaterialIndexHash);
+					firstInstanceLoc = program->GetUniformLocation(FirstInstanceHash);
+
+					// The material index and first instance are per program, so the new one needs them set again
+					currentMaterial = ~0ull;
+					programFirst = ~size_t(0);
+					++stats.programChanges;
+				}
+			}
+
+			if (setMaterials && material != currentMaterial)
+			{
+				glUniform1i(materialLoc, static_cast<GLint>(material));
+				currentMaterial = material;
+				++stats.materialChanges;
+			}
+
+			// Levels of detail of the same mesh only draw another range of its index buffer
+			const DrawMesh& drawMesh = meshes[mesh];
+			if (drawMesh.vao != currentVao)
+			{
+				if (currentFirst != 0)
+				{
+					instances.SetFirstInstance(0);
+					currentFirst = 0;
+				}
+				glBindVertexArray(drawMesh.vao);
+				currentVao = drawMesh.vao;
+				++stats.meshChanges;
+			}
+
+			if (batch.first != currentFirst)
+			{
+				instances.SetFirstInstance(batch.first);
+				currentFirst = batch.first;
+			}
+
+			// gl_InstanceID restarts from 0 at every draw, so the shaders that need the position
+			// of their object in the instance buffer get told where the draw starts
+			if (firstInstanceLoc != -1 && batch.first != programFirst)
+			{
+				glUniform1i(firstInstanceLoc, static_cast<GLint>(batch.first));
+				programFirst = batch.first;
+			}
+			glDrawElementsInstanced(GL_TRIANGLES, drawMesh.indexCount, drawMesh.indexType,
+				reinterpret_cast<const void*>(drawMesh.indexOffset), static_cast<GLsizei>(count));
+			++stats.drawCalls;
+			stats.instanceCount += count;
+			stats.triangleCount += drawMesh.indexCount / 3 * count;
+		}
+
+		// Leave the VAO drawing from the start of the buffer, like everyone else expects
+		if (currentFirst != 0)
+		{
+			instances.SetFirstInstance(0);
+		}
+	}
+
+	// Hashes of the uniforms selecting the material and telling where the draw starts in
+	// the instance buffer, looked up by hash since the programs may have been built in a batch
+	static constexpr uint32_t MaterialIndexHash = HashName("materialIndex");
+	static constexpr uint32_t FirstInstanceHash = HashName("firstInstance");
+
+	std::vector<std::pair<uint64_t, uint32_t>> entries;
+	std::vector<const ShaderProgram*> programs;
+	size_t lastProgramSlot = 0;
+
+	std::vector<uint32_t> objectIndices;
+	std::vector<Batch> batches;
+	DrawStats stats;
+};
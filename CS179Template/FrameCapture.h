@@ -0,0 +1,275 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Captures rendered frames without stalling the render thread.
+// Each capture is read into one of a ring of pixel pack buffers, so glReadPixels
+// returns immediately and the copy happens on the GPU timeline. The buffer is only
+// mapped once the ring comes back around to it, by which point a fence tells us the
+// copy is done. The pixels are then handed to a background thread, which hashes
+// them and/or writes them out as PPM images, so the render thread only pays for a memcpy.
+class FrameCapture
+{
+public:
+	// Number of frames between reading a frame into a buffer and mapping that buffer
+	static const int RingSize = 3;
+
+	// Prefix of the PPM images written for every frame (e.g. "capture/frame_"), empty to write none
+	std::string imagePrefix;
+
+	// Path of the file receiving a hash of every frame, empty to write none
+	std::string hashPath;
+
+	// Creates the pixel pack buffers and starts the background thread
+	// @param	captureWidth	Width of the captured area in pixels
+	// @param	captureHeight	Height of the captured area in pixels
+	void Create(int captureWidth, int captureHeight)
+	{
+		width = captureWidth;
+		height = captureHeight;
+		frameSize = static_cast<size_t>(width) * height * 4;
+
+		glGenBuffers(RingSize, pbos);
+		for (int i = 0; i < RingSize; ++i)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, frameSize, nullptr, GL_STREAM_READ);
+			fences[i] = nullptr;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (!hashPath.empty())
+		{
+			hashFile.open(hashPath);
+			if (hashFile.fail())
+			{
+				throw std::runtime_error("cannot open " + hashPath);
+			}
+		}
+
+		stopWorker = false;
+		worker = std::thread(&FrameCapture::WorkerLoop, this);
+	}
+
+	// Queues a capture of the bound read framebuffer, and hands the capture
+	// that used the same ring slot RingSize frames ago to the background thread
+	// @param	frameIndex	Index of the frame, used to name its image and hash
+	void Capture(uint32_t frameIndex)
+	{
+		current = (current + 1) % RingSize;
+		Retire(current);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[current]);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		frameIndices[current] = frameIndex;
+		++capturedFrames;
+	}
+
+	// Waits for every capture still in the ring and for the background thread to process them
+	void Flush()
+	{
+		for (int i = 1; i <= RingSize; ++i)
+		{
+			Retire((current + i) % RingSize);
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return jobs.empty() && !busy; });
+	}
+
+	// Gets the number of frames queued for capture
+	size_t GetCapturedFrameCount() const
+	{
+		return capturedFrames;
+	}
+
+	// Gets the number of times a buffer had to be waited on because the GPU
+	// was more than RingSize frames behind. Should stay at 0.
+	size_t GetStallCount() const
+	{
+		return stalls;
+	}
+
+	void Destroy()
+	{
+		Flush();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopWorker = true;
+		}
+		wake.notify_one();
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+
+		glDeleteBuffers(RingSize, pbos);
+		for (int i = 0; i < RingSize; ++i)
+		{
+			pbos[i] = 0;
+		}
+		hashFile.close();
+	}
+
+private:
+	// Pixels of one captured frame waiting for the background thread
+	struct CaptureJob
+	{
+		uint32_t frameIndex;
+		std::vector<uint8_t> pixels;
+	};
+
+	// Copies the pixels of a ring slot out to the background thread and frees the slot,
+	// waiting for the GPU if it has not finished the copy yet
+	// @param	slot	Index of the slot in the ring
+	void Retire(int slot)
+	{
+		if (fences[slot] == nullptr)
+		{
+			return;
+		}
+
+		GLenum status = glClientWaitSync(fences[slot], 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			++stalls;
+			glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+		}
+		glDeleteSync(fences[slot]);
+		fences[slot] = nullptr;
+
+		CaptureJob job;
+		job.frameIndex = frameIndices[slot];
+		{
+			// Reuse the storage of processed jobs to avoid reallocating every frame
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!freeBuffers.empty())
+			{
+				job.pixels.swap(freeBuffers.back());
+				freeBuffers.pop_back();
+			}
+		}
+		job.pixels.resize(frameSize);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+		const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameSize, GL_MAP_READ_BIT);
+		if (mapped)
+		{
+			std::memcpy(job.pixels.data(), mapped, frameSize);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		wake.notify_one();
+	}
+
+	void WorkerLoop()
+	{
+		for (;;)
+		{
+			CaptureJob job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopWorker || !jobs.empty(); });
+				if (jobs.empty())
+				{
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+				busy = true;
+			}
+
+			Process(job);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				freeBuffers.push_back(std::move(job.pixels));
+				busy = false;
+			}
+			idle.notify_all();
+		}
+	}
+
+	// Runs on the background thread
+	void Process(const CaptureJob& job)
+	{
+		if (hashFile.is_open())
+		{
+			// FNV-1a over the whole frame
+			uint64_t hash = 14695981039346656037ull;
+			for (uint8_t byte : job.pixels)
+			{
+				hash = (hash ^ byte) * 1099511628211ull;
+			}
+			hashFile << job.frameIndex << " " << std::hex << std::setw(16) << std::setfill('0') << hash
+				<< std::dec << std::setfill(' ') << std::endl;
+		}
+
+		if (!imagePrefix.empty())
+		{
+			char suffix[32];
+			std::snprintf(suffix, sizeof(suffix), "%05u.ppm", job.frameIndex);
+
+			std::ofstream image(imagePrefix + suffix, std::ios::binary);
+			image << "P6\n" << width << " " << height << "\n255\n";
+
+			// OpenGL rows go bottom to top, and PPM has no alpha
+			std::vector<uint8_t> row(static_cast<size_t>(width) * 3);
+			for (int y = height - 1; y >= 0; --y)
+			{
+				const uint8_t* src = &job.pixels[static_cast<size_t>(y) * width * 4];
+				for (int x = 0; x < width; ++x)
+				{
+					row[x * 3] = src[x * 4];
+					row[x * 3 + 1] = src[x * 4 + 1];
+					row[x * 3 + 2] = src[x * 4 + 2];
+				}
+				image.write(reinterpret_cast<const char*>(row.data()), row.size());
+			}
+		}
+	}
+
+	int width = 0;
+	int height = 0;
+	size_t frameSize = 0;
+
+	GLuint pbos[RingSize] = {};
+	GLsync fences[RingSize] = {};
+	uint32_t frameIndices[RingSize] = {};
+	int current = 0;
+	size_t capturedFrames = 0;
+	size_t stalls = 0;
+
+	std::ofstream hashFile;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::deque<CaptureJob> jobs;
+	std::vector<std::vector<uint8_t>> freeBuffers;
+	bool busy = false;
+	bool stopWorker = false;
+};
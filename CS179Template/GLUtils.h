@@ -2,8 +2,248 @@
 
 #include <glad/glad.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "ProgramCache.h"
+
+// Hashes a uniform or attribute name (32-bit FNV-1a).
+// Being constexpr, names known at compile time can be hashed once up front
+// so that lookups never need to compare strings.
+// @param	name	Null-terminated name of the variable
+// @return	Returns the hash of the name
+constexpr uint32_t HashName(const char* name)
+{
+	uint32_t hash = 2166136261u;
+	while (*name != '\0')
+	{
+		hash ^= static_cast<uint8_t>(*name++);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Info about an active uniform or attribute of a linked shader program
+struct ShaderVariable
+{
+	std::string name;
+	GLint location;
+	GLenum type;
+	GLint size;
+};
+
+// A linked shader program along with the active uniforms and attributes
+// reflected from it at link time. Uniform locations should be looked up once
+// (e.g. before the render loop) and reused, rather than querying the driver
+// with glGetUniformLocation every frame.
+struct ShaderProgram
+{
+	// Handle to the OpenGL program object
+	GLuint id = 0;
+
+	// Active uniforms, attributes and uniform blocks of the program
+	// (for uniform blocks, location holds the block index and size the data size in bytes)
+	std::vector<ShaderVariable> uniforms;
+	std::vector<ShaderVariable> attributes;
+	std::vector<ShaderVariable> uniformBlocks;
+
+	// Uniform/attribute locations keyed by the hash of their name
+	std::unordered_map<uint32_t, GLint> uniformLocations;
+	std::unordered_map<uint32_t, GLint> attributeLocations;
+
+	// Gets the location of a uniform in this program
+	// @param	nameHash	Hash of the uniform name (see HashName)
+	// @return	Returns the uniform location, or -1 if the uniform is not active
+	GLint GetUniformLocation(uint32_t nameHash) const
+	{
+		auto it = uniformLocations.find(nameHash);
+		return it != uniformLocations.end() ? it->second : -1;
+	}
+
+	GLint GetUniformLocation(const char* name) const
+	{
+		return GetUniformLocation(HashName(name));
+	}
+
+	// Gets the location of a vertex attribute in this program
+	// @param	nameHash	Hash of the attribute name (see HashName)
+	// @return	Returns the attribute location, or -1 if the attribute is not active
+	GLint GetAttributeLocation(uint32_t nameHash) const
+	{
+		auto it = attributeLocations.find(nameHash);
+		return it != attributeLocations.end() ? it->second : -1;
+	}
+
+	GLint GetAttributeLocation(const char* name) const
+	{
+		return GetAttributeLocation(HashName(name));
+	}
+};
+
+// Gets the table of uniform block binding points shared by every shader program.
+// Programs that declare a block with a registered name get it bound to the same
+// binding point at link time, so a single buffer range can feed all of them.
+// @return	Returns the map from uniform block name to binding point
+std::unordered_map<std::string, GLuint>& UniformBlockBindings()
+{
+	static std::unordered_map<std::string, GLuint> bindings;
+	return bindings;
+}
+
+// Registers the binding point used by a uniform block in every shader program
+// created afterwards.
+// @param	blockName	Name of the uniform block, as declared in GLSL
+// @param	binding		Uniform buffer binding point
+void RegisterUniformBlockBinding(const std::string& blockName, GLuint binding)
+{
+	UniformBlockBindings()[blockName] = binding;
+}
+
+// Gets the table of texture units assigned to sampler uniforms shared by every
+// shader program. Programs with an active sampler of a registered name get it
+// pointed at the same texture unit at link time.
+// @return	Returns the map from sampler uniform name to texture unit
+std::unordered_map<std::string, GLint>& SamplerBindings()
+{
+	static std::unordered_map<std::string, GLint> bindings;
+	return bindings;
+}
+
+// Registers the texture unit used by a sampler uniform in every shader program
+// created afterwards.
+// @param	samplerName		Name of the sampler uniform, as declared in GLSL
+// @param	textureUnit		Texture unit index (0 for GL_TEXTURE0, ...)
+void RegisterSamplerBinding(const std::string& samplerName, GLint textureUnit)
+{
+	SamplerBindings()[samplerName] = textureUnit;
+}
+
+// Gets the table of shader sources that can be pulled into other shaders
+// with an #include "name" directive, without having to exist on disk.
+// @return	Returns the map from include name to shader source
+std::unordered_map<std::string, std::string>& ShaderIncludes()
+{
+	static std::unordered_map<std::string, std::string> includes;
+	return includes;
+}
+
+// Registers a shader source that can be included by name from other shaders
+// @param	name	Name used in the #include directive
+// @param	source	Shader source to insert in place of the directive
+void RegisterShaderInclude(const std::string& name, const std::string& source)
+{
+	ShaderIncludes()[name] = source;
+}
+
+// Queries all active uniforms and attributes of a linked program
+// and stores their names, types and locations in the program object.
+// @param	program		Shader program whose id refers to a successfully linked program
+void ReflectShaderProgram(ShaderProgram& program)
+{
+	program.uniforms.clear();
+	program.attributes.clear();
+	program.uniformLocations.clear();
+	program.attributeLocations.clear();
+
+	GLint maxNameLen = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLen);
+	GLint maxAttribNameLen = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxAttribNameLen);
+	std::vector<char> nameBuffer(std::max(std::max(maxNameLen, maxAttribNameLen), 1));
+
+	// Samplers are assigned their texture units through the program, so make it current for now
+	GLint prevProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+	glUseProgram(program.id);
+
+	GLint uniformCount = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORMS, &uniformCount);
+	for (GLint i = 0; i < uniformCount; ++i)
+	{
+		ShaderVariable uniform;
+		GLsizei nameLen = 0;
+		glGetActiveUniform(program.id, i, nameBuffer.size(), &nameLen, &uniform.size, &uniform.type, nameBuffer.data());
+		uniform.name.assign(nameBuffer.data(), nameLen);
+
+		// Uniforms inside uniform blocks have no location
+		uniform.location = glGetUniformLocation(program.id, uniform.name.c_str());
+		if (uniform.location < 0)
+		{
+			continue;
+		}
+
+		program.uniformLocations[HashName(uniform.name.c_str())] = uniform.location;
+
+		// Arrays are reported as "name[0]", so also make them reachable as "name"
+		const std::string arraySuffix = "[0]";
+		if (uniform.name.size() > arraySuffix.size() &&
+			uniform.name.compare(uniform.name.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0)
+		{
+			std::string baseName = uniform.name.substr(0, uniform.name.size() - arraySuffix.size());
+			program.uniformLocations[HashName(baseName.c_str())] = uniform.location;
+		}
+
+		// Point the sampler at its shared texture unit, if it has one
+		auto sampler = SamplerBindings().find(uniform.name);
+		if (sampler != SamplerBindings().end())
+		{
+			glUniform1i(uniform.location, sampler->second);
+		}
+
+		program.uniforms.push_back(uniform);
+	}
+
+	glUseProgram(prevProgram);
+
+	GLint attributeCount = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+	for (GLint i = 0; i < attributeCount; ++i)
+	{
+		ShaderVariable attribute;
+		GLsizei nameLen = 0;
+		glGetActiveAttrib(program.id, i, nameBuffer.size(), &nameLen, &attribute.size, &attribute.type, nameBuffer.data());
+		attribute.name.assign(nameBuffer.data(), nameLen);
+		attribute.location = glGetAttribLocation(program.id, attribute.name.c_str());
+
+		program.attributeLocations[HashName(attribute.name.c_str())] = attribute.location;
+		program.attributes.push_back(attribute);
+	}
+
+	GLint maxBlockNameLen = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxBlockNameLen);
+	nameBuffer.resize(std::max<size_t>(nameBuffer.size(), maxBlockNameLen));
+
+	GLint blockCount = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+	for (GLint i = 0; i < blockCount; ++i)
+	{
+		ShaderVariable block;
+		GLsizei nameLen = 0;
+		glGetActiveUniformBlockName(program.id, i, nameBuffer.size(), &nameLen, nameBuffer.data());
+		block.name.assign(nameBuffer.data(), nameLen);
+		block.location = i;
+		block.type = GL_NONE;
+		glGetActiveUniformBlockiv(program.id, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.size);
+
+		// Hook the block up to its shared binding point, if it has one
+		auto binding = UniformBlockBindings().find(block.name);
+		if (binding != UniformBlockBindings().end())
+		{
+			glUniformBlockBinding(program.id, i, binding->second);
+		}
+
+		program.uniformBlocks.push_back(block);
+	}
+}
 
 // Reads the contents of the file specified by the file path,
 // and places the file contents into a string.
@@ -24,9 +264,114 @@ bool ReadFile(const std::string& filePath, std::string& outputString) {
 	return true;
 }
 
-// Creates a shader object given the shader type and the corresponding shader source
-// @param	type	Shader type (GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, ...)
+// Replaces every #include "name" line in a shader source with the contents of
+// the registered shader include of that name (see RegisterShaderInclude),
+// or otherwise with the contents of the file at that path.
+// @param	source	Shader source (as string)
+// @return	Returns the shader source with all includes expanded
+std::string ResolveShaderIncludes(const std::string& source)
+{
+	std::string result;
+	std::istringstream stream(source);
+	std::string line;
+	while (std::getline(stream, line))
+	{
+		size_t directive = line.find("#include");
+		if (directive == std::string::npos || line.find_first_not_of(" \t") != directive)
+		{
+			result += line + "\n";
+			continue;
+		}
+
+		size_t nameStart = line.find('"', directive);
+		size_t nameEnd = nameStart != std::string::npos ? line.find('"', nameStart + 1) : std::string::npos;
+		if (nameEnd == std::string::npos)
+		{
+			throw std::runtime_error(std::string("malformed shader include: ") + line);
+		}
+		std::string name = line.substr(nameStart + 1, nameEnd - nameStart - 1);
+
+		auto include = ShaderIncludes().find(name);
+		if (include != ShaderIncludes().end())
+		{
+			result += ResolveShaderIncludes(include->second);
+			continue;
+		}
+
+		std::string includeSource;
+		if (!ReadFile(name, includeSource))
+		{
+			throw std::runtime_error(std::string("failed to read shader include: ") + name);
+		}
+		result += ResolveShaderIncludes(includeSource);
+	}
+
+	return result;
+}
+
+// Inserts a #define line for each of the given names right after the #version
+// line of a shader source (or at its start if it has none), so that the rest
+// of the source and its includes can be switched with #ifdef
 // @param	source	Shader source (as string)
+// @param	defines	Names to define, optionally followed by a space and a value
+// @return	Returns the shader source with the defines inserted
+std::string InjectShaderDefines(const std::string& source, const std::vector<std::string>& defines)
+{
+	if (defines.empty())
+	{
+		return source;
+	}
+
+	std::string defineLines;
+	for (const std::string& define : defines)
+	{
+		defineLines += "#define " + define + "\n";
+	}
+
+	size_t version = source.find("#version");
+	if (version == std::string::npos)
+	{
+		return defineLines + source;
+	}
+	size_t lineEnd = source.find('\n', version);
+	if (lineEnd == std::string::npos)
+	{
+		return source + "\n" + defineLines;
+	}
+	return source.substr(0, lineEnd + 1) + defineLines + source.substr(lineEnd + 1);
+}
+
+// Enum of GL_KHR_parallel_shader_compile, which the GL 3.3 loader doesn't provide
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Whether the driver compiles and links shaders in the background (GL_KHR_parallel_shader_compile),
+// letting GL_COMPLETION_STATUS_KHR be polled without waiting for the build to finish
+// @return	Returns true if the extension is available
+bool HasParallelShaderCompile()
+{
+	static const bool available = [] {
+		GLint extensionCount = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+		for (GLint i = 0; i < extensionCount; ++i)
+		{
+			const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			if (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}();
+	return available;
+}
+
+// Creates a shader object given the shader type and the corresponding shader source,
+// and starts compiling it. The compile status is left for CheckShaderCompileStatus,
+// since asking for it waits for the compiler.
+// @param	type	Shader type (GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, ...)
+// @param	source	Shader source (as string), with its includes already expanded (see ResolveShaderIncludes)
 // @return	Returns the handle to the shader object
 GLuint CreateShader(const GLuint& type, const std::string& source)
 {
@@ -39,6 +384,15 @@ GLuint CreateShader(const GLuint& type, const std::string& source)
 	glShaderSource(shader, 1, &sourceCStr, &sourceLen);
 	glCompileShader(shader);
 
+	return shader;
+}
+
+// Prints the compile log of a shader that failed to compile
+// @param	type	Shader type (GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, ...)
+// @param	shader	Handle to the shader object
+// @return	Returns true if the shader compiled
+bool CheckShaderCompileStatus(const GLuint& type, GLuint shader)
+{
 	// Check compilation status
 	GLint compileStatus;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
@@ -65,73 +419,449 @@ GLuint CreateShader(const GLuint& type, const std::string& source)
 		errorMsg += std::string(infoLog);
 
 		std::cout << errorMsg << std::endl;
+		return false;
 	}
 
-	return shader;
+	return true;
 }
 
-GLuint CreateShaderProgramFromSource(const std::string& vertexShaderSource, const std::string& fragmentShaderSource)
+// Shader program whose build was started by BeginShaderProgram but not yet checked
+struct PendingShaderProgram
 {
-	// Create the vertex and fragment shader objects
-	GLuint vsh = CreateShader(GL_VERTEX_SHADER, vertexShaderSource);
-	GLuint fsh = CreateShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
+	// Handles to the program and shader objects (the shaders are 0 if the program came from the program cache)
+	GLuint program = 0;
+	GLuint vsh = 0;
+	GLuint fsh = 0;
+
+	// Key of the program in the program cache
+	uint64_t cacheKey = 0;
+
+	// Time spent issuing the compiles and the link. Together with the time FinishShaderProgram
+	// waits, that is what the build cost the calling thread, without the work done in between
+	// (other programs of a batch, frames rendered during a hot reload).
+	double issueMs = 0.0;
+};
+
+// Starts building a shader program from the given vertex and fragment shader sources,
+// loading it from the program cache when possible. Nothing waits for the driver,
+// so the build can run in the background until FinishShaderProgram.
+// @param	vertexShaderSource		Vertex shader source (as string)
+// @param	fragmentShaderSource	Fragment shader source (as string)
+// @param	defines					Names defined at the top of both shaders (see InjectShaderDefines)
+// @return	Returns the program being built
+PendingShaderProgram BeginShaderProgram(const std::string& vertexShaderSource, const std::string& fragmentShaderSource,
+	const std::vector<std::string>& defines = std::vector<std::string>())
+{
+	// Expand the defines and any #include directives, since GLSL has none of its own.
+	// The expanded sources are what the program cache is keyed on.
+	std::string vshSource = ResolveShaderIncludes(InjectShaderDefines(vertexShaderSource, defines));
+	std::string fshSource = ResolveShaderIncludes(InjectShaderDefines(fragmentShaderSource, defines));
 
 	// Create a shader program object
-	GLuint program = glCreateProgram();
+	PendingShaderProgram pending;
+	pending.program = glCreateProgram();
+
+	// Try the binary the program cache kept from an earlier run first
+	ProgramBinaryCache& cache = ProgramCache();
+	if (cache.IsEnabled())
+	{
+		pending.cacheKey = cache.ComputeKey(vshSource, fshSource);
+		if (cache.Load(pending.cacheKey, pending.program))
+		{
+			return pending;
+		}
+
+		// A program the driver refused a binary for may be left in a failed state, so start over
+		glDeleteProgram(pending.program);
+		pending.program = glCreateProgram();
+		cache.PrepareForStore(pending.program);
+	}
+
+	auto issueStart = std::chrono::steady_clock::now();
+
+	// Create the vertex and fragment shader objects
+	pending.vsh = CreateShader(GL_VERTEX_SHADER, vshSource);
+	pending.fsh = CreateShader(GL_FRAGMENT_SHADER, fshSource);
 
 	// Attach the vertex and fragment shaders to the program
-	glAttachShader(program, vsh);
-	glAttachShader(program, fsh);
+	glAttachShader(pending.program, pending.vsh);
+	glAttachShader(pending.program, pending.fsh);
 
 	// Link all attached shaders
-	glLinkProgram(program);
+	glLinkProgram(pending.program);
 
-	// Check shader program link status
-	GLint linkStatus;
-	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-	if (linkStatus != GL_TRUE) {
-		char infoLog[512];
-		GLsizei infoLogLen = sizeof(infoLog);
-		glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
-		throw std::runtime_error(std::string("program link error: ") + infoLog);
-		return 0;
+	pending.issueMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - issueStart).count();
+	return pending;
+}
+
+// Checks whether the build of a shader program is done, without waiting for it.
+// Without GL_KHR_parallel_shader_compile, there is no way to tell, so it always is.
+// @param	pending		Program being built
+// @return	Returns true if FinishShaderProgram won't have to wait for the driver
+bool IsShaderProgramReady(const PendingShaderProgram& pending)
+{
+	if (pending.vsh == 0 || !HasParallelShaderCompile())
+	{
+		return true;
 	}
 
-	// Detach the vertex and fragment shaders from the program,
-	// since they've already been linked and we don't need them anymore.
-	glDetachShader(program, vsh);
-	glDetachShader(program, fsh);
+	GLint completed = GL_FALSE;
+	glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &completed);
+	return completed == GL_TRUE;
+}
+
+// Deletes a program whose build was started, without checking it
+// @param	pending		Program being built
+void CancelShaderProgram(PendingShaderProgram& pending)
+{
+	glDeleteShader(pending.vsh);
+	glDeleteShader(pending.fsh);
+	glDeleteProgram(pending.program);
+	pending = PendingShaderProgram();
+}
+
+// Checks the build of a shader program, waiting for it to finish if needed,
+// and reflects its active uniforms and attributes.
+// Throws if the program failed to build, deleting it.
+// @param	pending		Program being built
+// @return	Returns the shader program object
+ShaderProgram FinishShaderProgram(PendingShaderProgram& pending)
+{
+	GLuint program = pending.program;
+	if (pending.vsh != 0)
+	{
+		auto waitStart = std::chrono::steady_clock::now();
+
+		// Print the log of every shader that failed, not just the first
+		bool vshCompiled = CheckShaderCompileStatus(GL_VERTEX_SHADER, pending.vsh);
+		bool fshCompiled = CheckShaderCompileStatus(GL_FRAGMENT_SHADER, pending.fsh);
+
+		// Check shader program link status
+		GLint linkStatus;
+		glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+		if (!vshCompiled || !fshCompiled || linkStatus != GL_TRUE) {
+			char infoLog[512];
+			GLsizei infoLogLen = sizeof(infoLog);
+			glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
+			CancelShaderProgram(pending);
+			throw std::runtime_error(std::string("program link error: ") + infoLog);
+		}
+
+		// Detach the vertex and fragment shaders from the program,
+		// since they've already been linked and we don't need them anymore.
+		glDetachShader(program, pending.vsh);
+		glDetachShader(program, pending.fsh);
 
-	// Delete the vertex and fragment shader objects
-	glDeleteShader(vsh);
-	glDeleteShader(fsh);
+		// Delete the vertex and fragment shader objects
+		glDeleteShader(pending.vsh);
+		glDeleteShader(pending.fsh);
 
-	return program;
+		// The time from BeginShaderProgram to here would count the other builds of a batch over and
+		// over, so only the issuing and the waiting are counted. Over a batch, those add up to its total.
+		double buildMs = pending.issueMs
+			+ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+		ProgramBinaryCache& cache = ProgramCache();
+		if (cache.IsEnabled())
+		{
+			cache.Store(pending.cacheKey, program, buildMs);
+		}
+		else
+		{
+			cache.RecordUncachedBuild(buildMs);
+		}
+	}
+	pending = PendingShaderProgram();
+
+	// List the active uniforms and attributes once, so that locations never
+	// have to be looked up by string while rendering
+	ShaderProgram shaderProgram;
+	shaderProgram.id = program;
+	ReflectShaderProgram(shaderProgram);
+
+	return shaderProgram;
+}
+
+// Creates a shader program from the given vertex and fragment shader sources,
+// and reflects its active uniforms and attributes
+// @param	vertexShaderSource		Vertex shader source (as string)
+// @param	fragmentShaderSource	Fragment shader source (as string)
+// @param	defines					Names defined at the top of both shaders (see InjectShaderDefines)
+// @return	Returns the shader program object
+ShaderProgram CreateShaderProgramFromSource(const std::string& vertexShaderSource, const std::string& fragmentShaderSource,
+	const std::vector<std::string>& defines = std::vector<std::string>())
+{
+	PendingShaderProgram pending = BeginShaderProgram(vertexShaderSource, fragmentShaderSource, defines);
+	return FinishShaderProgram(pending);
+}
+
+// Reads a shader source file, throwing if it cannot be read
+// @param	path	Path to the shader file
+// @return	Returns the shader source
+std::string ReadShaderFile(const std::string& path)
+{
+	std::string source;
+	if (!ReadFile(path, source))
+	{
+		std::cout << "Failed to read shader file: " << path << std::endl;
+		throw std::runtime_error(std::string("failed to read shader file: ") + path);
+	}
+	return source;
 }
 
 // Creates a shader program based on the given vertex and fragment shader source file paths
 // @param	vertexShaderPath	Path to the vertex shader file
 // @param	fragmentShaderPath	Path to the fragment shader file
-// @return	Returns the handle to the shader program
-GLuint CreateShaderProgram(const std::string& vertexShaderPath, const std::string& fragmentShaderPath)
+// @param	defines				Names defined at the top of both shaders (see InjectShaderDefines)
+// @return	Returns the shader program object
+ShaderProgram CreateShaderProgram(const std::string& vertexShaderPath, const std::string& fragmentShaderPath,
+	const std::vector<std::string>& defines = std::vector<std::string>())
 {
-	// Read the source code from the vertex shader file
-	std::string vshCode;
-	if (!ReadFile(vertexShaderPath, vshCode))
+	return CreateShaderProgramFromSource(ReadShaderFile(vertexShaderPath), ReadShaderFile(fragmentShaderPath), defines);
+}
+
+// Builds several shader programs at once. Every compile and link is issued
+// before any status is asked for, since asking waits for that build to finish.
+// Drivers with threaded compilers can then work on all of them at the same time,
+// instead of one after the other.
+class ShaderProgramBatch
+{
+public:
+	// Starts building a program from shader files
+	// @param	program				Where to put the program once the batch is finished
+	// @param	vertexShaderPath	Path to the vertex shader file
+	// @param	fragmentShaderPath	Path to the fragment shader file
+	// @param	defines				Names defined at the top of both shaders (see InjectShaderDefines)
+	void Add(ShaderProgram& program, const std::string& vertexShaderPath, const std::string& fragmentShaderPath,
+		const std::vector<std::string>& defines = std::vector<std::string>())
 	{
-		std::cout << "Failed to read shader file " << vertexShaderPath << std::endl;
-		throw std::runtime_error(std::string("failed to read shader file: ") + vertexShaderPath);
-		return 0;
+		AddFromSource(program, ReadShaderFile(vertexShaderPath), ReadShaderFile(fragmentShaderPath), defines);
 	}
 
-	// Read the source code from the fragment shader file
-	std::string fshCode;
-	if (!ReadFile(fragmentShaderPath, fshCode))
+	// Starts building a program from shader sources
+	// @param	program					Where to put the program once the batch is finished
+	// @param	vertexShaderSource		Vertex shader source (as string)
+	// @param	fragmentShaderSource	Fragment shader source (as string)
+	// @param	defines					Names defined at the top of both shaders (see InjectShaderDefines)
+	void AddFromSource(ShaderProgram& program, const std::string& vertexShaderSource, const std::string& fragmentShaderSource,
+		const std::vector<std::string>& defines = std::vector<std::string>())
 	{
-		std::cout << "Failed to read shader file: " << fragmentShaderPath << std::endl;
-		throw std::runtime_error(std::string("failed to read shader file: ") + fragmentShaderPath);
-		return 0;
+		if (entries.empty())
+		{
+			batchStart = std::chrono::steady_clock::now();
+		}
+
+		Entry entry;
+		entry.target = &program;
+		entry.pending = BeginShaderProgram(vertexShaderSource, fragmentShaderSource, defines);
+		entries.push_back(entry);
 	}
 
-	return CreateShaderProgramFromSource(vshCode, fshCode);
-}
+	// Checks every program of the batch and puts each where it was asked for.
+	// Throws if a program failed to build, deleting the rest of the batch.
+	void Finish()
+	{
+		auto checkStart = std::chrono::steady_clock::now();
+		try
+		{
+			for (Entry& entry : entries)
+			{
+				*entry.target = FinishShaderProgram(entry.pending);
+			}
+		}
+		catch (...)
+		{
+			for (Entry& entry : entries)
+			{
+				CancelShaderProgram(entry.pending);
+			}
+			entries.clear();
+			throw;
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		programCount += entries.size();
+		submitMs += std::chrono::duration<double, std::milli>(checkStart - batchStart).count();
+		totalMs += std::chrono::duration<double, std::milli>(end - batchStart).count();
+		entries.clear();
+	}
+
+	// Gets the number of programs built by the finished batches
+	size_t GetProgramCount() const
+	{
+		return programCount;
+	}
+
+	// Gets the time spent issuing the builds, and in total until every program was checked
+	double GetSubmitMs() const
+	{
+		return submitMs;
+	}
+
+	double GetTotalMs() const
+	{
+		return totalMs;
+	}
+
+	// Prints the number of programs built and how long it took
+	void Print(std::ostream& out) const
+	{
+		out << "Built " << programCount << " shader programs in " << totalMs << " ms ("
+			<< submitMs << " ms issuing, " << totalMs - submitMs << " ms waiting for the driver"
+			<< (HasParallelShaderCompile() ? ", parallel compile" : "") << ")" << std::endl;
+	}
+
+private:
+	struct Entry
+	{
+		ShaderProgram* target = nullptr;
+		PendingShaderProgram pending;
+	};
+
+	std::vector<Entry> entries;
+	std::chrono::steady_clock::time_point batchStart;
+	size_t programCount = 0;
+	double submitMs = 0.0;
+	double totalMs = 0.0;
+};
+
+// Variants of one shader program, each built from a bitmask of features.
+// Every set bit of the mask defines the name of that feature in both shaders,
+// along with SHADER_VARIANT, so that the sources can leave out the work of the
+// features that are off. Variants are compiled the first time they are asked
+// for and kept until destroyed.
+class ShaderVariantCache
+{
+public:
+	// Reads the shader sources. No variant is compiled yet.
+	// @param	vertexShaderPath	Path to the vertex shader file
+	// @param	fragmentShaderPath	Path to the fragment shader file
+	// @param	featureNames		Name defined for each bit of the feature mask, lowest bit first
+	void Create(const std::string& vertexShaderPath, const std::string& fragmentShaderPath, const std::vector<std::string>& featureNames)
+	{
+		if (!ReadFile(vertexShaderPath, vertexSource))
+		{
+			throw std::runtime_error(std::string("failed to read shader file: ") + vertexShaderPath);
+		}
+		if (!ReadFile(fragmentShaderPath, fragmentSource))
+		{
+			throw std::runtime_error(std::string("failed to read shader file: ") + fragmentShaderPath);
+		}
+		vertexPath = vertexShaderPath;
+		fragmentPath = fragmentShaderPath;
+		features = featureNames;
+	}
+
+	const std::string& GetVertexShaderPath() const
+	{
+		return vertexPath;
+	}
+
+	const std::string& GetFragmentShaderPath() const
+	{
+		return fragmentPath;
+	}
+
+	// Gets the vertex shader source the variants are built from
+	const std::string& GetVertexShaderSource() const
+	{
+		return vertexSource;
+	}
+
+	// Gets the variant with the given features, compiling it on first use
+	// @param	featureMask		Bitmask of the features the variant has
+	// @return	Returns the shader program of the variant
+	const ShaderProgram& Get(uint32_t featureMask)
+	{
+		featureMask &= GetAllFeatures();
+		auto it = variants.find(featureMask);
+		if (it != variants.end())
+		{
+			return it->second;
+		}
+		return variants[featureMask] = CreateShaderProgramFromSource(vertexSource, fragmentSource, GetDefines(featureMask));
+	}
+
+	// Adds the variant with the given features to a batch, unless it was built already.
+	// The variant must not be used before the batch is finished.
+	// @param	featureMask		Bitmask of the features the variant has
+	// @param	batch			Batch to build the variant in
+	void Prepare(uint32_t featureMask, ShaderProgramBatch& batch)
+	{
+		featureMask &= GetAllFeatures();
+		if (variants.find(featureMask) == variants.end())
+		{
+			batch.AddFromSource(variants[featureMask], vertexSource, fragmentSource, GetDefines(featureMask));
+		}
+	}
+
+	// Gets the names defined in the variant with the given features
+	// @param	featureMask		Bitmask of the features the variant has
+	// @return	Returns the defines of the variant
+	std::vector<std::string> GetDefines(uint32_t featureMask) const
+	{
+		std::vector<std::string> defines = { "SHADER_VARIANT" };
+		for (size_t i = 0; i < features.size(); ++i)
+		{
+			if (featureMask & (1u << i))
+			{
+				defines.push_back(features[i]);
+			}
+		}
+		return defines;
+	}
+
+	// Gets the feature masks of the variants compiled so far
+	std::vector<uint32_t> GetVariantMasks() const
+	{
+		std::vector<uint32_t> masks;
+		for (const auto& variant : variants)
+		{
+			masks.push_back(variant.first);
+		}
+		return masks;
+	}
+
+	// Switches to new shader sources in one go, taking over the variants
+	// already built from them. Every other variant is dropped and rebuilt
+	// from the new sources the next time it is asked for.
+	// @param	newVertexSource		New vertex shader source
+	// @param	newFragmentSource	New fragment shader source
+	// @param	newVariants			Variants built from the new sources, by feature mask
+	void ReplaceSources(std::string newVertexSource, std::string newFragmentSource,
+		std::unordered_map<uint32_t, ShaderProgram>&& newVariants)
+	{
+		Destroy();
+		vertexSource = std::move(newVertexSource);
+		fragmentSource = std::move(newFragmentSource);
+		variants = std::move(newVariants);
+	}
+
+	// Gets the mask with every feature set
+	uint32_t GetAllFeatures() const
+	{
+		return features.size() >= 32 ? ~0u : (1u << features.size()) - 1;
+	}
+
+	// Gets the number of variants compiled so far
+	size_t GetVariantCount() const
+	{
+		return variants.size();
+	}
+
+	void Destroy()
+	{
+		for (auto& variant : variants)
+		{
+			glDeleteProgram(variant.second.id);
+		}
+		variants.clear();
+	}
+
+private:
+	std::string vertexPath;
+	std::string fragmentPath;
+	std::string vertexSource;
+	std::string fragmentSource;
+	std::vector<std::string> features;
+	std::unordered_map<uint32_t, ShaderProgram> variants;
+};
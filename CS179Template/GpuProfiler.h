@@ -0,0 +1,341 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GLUtils.h"
+
+// Rolling GPU time statistics of a named scope, in milliseconds
+struct GpuScopeStats
+{
+	std::string name;
+	size_t sampleCount;
+	double minMs;
+	double avgMs;
+	double p99Ms;
+	double lastMs;
+};
+
+// Measures GPU time spent in named scopes with GL_TIMESTAMP queries.
+// Queries are kept in a ring of FrameLatency frames, and the results of a frame
+// are only read once the ring comes back around to it, by which point the GPU
+// has normally finished it. Results that are still not available are dropped
+// instead of waited for, so reading them never stalls the pipeline.
+class GpuProfiler
+{
+public:
+	// Number of frames in flight before a frame's queries are read back
+	static const int FrameLatency = 3;
+
+	// Number of most recent samples kept per scope for the statistics
+	size_t historySize = 240;
+
+	// Starts a new frame, collecting the results of the frame that used this slot before
+	void BeginFrame()
+	{
+		currentFrame = (currentFrame + 1) % FrameLatency;
+		CollectFrame(frames[currentFrame]);
+		frames[currentFrame].usedQueries = 0;
+		frames[currentFrame].scopes.clear();
+		openScopes.clear();
+	}
+
+	// Starts timing a scope. Scopes may be nested.
+	// @param	name	Name of the scope
+	void BeginScope(const char* name)
+	{
+		FrameQueries& frame = frames[currentFrame];
+
+		ScopeQueries scope;
+		scope.scopeIndex = GetScopeIndex(name);
+		scope.beginQuery = AcquireQuery(frame);
+		scope.endQuery = 0;
+		glQueryCounter(scope.beginQuery, GL_TIMESTAMP);
+
+		openScopes.push_back(frame.scopes.size());
+		frame.scopes.push_back(scope);
+	}
+
+	// Stops timing the innermost open scope
+	void EndScope()
+	{
+		FrameQueries& frame = frames[currentFrame];
+
+		ScopeQueries& scope = frame.scopes[openScopes.back()];
+		openScopes.pop_back();
+		scope.endQuery = AcquireQuery(frame);
+		glQueryCounter(scope.endQuery, GL_TIMESTAMP);
+	}
+
+	// Waits for every frame still in flight and collects its results.
+	// This stalls, so it is only meant for the end of a run.
+	void Flush()
+	{
+		glFinish();
+		for (int i = 1; i <= FrameLatency; ++i)
+		{
+			FrameQueries& frame = frames[(currentFrame + i) % FrameLatency];
+			CollectFrame(frame);
+			frame.usedQueries = 0;
+			frame.scopes.clear();
+		}
+	}
+
+	// Gets the statistics of every scope seen so far, in order of first use
+	std::vector<GpuScopeStats> GetStats() const
+	{
+		std::vector<GpuScopeStats> stats;
+		for (const ScopeHistory& history : scopes)
+		{
+			GpuScopeStats scopeStats = { history.name, history.samples.size(), 0.0, 0.0, 0.0, history.lastMs };
+			if (!history.samples.empty())
+			{
+				std::vector<double> sorted = history.samples;
+				std::sort(sorted.begin(), sorted.end());
+
+				double sum = 0.0;
+				for (double sample : sorted)
+				{
+					sum += sample;
+				}
+
+				scopeStats.minMs = sorted.front();
+				scopeStats.avgMs = sum / sorted.size();
+				scopeStats.p99Ms = sorted[std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * 0.99))];
+			}
+			stats.push_back(scopeStats);
+		}
+		return stats;
+	}
+
+	// Gets the number of frames whose results were dropped because the GPU had not finished them yet
+	size_t GetDroppedFrameCount() const
+	{
+		return droppedFrames;
+	}
+
+	// Writes the statistics of every scope as CSV
+	void WriteCsv(std::ostream& out) const
+	{
+		out << "scope,samples,min_ms,avg_ms,p99_ms,last_ms" << std::endl;
+		for (const GpuScopeStats& stats : GetStats())
+		{
+			out << stats.name << "," << stats.sampleCount << ","
+				<< stats.minMs << "," << stats.avgMs << "," << stats.p99Ms << "," << stats.lastMs << std::endl;
+		}
+	}
+
+	// Writes the statistics of every scope as JSON
+	void WriteJson(std::ostream& out) const
+	{
+		out << "{" << std::endl;
+		out << "  \"droppedFrames\": " << droppedFrames << "," << std::endl;
+		out << "  \"scopes\": [" << std::endl;
+		std::vector<GpuScopeStats> allStats = GetStats();
+		for (size_t i = 0; i < allStats.size(); ++i)
+		{
+			const GpuScopeStats& stats = allStats[i];
+			out << "    { \"name\": \"" << stats.name << "\", \"samples\": " << stats.sampleCount
+				<< ", \"minMs\": " << stats.minMs << ", \"avgMs\": " << stats.avgMs
+				<< ", \"p99Ms\": " << stats.p99Ms << ", \"lastMs\": " << stats.lastMs << " }"
+				<< (i + 1 < allStats.size() ? "," : "") << std::endl;
+		}
+		out << "  ]" << std::endl;
+		out << "}" << std::endl;
+	}
+
+	// Writes the statistics to a file, as JSON if the path ends in .json and as CSV otherwise
+	// @param	path	Path of the file to write
+	// @return	Returns true if the file was written
+	bool WriteFile(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if (file.fail())
+		{
+			return false;
+		}
+
+		const std::string jsonExtension = ".json";
+		if (path.size() >= jsonExtension.size() && path.compare(path.size() - jsonExtension.size(), jsonExtension.size(), jsonExtension) == 0)
+		{
+			WriteJson(file);
+		}
+		else
+		{
+			WriteCsv(file);
+		}
+		return true;
+	}
+
+	// Prints the statistics of every scope
+	void Print(std::ostream& out) const
+	{
+		out << std::left << std::setw(16) << "gpu scope"
+			<< std::right << std::setw(10) << "samples"
+			<< std::setw(12) << "min ms"
+			<< std::setw(12) << "avg ms"
+			<< std::setw(12) << "p99 ms" << std::endl;
+		for (const GpuScopeStats& stats : GetStats())
+		{
+			out << std::left << std::setw(16) << stats.name
+				<< std::right << std::setw(10) << stats.sampleCount
+				<< std::fixed << std::setprecision(4)
+				<< std::setw(12) << stats.minMs
+				<< std::setw(12) << stats.avgMs
+				<< std::setw(12) << stats.p99Ms
+				<< std::defaultfloat << std::endl;
+		}
+	}
+
+	void Destroy()
+	{
+		for (FrameQueries& frame : frames)
+		{
+			if (!frame.queries.empty())
+			{
+				glDeleteQueries(frame.queries.size(), frame.queries.data());
+			}
+			frame.queries.clear();
+			frame.usedQueries = 0;
+			frame.scopes.clear();
+		}
+	}
+
+private:
+	// Queries bracketing one scope in one frame
+	struct ScopeQueries
+	{
+		size_t scopeIndex;
+		GLuint beginQuery;
+		GLuint endQuery;
+	};
+
+	// Query objects of one frame slot in the ring
+	struct FrameQueries
+	{
+		std::vector<GLuint> queries;
+		size_t usedQueries = 0;
+		std::vector<ScopeQueries> scopes;
+	};
+
+	// Samples collected for one scope
+	struct ScopeHistory
+	{
+		std::string name;
+		std::vector<double> samples;
+		size_t nextSample = 0;
+		double lastMs = 0.0;
+	};
+
+	size_t GetScopeIndex(const char* name)
+	{
+		uint32_t hash = HashName(name);
+		auto it = scopeIndices.find(hash);
+		if (it != scopeIndices.end())
+		{
+			return it->second;
+		}
+
+		ScopeHistory history;
+		history.name = name;
+		scopes.push_back(history);
+		scopeIndices[hash] = scopes.size() - 1;
+		return scopes.size() - 1;
+	}
+
+	GLuint AcquireQuery(FrameQueries& frame)
+	{
+		if (frame.usedQueries == frame.queries.size())
+		{
+			GLuint query;
+			glGenQueries(1, &query);
+			frame.queries.push_back(query);
+		}
+		return frame.queries[frame.usedQueries++];
+	}
+
+	void CollectFrame(const FrameQueries& frame)
+	{
+		if (frame.scopes.empty())
+		{
+			return;
+		}
+
+		// Queries complete in order, so if the last one is done, all of them are
+		GLuint lastQuery = frame.queries[frame.usedQueries - 1];
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+		{
+			++droppedFrames;
+			return;
+		}
+
+		for (const ScopeQueries& scope : frame.scopes)
+		{
+			if (scope.endQuery == 0)
+			{
+				continue;
+			}
+
+			GLuint64 begin = 0;
+			GLuint64 end = 0;
+			glGetQueryObjectui64v(scope.beginQuery, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(scope.endQuery, GL_QUERY_RESULT, &end);
+			AddSample(scopes[scope.scopeIndex], (end - begin) / 1.0e6);
+		}
+	}
+
+	void AddSample(ScopeHistory& history, double ms)
+	{
+		if (history.samples.size() < historySize)
+		{
+			history.samples.push_back(ms);
+		}
+		else
+		{
+			history.samples[history.nextSample] = ms;
+			history.nextSample = (history.nextSample + 1) % historySize;
+		}
+		history.lastMs = ms;
+	}
+
+	FrameQueries frames[FrameLatency];
+	int currentFrame = 0;
+	std::vector<size_t> openScopes;
+
+	std::vector<ScopeHistory> scopes;
+	std::unordered_map<uint32_t, size_t> scopeIndices;
+	size_t droppedFrames = 0;
+};
+
+// Times the GPU work issued during its lifetime as a named profiler scope
+class GpuProfileScope
+{
+public:
+	GpuProfileScope(GpuProfiler& profiler, const char* name)
+		: profiler(profiler)
+	{
+		profiler.BeginScope(name);
+	}
+
+	~GpuProfileScope()
+	{
+		profiler.EndScope();
+	}
+
+	GpuProfileScope(const GpuProfileScope&) = delete;
+	GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+private:
+	GpuProfiler& profiler;
+};
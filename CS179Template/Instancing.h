@@ -0,0 +1,113 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Attribute location of the per-instance object index. The vertex shader
+// uses it to fetch the object's transform from the object transform buffer.
+const GLuint InstanceObjectIndexAttrib = 3;
+
+// Enables or disables the instance attribute arrays of the bound VAO.
+// While disabled, the attributes take the constant values set with glVertexAttrib*.
+// @param	enabled		Whether to enable the instance attribute arrays
+void SetInstanceArraysEnabled(bool enabled)
+{
+	if (enabled)
+	{
+		glEnableVertexAttribArray(InstanceObjectIndexAttrib);
+	}
+	else
+	{
+		glDisableVertexAttribArray(InstanceObjectIndexAttrib);
+	}
+}
+
+// Vertex buffer holding per-instance object indices, so that every instance
+// of a mesh can be drawn with a single glDrawElementsInstanced call
+class InstanceBuffer
+{
+public:
+	// Creates the instance VBO and hooks its attributes up to the given VAO
+	// @param	vao		VAO of the mesh that will be instanced
+	void Create(GLuint vao)
+	{
+		glGenBuffers(1, &vbo);
+		AttachTo(vao);
+	}
+
+	// Hooks the instance attributes up to another VAO sharing this buffer
+	// @param	vao		VAO of the mesh that will be instanced
+	void AttachTo(GLuint vao)
+	{
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+		// Object index attribute, advancing once per instance rather than once per vertex
+		glEnableVertexAttribArray(InstanceObjectIndexAttrib);
+		glVertexAttribIPointer(InstanceObjectIndexAttrib, 1, GL_UNSIGNED_INT, sizeof(uint32_t), 0);
+		glVertexAttribDivisor(InstanceObjectIndexAttrib, 1);
+	}
+
+	// Uploads the object indices of all instances
+	// @param	objectIndices	Pointer to the first object index
+	// @param	count			Number of instances
+	void Upload(const uint32_t* objectIndices, size_t count)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+		size_t size = count * sizeof(uint32_t);
+		if (size > capacity)
+		{
+			// Grow the buffer
+			capacity = size;
+			glBufferData(GL_ARRAY_BUFFER, capacity, objectIndices, GL_DYNAMIC_DRAW);
+		}
+		else
+		{
+			// Orphan the old storage so we don't wait for draws still reading from it
+			glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, size, objectIndices);
+		}
+	}
+
+	void Upload(const std::vector<uint32_t>& objectIndices)
+	{
+		Upload(objectIndices.data(), objectIndices.size());
+	}
+
+	// Makes instanced draws with the bound VAO start at a later instance of the buffer,
+	// standing in for the base instance of GL 4.2 draws. Set it back to 0 when done.
+	// @param	firstInstance	Index of the instance the next draws start at
+	void SetFirstInstance(size_t firstInstance)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glVertexAttribIPointer(InstanceObjectIndexAttrib, 1, GL_UNSIGNED_INT, sizeof(uint32_t),
+			reinterpret_cast<const void*>(firstInstance * sizeof(uint32_t)));
+	}
+
+	void Destroy()
+	{
+		glDeleteBuffers(1, &vbo);
+		vbo = 0;
+		capacity = 0;
+	}
+
+	GLuint vbo = 0;
+	size_t capacity = 0;
+};
+
+// Draws a single instance of the bound mesh without using the instance buffer.
+// The object index is fed from a constant generic attribute value instead,
+// which is the per-draw equivalent of setting a uniform. The instance arrays
+// must be disabled (see SetInstanceArraysEnabled).
+// @param	objectIndex		Index of the object to draw
+// @param	indexCount		Number of indices of the bound mesh
+// @param	indexType		Type of the indices of the bound mesh
+void DrawSingleInstance(uint32_t objectIndex, GLsizei indexCount, GLenum indexType)
+{
+	glVertexAttribI1ui(InstanceObjectIndexAttrib, objectIndex);
+	glDrawElements(GL_TRIANGLES, indexCount, indexType, 0);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ClusteredLighting.h"
+#include "Materials.h"
+#include "UniformBlocks.h"
+
+// Features of the lighting shader variants (see ShaderVariantCache).
+// A variant without a feature skips its work entirely.
+enum LightingFeature : uint32_t
+{
+	// Directional light term
+	LightingDirectional = 1u << 0,
+
+	// Loop over the point and spot lights of the fragment's cluster
+	LightingLocalLights = 1u << 1,
+
+	// Spot light cone test. Without it, every local light is treated as a point light.
+	LightingSpotLights = 1u << 2,
+
+	// Specular highlights of every light
+	LightingSpecular = 1u << 3,
+
+	// Take the local lights from the per-object light lists instead of the cluster grid
+	// (see ObjectLights.h). Never picked by SelectLightingFeatures.
+	LightingObjectLights = 1u << 4,
+
+	// Shadow maps of the directional light and the shadowed spot light (see ShadowMaps.h).
+	// Never picked by SelectLightingFeatures.
+	LightingShadows = 1u << 5
+};
+
+// Gets the names the lighting features are defined as in the shaders, lowest bit first
+std::vector<std::string> GetLightingFeatureNames()
+{
+	return { "HAS_DIRECTIONAL", "HAS_LOCAL_LIGHTS", "HAS_SPOT", "SPECULAR", "PER_OBJECT_LIGHTS", "HAS_SHADOWS" };
+}
+
+// Picks the cheapest set of lighting features that still lights a draw correctly,
+// leaving out the lights and terms that cannot contribute anything
+// @param	lights		Directional light of the frame
+// @param	material	Material of the draw
+// @param	localLights	Point and spot lights of the frame
+// @return	Returns the bitmask of lighting features
+uint32_t SelectLightingFeatures(const LightsBlock& lights, const Material& material, const std::vector<LocalLight>& localLights)
+{
+	const glm::vec3 zero(0.0f);
+	uint32_t features = 0;
+
+	const DirectionalLightData& dirLight = lights.dirLight;
+	bool hasDirectional = dirLight.ambient != zero || dirLight.diffuse != zero || dirLight.specular != zero;
+	if (hasDirectional)
+	{
+		features |= LightingDirectional;
+	}
+
+	bool anySpecular = hasDirectional && dirLight.specular != zero;
+	for (const LocalLight& light : localLights)
+	{
+		features |= LightingLocalLights;
+		if (light.isSpot)
+		{
+			features |= LightingSpotLights;
+		}
+		anySpecular = anySpecular || light.specular != zero;
+	}
+
+	if (anySpecular && material.specular != zero)
+	{
+		features |= LightingSpecular;
+	}
+	return features;
+}
@@ -5,28 +5,222 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <stdexcept>
 #include <vector>
 
+#include "Benchmark.h"
+#include "ClusteredLighting.h"
+#include "DeferredShading.h"
+#include "DepthPrepass.h"
+#include "DrawQueue.h"
+#include "FrameCapture.h"
 #include "GLUtils.h"
-
-// Struct containing vertex info
-struct Vertex
+#include "GpuProfiler.h"
+#include "Instancing.h"
+#include "LightingFeatures.h"
+#include "Materials.h"
+#include "Mesh.h"
+#include "MeshCache.h"
+#include "ObjLoader.h"
+#include "ObjectLights.h"
+#include "RenderTarget.h"
+#include "SceneGenerator.h"
+#include "ShaderHotReload.h"
+#include "ShadowMaps.h"
+#include "TransformStore.h"
+#include "UniformBlocks.h"
+#include "VertexFormats.h"
+
+int main(int argc, char* argv[])
 {
-	// Position
-	float x, y, z;
-
-	// Normal
-	float nx, ny, nz;
+	// Parse the command line options
+	bool benchmarkInstancing = false;
+	bool benchmarkScaling = false;
+	bool benchmarkDeferred = false;
+	bool benchmarkMeshLoader = false;
+	bool benchmarkVertexFormats = false;
+	bool useMeshCache = true;
+	bool optimizeMesh = true;
+	bool generateMeshLods = true;
+	float lodPixelError = 1.0f;
+	VertexFormat vertexFormat = VertexFormat::Float;
+	bool useDeferred = false;
+	bool useDepthPrepass = false;
+	bool useObjectLights = false;
+	bool useShadows = true;
+	size_t maxBenchmarkObjectCount = 1000000;
+	bool generateScene = false;
+	SceneDesc sceneDesc;
+	size_t extraLightCount = 0;
+	float lightCutoff = DefaultLightCutoff;
+	bool headless = false;
+	int headlessFrameCount = 600;
+	std::string benchmarkOutputPath;
+	std::string gpuProfilePath;
+	std::string captureImagePrefix;
+	std::string captureHashPath;
+	std::string programCachePrefix;
+	std::string meshPath;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--benchmark-instancing")
+		{
+			// Compare per-draw and instanced submission, then exit
+			benchmarkInstancing = true;
+		}
+		else if (arg == "--benchmark-scaling")
+		{
+			// Measure how rendering scales with the object count, then exit
+			benchmarkScaling = true;
+		}
+		else if (arg == "--benchmark-deferred")
+		{
+			// Compare forward and deferred shading at increasing light counts, then exit
+			benchmarkDeferred = true;
+		}
+		else if (arg == "--benchmark-mesh-loader")
+		{
+			// Measure the OBJ loader's throughput at increasing thread counts on the --mesh file
+			// (or a generated sphere without one), then exit
+			benchmarkMeshLoader = true;
+		}
+		else if (arg == "--mesh" && i + 1 < argc)
+		{
+			// Draw the scene objects with a mesh loaded from an OBJ file instead of the cube
+			meshPath = argv[++i];
+		}
+		else if (arg == "--benchmark-vertex-formats")
+		{
+			// Check the error of the compact vertex formats on the --mesh file (or a generated sphere), then exit
+			benchmarkVertexFormats = true;
+		}
+		else if (arg == "--vertex-format" && i + 1 < argc)
+		{
+			// Layout of the vertex buffers (float, half, quantized or octahedral)
+			vertexFormat = ParseVertexFormat(argv[++i]);
+		}
+		else if (arg == "--no-mesh-cache")
+		{
+			// Always convert the --mesh file, instead of loading it from <file>.meshcache when that is up to date
+			useMeshCache = false;
+		}
+		else if (arg == "--no-mesh-optimize")
+		{
+			// Keep the --mesh file's triangle and vertex order, to compare against the cache-optimized order
+			optimizeMesh = false;
+		}
+		else if (arg == "--no-mesh-lods")
+		{
+			// Draw the --mesh file at full detail at any distance, instead of generating levels of detail for it
+			generateMeshLods = false;
+		}
+		else if (arg == "--lod-error" && i + 1 < argc)
+		{
+			// Largest error, in pixels, of the level of detail an object is drawn with (0 always draws the full detail)
+			lodPixelError = std::max(static_cast<float>(std::atof(argv[++i])), 0.0f);
+		}
+		else if (arg == "--deferred")
+		{
+			// Start with deferred shading instead of forward shading (toggled with Tab)
+			useDeferred = true;
+		}
+		else if (arg == "--depth-prepass")
+		{
+			// Start with the depth pre-pass of the forward path on (toggled with P)
+			useDepthPrepass = true;
+		}
+		else if (arg == "--object-lights")
+		{
+			// Start with the forward path taking its lights from per-object lists instead of the clusters (toggled with L)
+			useObjectLights = true;
+		}
+		else if (arg == "--no-shadows")
+		{
+			// Start with the shadow maps of the directional and spot lights off (toggled with O)
+			useShadows = false;
+		}
+		else if (arg == "--max-objects" && i + 1 < argc)
+		{
+			maxBenchmarkObjectCount = std::min<size_t>(std::strtoull(argv[++i], nullptr, 10), 10000000);
+		}
+		else if (arg == "--scene" && i + 1 < argc)
+		{
+			// Replace the hand-placed cubes with a generated scene (grid, clusters or poisson)
+			sceneDesc.layout = ParseSceneLayout(argv[++i]);
+			generateScene = true;
+		}
+		else if (arg == "--objects" && i + 1 < argc)
+		{
+			sceneDesc.objectCount = std::strtoull(argv[++i], nullptr, 10);
+			generateScene = true;
+		}
+		else if (arg == "--lights" && i + 1 < argc)
+		{
+			// Scatter this many extra point lights over the scene
+			extraLightCount = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--light-cutoff" && i + 1 < argc)
+		{
+			// Intensity at which the attenuation of a point or spot light counts as faded out, setting its range
+			lightCutoff = glm::clamp(static_cast<float>(std::atof(argv[++i])), 1e-4f, 1.0f);
+		}
+		else if (arg == "--seed" && i + 1 < argc)
+		{
+			sceneDesc.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--headless")
+		{
+			// Render a fixed workload offscreen, along a scripted camera path, then exit
+			headless = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc)
+		{
+			headlessFrameCount = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--benchmark-output" && i + 1 < argc)
+		{
+			benchmarkOutputPath = argv[++i];
+		}
+		else if (arg == "--gpu-profile" && i + 1 < argc)
+		{
+			gpuProfilePath = argv[++i];
+		}
+		else if (arg == "--capture-images" && i + 1 < argc)
+		{
+			// Write every frame as <prefix>00000.ppm, <prefix>00001.ppm, ...
+			captureImagePrefix = argv[++i];
+		}
+		else if (arg == "--capture-hashes" && i + 1 < argc)
+		{
+			// Write a hash of every frame, one line per frame
+			captureHashPath = argv[++i];
+		}
+		else if (arg == "--program-cache" && i + 1 < argc)
+		{
+			// Keep linked program binaries as <prefix><hash>.bin, and load them instead of compiling on later runs
+			programCachePrefix = argv[++i];
+		}
+	}
 
-	// Vertex Color
-	GLubyte r, g, b, a;
-};
+	// The loader and vertex format benchmarks need no window or context
+	if (benchmarkMeshLoader)
+	{
+		RunMeshLoaderBenchmark(meshPath);
+		return 0;
+	}
+	if (benchmarkVertexFormats)
+	{
+		return RunVertexFormatBenchmark(meshPath) ? 0 : 1;
+	}
 
-int main()
-{
 	// Initialize GLFW
 	if (glfwInit() == GLFW_FALSE)
 	{
@@ -42,6 +236,12 @@ int main()
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 
+	// A headless run never shows its window and renders to an offscreen framebuffer instead
+	if (headless)
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	}
+
 	int windowWidth = 640;
 	int windowHeight = 480;
 
@@ -61,103 +261,68 @@ int main()
 	// Load OpenGL extensions via GLAD
 	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
 
-	// Vertices of the cube.
-	// Convention for each face: lower-left, lower-right, upper-right, upper-left
-	Vertex cubeVertices[] =
-	{
-		// Front
-		{ -1.0f, -1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	255, 0, 0, 255 },
-		{ 1.0f, -1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	255, 0, 0, 255 },
-		{ 1.0f, 1.0f, 1.0f,		0.0f, 0.0f, 1.0f,	255, 0, 0, 255 },
-		{ -1.0f, 1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	255, 0, 0, 255 },
-
-		// Back
-		{ 1.0f, -1.0f, -1.0f,	0.0f, 0.0f, -1.0f,	0, 255, 0, 255 },
-		{ -1.0f, -1.0f, -1.0f,	0.0f, 0.0f, -1.0f,	0, 255, 0, 255 },
-		{ -1.0f, 1.0f, -1.0f,	0.0f, 0.0f, -1.0f,	0, 255, 0, 255 },
-		{ 1.0f, 1.0f, -1.0f,	0.0f, 0.0f, -1.0f,	0, 255, 0, 255 },
-
-		// Left
-		{ -1.0f, -1.0f, -1.0f,	-1.0f, 0.0f, 0.0f,	0, 0, 255, 255 },
-		{ -1.0f, -1.0f, 1.0f,	-1.0f, 0.0f, 0.0f,	0, 0, 255, 255 },
-		{ -1.0f, 1.0f, 1.0f,	-1.0f, 0.0f, 0.0f,	0, 0, 255, 255 },
-		{ -1.0f, 1.0f, -1.0f,	-1.0f, 0.0f, 0.0f,	0, 0, 255, 255 },
-
-		// Right
-		{ 1.0f, -1.0f, 1.0f,	1.0f, 0.0f, 0.0f,	255, 255, 0, 255 },
-		{ 1.0f, -1.0f, -1.0f,	1.0f, 0.0f, 0.0f,	255, 255, 0, 255 },
-		{ 1.0f, 1.0f, -1.0f,	1.0f, 0.0f, 0.0f,	255, 255, 0, 255 },
-		{ 1.0f, 1.0f, 1.0f,		1.0f, 0.0f, 0.0f,	255, 255, 0, 255 },
-
-		// Top
-		{ -1.0f, 1.0f, 1.0f,	0.0f, 1.0f, 0.0f,	255, 0, 255, 255 },
-		{ 1.0f, 1.0f, 1.0f,		0.0f, 1.0f, 0.0f,	255, 0, 255, 255 },
-		{ 1.0f, 1.0f, -1.0f,	0.0f, 1.0f, 0.0f,	255, 0, 255, 255 },
-		{ -1.0f, 1.0f, -1.0f,	0.0f, 1.0f, 0.0f,	255, 0, 255, 255 },
-
-		// Bottom
-		{ -1.0f, -1.0f, -1.0f,	0.0f, -1.0f, 0.0f,	0, 255, 255, 255 },
-		{ 1.0f, -1.0f, -1.0f,	0.0f, -1.0f, 0.0f,	0, 255, 255, 255 },
-		{ 1.0f, -1.0f, 1.0f,	0.0f, -1.0f, 0.0f,	0, 255, 255, 255 },
-		{ -1.0f, -1.0f, 1.0f,	0.0f, -1.0f, 0.0f,	0, 255, 255, 255 }
-	};
+	// Set up the program binary cache before the first program is created
+	ProgramCache().pathPrefix = programCachePrefix;
+	ProgramCache().Initialize((GLADloadproc)glfwGetProcAddress);
 
-	// Vertex indices for the cube
-	unsigned int cubeIndices[] =
+	// Construct the offscreen framebuffer for headless runs
+	RenderTarget offscreenTarget;
+	if (headless)
 	{
-		// Front
-		0, 1, 2, 2, 3, 0,
-
-		// Back
-		4, 5, 6, 6, 7, 4,
+		offscreenTarget.Create(windowWidth, windowHeight);
 
-		// Left
-		8, 9, 10, 10, 11, 8,
-
-		// Right
-		12, 13, 14, 14, 15, 12,
-
-		// Top
-		16, 17, 18, 18, 19, 16,
-
-		// Bottom
-		20, 21, 22, 22, 23, 20
-	};
+		// Don't let vsync throttle the benchmark
+		glfwSwapInterval(0);
+	}
 
 	// Enable depth testing to handle occlusion
 	glEnable(GL_DEPTH_TEST);
 
-	// Construct VBO for the cube
-	GLuint cubeVbo;
-	glGenBuffers(1, &cubeVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, cubeVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
-
-	// Construct EBO (Element Buffer Object) for the cube
-	GLuint cubeEbo;
-	glGenBuffers(1, &cubeEbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices, GL_STATIC_DRAW);
-
-	// Construct VAO for the cube
-	GLuint cubeVao;
-	glGenVertexArrays(1, &cubeVao);
-	glBindVertexArray(cubeVao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, cubeVbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEbo);
+	// Geometry of the cube, also drawn for the light gizmo and used as the light volume proxy.
+	// Every mesh is uploaded in the same vertex format, which the shaders are built to decode.
+	MeshData cubeMeshData = CreateCubeMesh();
+	GpuMesh cubeMesh;
+	cubeMesh.Create(cubeMeshData, vertexFormat);
 
-	// Vertex position attribute
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+	// Geometry the scene objects are drawn with: the cube, or a mesh loaded from a file,
+	// fitted to the cube's bounding sphere so that it fits in the same scenes
+	GpuMesh objectMesh;
+	if (meshPath.empty())
+	{
+		objectMesh.Create(cubeMeshData, vertexFormat);
+	}
+	else
+	{
+		MeshImportSettings importSettings;
+		importSettings.fitToSphere = true;
+		importSettings.fitCenter = cubeMeshData.boundsCenter;
+		importSettings.fitRadius = cubeMeshData.boundsRadius;
+		importSettings.vertexFormat = vertexFormat;
+		importSettings.generateLods = generateMeshLods;
+		importSettings.optimize = optimizeMesh;
+
+		// On a cache hit, the buffers are filled straight from the mapped cache file
+		CachedMesh loadedMesh;
+		try
+		{
+			loadedMesh.Load(meshPath, importSettings, useMeshCache);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Cannot load mesh: " << e.what() << std::endl;
+			glfwTerminate();
+			return -1;
+		}
+		objectMesh.Create(loadedMesh.GetView());
+		loadedMesh.Close();
 
-	// Vertex normal attribute
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, nx));
+		// Reported on stderr, so it does not end up in a headless report written to stdout
+		loadedMesh.GetStats().Print(std::cerr);
+	}
 
-	// Vertex color attribute
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, r));
+	// Construct the instance buffer holding the object index of every cube to draw
+	InstanceBuffer cubeInstances;
+	cubeInstances.Create(objectMesh.vao);
 
 	// Construct VAO for the light source
 	GLuint lightVao;
@@ -165,22 +330,85 @@ int main()
 	glBindVertexArray(lightVao);
 
 	// Since the light source is also a cube, we can reuse the VBO and EBO
-	glBindBuffer(GL_ARRAY_BUFFER, cubeVbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEbo);
+	glBindBuffer(GL_ARRAY_BUFFER, cubeMesh.vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeMesh.ebo);
 
 	// Vertex position attribute
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+	SetupVertexAttributes(vertexFormat, true);
+
+	// Register the vertex decoding and the uniform blocks shared by all shader programs
+	RegisterVertexFormat(vertexFormat);
+	RegisterUniformBlocks();
+	RegisterObjectTransforms();
+	RegisterClusteredLighting();
+	RegisterDeferredShading();
+	RegisterObjectLights();
+	RegisterShadowMaps();
+	RegisterMaterials();
+
+	// Programs needed from the first frame on are built in one batch, so that the
+	// driver can work on all of them at once. None of them is usable before it is finished.
+	ShaderProgramBatch programBatch;
 
 	// Create shader program for the light source
-	GLuint lightProgram = CreateShaderProgram("Basic.vsh", "Basic.fsh");
+	ShaderProgram lightProgram;
+	programBatch.Add(lightProgram, "Basic.vsh", "Basic.fsh");
+
+	// Variants of the shader program for the cube, compiled on first use
+	ShaderVariantCache cubeVariants;
+	cubeVariants.Create("BasicLighting.vsh", "BasicLighting.fsh", GetLightingFeatureNames());
+
+	// Rebuild the cube variants whenever their fragment shader is saved. The vertex shader is
+	// shared with the G-buffer and kept in step with the depth-only one, so it isn't reloaded.
+	// Headless runs keep the shaders they started with, so every run renders the same frames.
+	ShaderHotReloader shaderReloader;
+	if (!headless)
+	{
+		shaderReloader.Watch(cubeVariants);
+	}
 
-	// Create shader program for the cube
-	GLuint cubeProgram = CreateShaderProgram("BasicLighting.vsh", "BasicLighting.fsh");
+	// Create the uniform buffer backing the camera, lights and material blocks
+	SharedUniformBuffer sharedUniforms;
+	sharedUniforms.Create();
 
 	// Construct the projection matrix
 	glm::mat4 projMatrix = glm::perspective(glm::radians(45.0f), windowWidth * 1.0f / windowHeight, 0.1f, 100.0f);
 
+	// Create the cluster grid the point and spot lights are binned into, matching the projection
+	ClusteredLighting clusteredLighting;
+	clusteredLighting.Create();
+	int framebufferWidth = windowWidth;
+	int framebufferHeight = windowHeight;
+	if (!headless)
+	{
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	}
+	clusteredLighting.SetProjection(glm::radians(45.0f), windowWidth * 1.0f / windowHeight, 0.1f, 100.0f, framebufferWidth, framebufferHeight);
+
+	// Create the G-buffer and passes of the deferred path, drawing the light volumes with the cube's VBO and EBO
+	DeferredRenderer deferredRenderer;
+	deferredRenderer.Create(framebufferWidth, framebufferHeight, cubeMesh, programBatch);
+
+	// Create the depth-only program of the forward path's depth pre-pass
+	DepthPrepass depthPrepass;
+	depthPrepass.enabled = useDepthPrepass;
+	depthPrepass.Create(programBatch);
+
+	// Create the buffers of the per-object light lists, an alternative to the cluster grid on the forward path
+	ObjectLightLists objectLights;
+	objectLights.Create();
+	std::vector<glm::vec4> lightSpheres;
+
+	// Create the shadow atlas of the directional and spot lights, drawing the casters with the scene objects' VBO and EBO.
+	// Shadows end where the cascades of the camera's view end.
+	ShadowMaps shadowMaps;
+	shadowMaps.enabled = useShadows;
+	shadowMaps.Create(objectMesh, programBatch);
+	shadowMaps.SetProjection(glm::radians(45.0f), windowWidth * 1.0f / windowHeight, 0.1f, 100.0f);
+
+	// Framebuffer the frames end up in
+	const GLuint targetFbo = headless ? offscreenTarget.fbo : 0;
+
 	// Camera parameters
 	glm::vec3 eyePosition = glm::vec3(0.0f, 0.0f, 10.0f);
 	float cameraPitch = 0.0f;
@@ -191,6 +419,105 @@ int main()
 	// Light-related parameters
 	glm::vec3 spotLightPosition(0.0f, 0.0f, 0.0f);
 
+	// Directional light parameters
+	DirectionalLightData& dirLight = sharedUniforms.lights.dirLight;
+	dirLight.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+	dirLight.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+	dirLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	dirLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+
+	// Point light parameters
+	LocalLight pointLight;
+	pointLight.position = glm::vec3(0.0f, 0.0f, 0.0f);
+	pointLight.ambient = glm::vec3(0.01f, 0.01f, 0.01f);
+	pointLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	pointLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+	pointLight.kConstant = 1.0f;
+	pointLight.kLinear = 0.09f;
+	pointLight.kQuadratic = 0.032f;
+	pointLight.range = ComputeLightRange(pointLight, lightCutoff);
+	clusteredLighting.lights.push_back(pointLight);
+
+	// Spot light parameters (position and direction are updated every frame)
+	LocalLight spotLight;
+	spotLight.isSpot = true;
+	spotLight.ambient = glm::vec3(0.1f, 0.1f, 0.1f);
+	spotLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	spotLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+	spotLight.kConstant = 1.0f;
+	spotLight.kLinear = 0.09f;
+	spotLight.kQuadratic = 0.032f;
+	spotLight.cutOffAngle = glm::radians(12.5f);
+	spotLight.range = ComputeLightRange(spotLight, lightCutoff);
+	const size_t spotLightIndex = clusteredLighting.lights.size();
+	clusteredLighting.lights.push_back(spotLight);
+
+	// Cube materials, which the cubes take in turns. Bronze comes first, so the benchmarks draw with it.
+	MaterialTable materialTable;
+	materialTable.Create();
+
+	Material bronze;
+	bronze.ambient = glm::vec3(0.2125, 0.1275f, 0.054f);
+	bronze.diffuse = glm::vec3(0.714f, 0.4284f, 0.18144f);
+	bronze.specular = glm::vec3(0.393548f, 0.271906f, 0.166721f);
+	bronze.shininess = 128 * 0.2f;
+	materialTable.Add(bronze);
+
+	Material gold;
+	gold.ambient = glm::vec3(0.24725f, 0.1995f, 0.0745f);
+	gold.diffuse = glm::vec3(0.75164f, 0.60648f, 0.22648f);
+	gold.specular = glm::vec3(0.628281f, 0.555802f, 0.366065f);
+	gold.shininess = 128 * 0.4f;
+	materialTable.Add(gold);
+
+	Material jade;
+	jade.ambient = glm::vec3(0.135f, 0.2225f, 0.1575f);
+	jade.diffuse = glm::vec3(0.54f, 0.89f, 0.63f);
+	jade.specular = glm::vec3(0.316228f, 0.316228f, 0.316228f);
+	jade.shininess = 128 * 0.1f;
+	materialTable.Add(jade);
+
+	// Without any highlights, so its cubes are drawn with a variant that skips specular
+	Material clay;
+	clay.ambient = glm::vec3(0.1f, 0.06f, 0.05f);
+	clay.diffuse = glm::vec3(0.6f, 0.35f, 0.25f);
+	clay.specular = glm::vec3(0.0f);
+	clay.shininess = 1.0f;
+	materialTable.Add(clay);
+
+	materialTable.Update(dirLight);
+	materialTable.Bind();
+
+	// Picks the cheapest cube variant for the current lights and a material,
+	// taking the local lights from the per-object lists if those are on,
+	// and sampling the shadow maps if those are on
+	auto selectCubeFeatures = [&](const Material& material)
+	{
+		uint32_t features = SelectLightingFeatures(sharedUniforms.lights, material, clusteredLighting.lights);
+		if (useObjectLights && (features & LightingLocalLights))
+		{
+			features |= LightingObjectLights;
+		}
+		if (shadowMaps.enabled && (features & (LightingDirectional | LightingLocalLights)))
+		{
+			features |= LightingShadows;
+		}
+		return features;
+	};
+
+	// Build the cube variants for the lights and materials above along with the other programs,
+	// then check them all
+	for (const Material& material : materialTable.materials)
+	{
+		cubeVariants.Prepare(selectCubeFeatures(material), programBatch);
+	}
+	programBatch.Finish();
+	programBatch.Print(std::cerr);
+
+	// Look up the uniform locations once, rather than by name every frame
+	const GLint lightModelMatrixLoc = lightProgram.GetUniformLocation("modelMatrix");
+	const GLint lightColorLoc = lightProgram.GetUniformLocation("color");
+
 	// Cube positions
 	std::vector<glm::vec3> cubePositions;
 	cubePositions.push_back(glm::vec3(2.0f, 5.0f, -15.0f));
@@ -203,23 +530,217 @@ int main()
 	cubePositions.push_back(glm::vec3(1.5f, 0.2f, -1.5f));
 	cubePositions.push_back(glm::vec3(-1.3f, 1.0f, -1.5f));
 
+	// Transforms of the cubes. They never move, so their model matrices, normal matrices
+	// and bounds are computed once here, and only recomputed if a cube gets changed.
+	TransformStore cubeTransforms;
+	if (generateScene)
+	{
+		GenerateScene(sceneDesc, cubeTransforms);
+		cubePositions.clear();
+	}
+	for (int i = 0; i < cubePositions.size(); ++i)
+	{
+		ObjectTransform transform;
+		transform.position = cubePositions[i];
+
+		float angle = 20.0f * i;
+		transform.rotation = glm::angleAxis(glm::radians(angle), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)));
+		transform.scale = glm::vec3(0.5f, 0.5f, 0.5f);
+
+		// The cube spans -1 to 1 on every axis, so it fits in a sphere of radius sqrt(3)
+		cubeTransforms.Add(transform, glm::vec3(0.0f), std::sqrt(3.0f));
+	}
+
+	// Give the cubes the materials in turns
+	std::vector<uint32_t> cubeMaterials(cubeTransforms.Size());
+	for (size_t i = 0; i < cubeMaterials.size(); ++i)
+	{
+		cubeMaterials[i] = static_cast<uint32_t>(i % materialTable.materials.size());
+	}
+
+	// Light up the scene with extra point lights, spread over the cubes
+	if (extraLightCount > 0)
+	{
+		cubeTransforms.Update();
+		ScatterPointLights(cubeTransforms.GetWorldBounds(), extraLightCount, sceneDesc.seed, lightCutoff, clusteredLighting.lights);
+	}
+
+	// Texture buffer holding the cube transforms on the GPU
+	ObjectTransformBuffer cubeTransformBuffer;
+	cubeTransformBuffer.Create();
+
+	// Indices of the cubes that passed frustum culling
+	std::vector<uint32_t> visibleCubeIndices;
+
+	// Visible cubes of the frame, drawn sorted by program, then material, then mesh
+	DrawQueue cubeDraws;
+
+	// Every level of detail of the object mesh is a draw mesh of its own, in the same order
+	std::vector<DrawMesh> objectMeshes(std::max<size_t>(objectMesh.lods.size(), 1));
+	for (size_t i = 0; i < objectMeshes.size(); ++i)
+	{
+		objectMeshes[i].vao = objectMesh.vao;
+		objectMeshes[i].indexType = objectMesh.indexType;
+		objectMeshes[i].indexCount = objectMesh.lods.empty() ? objectMesh.indexCount : objectMesh.lods[i].indexCount;
+		objectMeshes[i].indexOffset = objectMesh.lods.empty() ? 0 : objectMesh.lods[i].firstIndex * GetIndexSize(objectMesh.indexType);
+	}
+
+	// Cube variant picked for each material
+	std::vector<const ShaderProgram*> materialPrograms(materialTable.materials.size());
+
+	// Draw calls and state changes of the last frame, and summed over the frames for the headless report
+	DrawStats lastDrawStats;
+	DrawStats totalDrawStats;
+
+	// Every cube casts shadows, and since none of them moves, all of them are static casters
+	std::vector<uint32_t> staticShadowCasters(cubeTransforms.Size());
+	for (size_t i = 0; i < staticShadowCasters.size(); ++i)
+	{
+		staticShadowCasters[i] = static_cast<uint32_t>(i);
+	}
+	const std::vector<uint32_t> dynamicShadowCasters;
+
+	// Visible/culled cube counters of the current frame
+	CullingStats cubeCulling;
+
+	// Title currently shown by the window
+	std::string windowTitle;
+
+	// GPU timings of the render passes, written to a CSV or JSON file on exit if a path is given
+	GpuProfiler gpuProfiler;
+	if (headless)
+	{
+		gpuProfiler.historySize = headlessFrameCount;
+	}
+
+	// CPU time of every frame of a headless run
+	std::vector<double> headlessFrameTimes;
+	int frameIndex = 0;
+
+	// Asynchronous capture of the rendered frames, for regression images and video
+	FrameCapture frameCapture;
+	bool captureFrames = !captureImagePrefix.empty() || !captureHashPath.empty();
+	if (captureFrames)
+	{
+		int captureWidth = windowWidth;
+		int captureHeight = windowHeight;
+		if (!headless)
+		{
+			glfwGetFramebufferSize(window, &captureWidth, &captureHeight);
+		}
+		frameCapture.imagePrefix = captureImagePrefix;
+		frameCapture.hashPath = captureHashPath;
+		frameCapture.Create(captureWidth, captureHeight);
+	}
+
+	if (benchmarkInstancing)
+	{
+		glm::vec3 lookDir(0.0f, 0.0f, -1.0f);
+		sharedUniforms.camera.projMatrix = projMatrix;
+		sharedUniforms.camera.viewMatrix = glm::lookAt(eyePosition, eyePosition + lookDir, glm::vec3(0.0f, 1.0f, 0.0f));
+		sharedUniforms.camera.eyePos = eyePosition;
+		clusteredLighting.lights[spotLightIndex].position = eyePosition;
+		clusteredLighting.lights[spotLightIndex].direction = lookDir;
+		sharedUniforms.Upload();
+		clusteredLighting.Update(sharedUniforms.camera.viewMatrix);
+		clusteredLighting.Bind();
+
+		if (headless)
+		{
+			offscreenTarget.Bind();
+		}
+
+		RunInstancingBenchmark(objectMesh, cubeInstances, cubeTransformBuffer,
+			cubeVariants.Get(SelectLightingFeatures(sharedUniforms.lights, materialTable.materials[0], clusteredLighting.lights)));
+
+		glfwTerminate();
+		return 0;
+	}
+
+	if (benchmarkScaling)
+	{
+		if (headless)
+		{
+			offscreenTarget.Bind();
+		}
+
+		RunScalingBenchmark(sceneDesc.layout, sceneDesc.seed, maxBenchmarkObjectCount, objectMesh, cubeInstances,
+			cubeTransformBuffer, sharedUniforms, clusteredLighting, spotLightIndex,
+			cubeVariants.Get(SelectLightingFeatures(sharedUniforms.lights, materialTable.materials[0], clusteredLighting.lights)), windowWidth * 1.0f / windowHeight, benchmarkOutputPath);
+
+		glfwTerminate();
+		return 0;
+	}
+
+	if (benchmarkDeferred)
+	{
+		glm::vec3 lookDir(0.0f, 0.0f, -1.0f);
+		glm::mat4 viewMatrix = glm::lookAt(eyePosition, eyePosition + lookDir, glm::vec3(0.0f, 1.0f, 0.0f));
+		sharedUniforms.camera.projMatrix = projMatrix;
+		sharedUniforms.camera.viewMatrix = viewMatrix;
+		sharedUniforms.camera.eyePos = eyePosition;
+		sharedUniforms.Upload();
+
+		RunDeferredBenchmark(objectMesh, cubeInstances, cubeTransformBuffer, cubeVariants, sharedUniforms, materialTable.materials[0], deferredRenderer, clusteredLighting,
+			targetFbo, projMatrix, viewMatrix);
+
+		glfwTerminate();
+		return 0;
+	}
+
+	// Whether the render path and pre-pass keys were down last frame, so holding them toggles only once
+	bool renderPathKeyWasDown = false;
+	bool prepassKeyWasDown = false;
+	bool objectLightsKeyWasDown = false;
+	bool shadowsKeyWasDown = false;
+
 	double prevTime = glfwGetTime();
 	while (!glfwWindowShouldClose(window)) {
 		// Calculate amount of time passed since the last frame
 		float deltaTime = glfwGetTime() - prevTime;
 		prevTime = glfwGetTime();
+		double frameStartMs = BenchmarkNowMs();
+
+		// Start a new frame of GPU timings, reading back the results of an earlier frame
+		gpuProfiler.BeginFrame();
+		depthPrepass.BeginFrame();
+		gpuProfiler.BeginScope("frame");
+
+		// Swap in the shaders saved since the last frame, once they are built
+		shaderReloader.Update(deltaTime * 1000.0);
+
+		if (headless)
+		{
+			// Follow the scripted camera path instead of the keyboard,
+			// so every run renders exactly the same frames
+			CameraPose pose = ScriptedCameraPose(frameIndex * 1.0f / headlessFrameCount);
+			eyePosition = pose.position;
+			cameraPitch = pose.pitch;
+			cameraYaw = pose.yaw;
+			deltaTime = 0.0f;
+
+			offscreenTarget.Bind();
+		}
 
 		// Set background color to black
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
 		// Clear the color buffer
+		gpuProfiler.BeginScope("clear");
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		gpuProfiler.EndScope();
 
-		// Bind the vao of the cube
-		glBindVertexArray(cubeVao);
+		// Bind the vao of the scene objects
+		glBindVertexArray(objectMesh.vao);
 
-		// Use the shader for the cube
-		glUseProgram(cubeProgram);
+		// Use the cheapest variant of the cube shader that still handles the current lights and each material
+		uint32_t cubeFeatures = 0;
+		for (size_t i = 0; i < materialPrograms.size(); ++i)
+		{
+			uint32_t features = selectCubeFeatures(materialTable.materials[i]);
+			materialPrograms[i] = &cubeVariants.Get(features);
+			cubeFeatures |= features;
+		}
 
 		// Handle camera look input (up/down)
 		if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
@@ -271,68 +792,193 @@ int main()
 			eyePosition -= lookDir * movementSpeed * deltaTime;
 		}
 
-		// Pass the eye position vector to the current shader that we're using
-		glUniform3f(glGetUniformLocation(cubeProgram, "eyePos"), eyePosition.x, eyePosition.y, eyePosition.z);
+		// Handle switching between forward and deferred shading
+		bool renderPathKeyDown = glfwGetKey(window, GLFW_KEY_TAB) == GLFW_PRESS;
+		if (renderPathKeyDown && !renderPathKeyWasDown)
+		{
+			useDeferred = !useDeferred;
+		}
+		renderPathKeyWasDown = renderPathKeyDown;
 
-		// Pass directional light parameters to the shader
-		glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.direction"), 1, glm::value_ptr(glm::vec3(0.0f, -1.0f, 0.0f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.ambient"), 1, glm::value_ptr(glm::vec3(0.05f, 0.05f, 0.05f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.diffuse"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.specular"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
+		// Handle switching the depth pre-pass on and off
+		bool prepassKeyDown = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+		if (prepassKeyDown && !prepassKeyWasDown)
+		{
+			depthPrepass.enabled = !depthPrepass.enabled;
+		}
+		prepassKeyWasDown = prepassKeyDown;
 
-		// Pass point light parameters to the shader
-		glUniform3fv(glGetUniformLocation(cubeProgram, "pointLight.position"), 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, 0.0f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "pointLight.ambient"), 1, glm::value_ptr(glm::vec3(0.01f, 0.01f, 0.01f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "pointLight.diffuse"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "pointLight.specular"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		glUniform1f(glGetUniformLocation(cubeProgram, "pointLight.kConstant"), 1.0f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "pointLight.kLinear"), 0.09f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "pointLight.kQuadratic"), 0.032f);
+		// Handle switching between per-object light lists and the cluster grid.
+		// Takes effect on the next frame, whose cube variant is picked with it.
+		bool objectLightsKeyDown = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS;
+		if (objectLightsKeyDown && !objectLightsKeyWasDown)
+		{
+			useObjectLights = !useObjectLights;
+		}
+		objectLightsKeyWasDown = objectLightsKeyDown;
+
+		// Handle switching the shadow maps on and off.
+		// Takes effect on the next frame, whose cube variant is picked with it.
+		bool shadowsKeyDown = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+		if (shadowsKeyDown && !shadowsKeyWasDown)
+		{
+			shadowMaps.enabled = !shadowMaps.enabled;
+		}
+		shadowsKeyWasDown = shadowsKeyDown;
+
+		// Construct the view matrix
+		glm::mat4 viewMatrix = glm::lookAt(eyePosition, eyePosition + lookDir, glm::vec3(0.0f, 1.0f, 0.0f));
+
+		// Update the camera block
+		sharedUniforms.camera.projMatrix = projMatrix;
+		sharedUniforms.camera.viewMatrix = viewMatrix;
+		sharedUniforms.camera.eyePos = eyePosition;
 
-		// Pass spot light parameters to the shader
 		// We pass the camera position and direction as the spot light position and direction respectively
 		// to emulate a flash light
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.position"), 1, glm::value_ptr(eyePosition));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.direction"), 1, glm::value_ptr(lookDir));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.ambient"), 1, glm::value_ptr(glm::vec3(0.1f, 0.1f, 0.1f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.diffuse"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.specular"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		glUniform1f(glGetUniformLocation(cubeProgram, "spotLight.kConstant"), 1.0f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "spotLight.kLinear"), 0.09f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "spotLight.kQuadratic"), 0.032f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "spotLight.cutOffAngle"), glm::radians(12.5f));
-
-		// Pass cube material parameters to the shader (bronze material in this case)
-		glUniform3fv(glGetUniformLocation(cubeProgram, "material.ambient"), 1, glm::value_ptr(glm::vec3(0.2125, 0.1275f, 0.054f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "material.diffuse"), 1, glm::value_ptr(glm::vec3(0.714f, 0.4284f, 0.18144f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "material.specular"), 1, glm::value_ptr(glm::vec3(0.393548f, 0.271906f, 0.166721f)));
-		glUniform1f(glGetUniformLocation(cubeProgram, "material.shininess"), 128 * 0.2f);
-
-		// Pass the projection matrix to the shader
-		glUniformMatrix4fv(glGetUniformLocation(cubeProgram, "projMatrix"), 1, GL_FALSE, glm::value_ptr(projMatrix));
-
-		// Construct the view matrix, and pass the view matrix to the shader
-		glm::mat4 viewMatrix = glm::lookAt(eyePosition, eyePosition + lookDir, glm::vec3(0.0f, 1.0f, 0.0f));
-		glUniformMatrix4fv(glGetUniformLocation(cubeProgram, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
+		clusteredLighting.lights[spotLightIndex].position = eyePosition;
+		clusteredLighting.lights[spotLightIndex].direction = lookDir;
+
+		gpuProfiler.BeginScope("cubes");
+
+		// Upload the camera and lights blocks shared by every shader, and the material table if the lights changed it
+		sharedUniforms.Upload();
+		materialTable.Update(dirLight);
+		materialTable.Bind();
+
+		// Bin the point and spot lights into the clusters of the current view.
+		// The deferred path and the per-object light lists only need the light buffer, so they skip the binning.
+		const bool drawObjectLights = !useDeferred && (cubeFeatures & LightingObjectLights) != 0;
+		clusteredLighting.binLights = !useDeferred && !drawObjectLights;
+		clusteredLighting.Update(viewMatrix);
+		clusteredLighting.Bind();
+
+		// Recompute the cubes that changed since the last frame, and upload only those.
+		// The cached shadows of the static casters no longer match if any of them moved.
+		if (cubeTransforms.Update() > 0)
+		{
+			shadowMaps.InvalidateStatic();
+		}
+		cubeTransformBuffer.Upload(cubeTransforms);
+		cubeTransformBuffer.Bind();
+
+		// Cull the cubes that are outside the view frustum
+		Frustum viewFrustum = ExtractFrustum(projMatrix * viewMatrix);
+		const std::vector<glm::vec4>& cubeBounds = cubeTransforms.GetWorldBounds();
+		cubeCulling = CullSpheres(viewFrustum, cubeBounds.data(), cubeBounds.size(), visibleCubeIndices);
+
+		// Redraw the shadow tiles that no longer match the camera or the lights, from every cube,
+		// since the casters of a visible shadow may themselves be out of view. While they are off,
+		// the shaders still get told so, since the deferred ones sample the shadows regardless.
+		if (shadowMaps.enabled)
+		{
+			gpuProfiler.BeginScope("shadows");
+			shadowMaps.Update(eyePosition, dirLight, &clusteredLighting.lights[spotLightIndex], static_cast<int>(spotLightIndex),
+				cubeBounds, staticShadowCasters, dynamicShadowCasters);
+			shadowMaps.Bind();
+			gpuProfiler.EndScope();
+		}
+		else
+		{
+			shadowMaps.Disable();
+		}
 
-		// Render the cubes
-		for (int i = 0; i < cubePositions.size(); ++i)
+		// Queue the visible cubes, so they can be drawn sorted by program, material and mesh,
+		// with the level of detail their size on the screen calls for
+		cubeDraws.Clear();
+		for (uint32_t cube : visibleCubeIndices)
 		{
-			glm::mat4 modelMatrix = glm::mat4(1.0f);
-			modelMatrix = glm::translate(modelMatrix, cubePositions[i]);
+			uint32_t cubeMaterial = cubeMaterials[cube];
+			uint32_t lod = SelectMeshLod(objectMesh.lods, objectMesh.boundsRadius, cubeBounds[cube], eyePosition, projMatrix,
+				framebufferHeight, lodPixelError);
+			cubeDraws.Add(*materialPrograms[cubeMaterial], cubeMaterial, lod, cube);
+		}
+		cubeDraws.Prepare(cubeInstances);
 
-			float angle = 20.0f * i;
-			modelMatrix = glm::rotate(modelMatrix, glm::radians(angle), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(0.5f, 0.5f, 0.5f));
+		// Give every visible cube the list of the lights whose range reaches it, in the order
+		// the cubes were put in the instance buffer, which is how the shaders find their list
+		if (drawObjectLights)
+		{
+			clusteredLighting.GetLightSpheres(lightSpheres);
+			objectLights.Update(cubeBounds, cubeDraws.GetObjectIndices(), lightSpheres);
+			objectLights.Bind();
+		}
 
-			glUniformMatrix4fv(glGetUniformLocation(cubeProgram, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
-			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		// Show the culling, draw and shaded fragment counters in the window title whenever they change
+		const OverdrawStats& overdraw = depthPrepass.GetStats();
+		std::string title = std::string("Basic Lighting (") + (useDeferred ? "deferred" : "forward") + ") - visible: "
+			+ std::to_string(cubeCulling.visible) + ", culled: " + std::to_string(cubeCulling.culled);
+		title += ", draws: " + std::to_string(lastDrawStats.drawCalls) + ", state changes: " + std::to_string(lastDrawStats.GetStateChanges())
+			+ ", triangles: " + std::to_string(lastDrawStats.triangleCount);
+		if (drawObjectLights)
+		{
+			const ObjectLightStats& objectLightStats = objectLights.GetStats();
+			title += ", lights per cube: " + std::to_string(objectLightStats.maxLightsPerObject) + " max";
+		}
+		if (!useDeferred)
+		{
+			title += ", shaded: " + std::to_string(overdraw.shadedFragments);
+			if (overdraw.prepassEnabled)
+			{
+				title += " (" + std::to_string(overdraw.prepassFragments) + " without pre-pass)";
+			}
+		}
+		if (title != windowTitle)
+		{
+			glfwSetWindowTitle(window, title.c_str());
+			windowTitle = title;
+		}
+
+		// Render the visible cubes with one instanced draw call per program, material and mesh,
+		// into the G-buffer rather than shading them right away on the deferred path
+		if (useDeferred)
+		{
+			deferredRenderer.BeginGeometryPass();
+			cubeDraws.SubmitWithProgram(objectMeshes, cubeInstances, deferredRenderer.GetGeometryProgram());
+		}
+		else
+		{
+			// Lay down the depth of the nearest surfaces first, so that the lighting
+			// shader runs only once per covered pixel rather than for every overlapping cube
+			if (depthPrepass.enabled)
+			{
+				gpuProfiler.BeginScope("depth prepass");
+				depthPrepass.BeginDepthPass();
+				cubeDraws.SubmitGeometry(objectMeshes, cubeInstances);
+				depthPrepass.EndDepthPass();
+				gpuProfiler.EndScope();
+			}
+
+			depthPrepass.BeginShadingPass();
+			cubeDraws.Submit(objectMeshes, cubeInstances);
+			depthPrepass.EndShadingPass();
+		}
+
+		const DrawStats& drawStats = cubeDraws.GetStats();
+		lastDrawStats = drawStats;
+		totalDrawStats.drawCalls += drawStats.drawCalls;
+		totalDrawStats.triangleCount += drawStats.triangleCount;
+		totalDrawStats.programChanges += drawStats.programChanges;
+		totalDrawStats.materialChanges += drawStats.materialChanges;
+		totalDrawStats.meshChanges += drawStats.meshChanges;
+		totalDrawStats.unsortedStateChanges += drawStats.unsortedStateChanges;
+
+		gpuProfiler.EndScope();
+
+		// Shade the G-buffer into the frame, lighting only the visible pixels
+		if (useDeferred)
+		{
+			gpuProfiler.BeginScope("deferred lights");
+			deferredRenderer.ShadeLights(targetFbo, projMatrix, viewMatrix, clusteredLighting);
+			gpuProfiler.EndScope();
 		}
 
 		// --- Render a cube where the point light is for visualization purposes
 
+		gpuProfiler.BeginScope("light gizmo");
+
 		// Switch to the shader for the light source
-		glUseProgram(lightProgram);
+		glUseProgram(lightProgram.id);
 
 		// Bind the light source VAO
 		glBindVertexArray(lightVao);
@@ -342,27 +988,143 @@ int main()
 		lightModelMatrix = glm::translate(lightModelMatrix, spotLightPosition);
 		lightModelMatrix = glm::scale(lightModelMatrix, glm::vec3(0.1f, 0.1f, 0.1f));
 
-		// Pass the projection matrix to the shader
-		glUniformMatrix4fv(glGetUniformLocation(lightProgram, "projMatrix"), 1, GL_FALSE, glm::value_ptr(projMatrix));
-
-		// Pass the view matrix to the shader
-		glUniformMatrix4fv(glGetUniformLocation(lightProgram, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
-
 		// Pass the model matrix to the shader
-		glUniformMatrix4fv(glGetUniformLocation(lightProgram, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(lightModelMatrix));
+		glUniformMatrix4fv(lightModelMatrixLoc, 1, GL_FALSE, glm::value_ptr(lightModelMatrix));
 
 		// Pass the color of the light source to the shader
-		glUniform3fv(glGetUniformLocation(lightProgram, "color"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
+		glUniform3fv(lightColorLoc, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
 
 		// Draw the cube for the light source
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, cubeMesh.indexCount, cubeMesh.indexType, 0);
+
+		gpuProfiler.EndScope();
+
+		// Read the finished frame back without waiting for it
+		if (captureFrames)
+		{
+			gpuProfiler.BeginScope("capture");
+			frameCapture.Capture(frameIndex);
+			gpuProfiler.EndScope();
+		}
 
 		// Swap the front and back buffers
+		gpuProfiler.BeginScope("swap");
 		glfwSwapBuffers(window);
+		gpuProfiler.EndScope();
+
+		gpuProfiler.EndScope();
 
 		// Poll pending events
 		glfwPollEvents();
+
+		++frameIndex;
+		if (headless)
+		{
+			headlessFrameTimes.push_back(BenchmarkNowMs() - frameStartMs);
+			if (frameIndex >= headlessFrameCount)
+			{
+				glfwSetWindowShouldClose(window, GLFW_TRUE);
+			}
+		}
+	}
+
+	// Finish writing the frames still being captured
+	if (captureFrames)
+	{
+		frameCapture.Flush();
+		// Reported on stderr, so it does not end up in a headless report written to stdout
+		std::cerr << "Captured " << frameCapture.GetCapturedFrameCount() << " frames ("
+			<< frameCapture.GetStallCount() << " readback stalls)" << std::endl;
+	}
+
+	// Report whether reloading shaders caused any hitches
+	if (shaderReloader.GetReloadCount() + shaderReloader.GetFailedReloadCount() > 0)
+	{
+		shaderReloader.Print(std::cerr);
+	}
+
+	// Report how often the cached shadow maps had to be redrawn
+	const ShadowStats& shadowStats = shadowMaps.GetStats();
+	if (headless && shadowStats.updateCount > 0)
+	{
+		std::cerr << "Shadow maps redrawn in " << shadowStats.redrawUpdateCount << " of " << shadowStats.updateCount << " updates" << std::endl;
+	}
+
+	// Report how much program building the cache saved, on stderr like the other headless counters
+	if (!programCachePrefix.empty())
+	{
+		ProgramCache().Print(std::cerr);
+	}
+
+	// Report the timings of a headless run
+	if (headless)
+	{
+		// Reported on stderr, so it does not end up in a headless report written to stdout
+		const OverdrawStats& overdraw = depthPrepass.GetStats();
+		if (overdraw.frameCount > 0)
+		{
+			std::cerr << "Shaded " << overdraw.totalShadedFragments / overdraw.frameCount << " fragments per frame";
+			if (overdraw.totalPrepassFragments > 0)
+			{
+				std::cerr << " (" << overdraw.totalPrepassFragments / overdraw.frameCount << " without the depth pre-pass)";
+			}
+			std::cerr << std::endl;
+		}
+
+		// Reported per frame, against what drawing the cubes in culling order would have changed
+		std::cerr << "Submitted " << totalDrawStats.drawCalls / frameIndex << " draws and "
+			<< totalDrawStats.GetStateChanges() / frameIndex << " state changes per frame ("
+			<< totalDrawStats.programChanges / frameIndex << " programs, "
+			<< totalDrawStats.materialChanges / frameIndex << " materials, "
+			<< totalDrawStats.meshChanges / frameIndex << " meshes; "
+			<< totalDrawStats.unsortedStateChanges / frameIndex << " unsorted), "
+			<< totalDrawStats.triangleCount / frameIndex << " triangles per frame" << std::endl;
+
+		gpuProfiler.Flush();
+
+		FrameTimeSummary cpuFrameTimes = SummarizeFrameTimes(headlessFrameTimes);
+		if (benchmarkOutputPath.empty())
+		{
+			WriteHeadlessReport(std::cout, offscreenTarget.width, offscreenTarget.height, cpuFrameTimes, gpuProfiler);
+		}
+		else
+		{
+			std::ofstream reportFile(benchmarkOutputPath);
+			if (reportFile.fail())
+			{
+				std::cerr << "Cannot write benchmark report to " << benchmarkOutputPath << std::endl;
+			}
+			WriteHeadlessReport(reportFile, offscreenTarget.width, offscreenTarget.height, cpuFrameTimes, gpuProfiler);
+		}
+	}
+
+	// Report the GPU timings
+	if (!gpuProfilePath.empty())
+	{
+		gpuProfiler.Print(std::cout);
+		if (!gpuProfiler.WriteFile(gpuProfilePath))
+		{
+			std::cerr << "Cannot write GPU profile to " << gpuProfilePath << std::endl;
+		}
 	}
+	gpuProfiler.Destroy();
+
+	frameCapture.Destroy();
+	offscreenTarget.Destroy();
+	cubeTransformBuffer.Destroy();
+	cubeInstances.Destroy();
+	glDeleteVertexArrays(1, &lightVao);
+	objectMesh.Destroy();
+	cubeMesh.Destroy();
+	objectLights.Destroy();
+	materialTable.Destroy();
+	shadowMaps.Destroy();
+	depthPrepass.Destroy();
+	deferredRenderer.Destroy();
+	clusteredLighting.Destroy();
+	shaderReloader.Destroy();
+	cubeVariants.Destroy();
+	sharedUniforms.Destroy();
 
 	// Terminate GLFW
 	glfwTerminate();
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "ClusteredLighting.h"
+#include "GLUtils.h"
+#include "UniformBlocks.h"
+
+// Texture unit of the material table
+const GLint MaterialsTextureUnit = 12;
+
+// Number of RGBA32F texels taken up by one material in the material table
+const GLint TexelsPerMaterial = 6;
+
+// GLSL side of the material table, pulled into fragment shaders with
+// #include "Materials.glsl" (after "UniformBlocks.glsl"). Shaders call
+// LoadMaterial() first thing, and read the draw's material from material.
+const char* const MaterialsSource = R"(
+// Per material: ambient color and shininess, diffuse and specular colors,
+// then the same colors already multiplied by those of the directional light
+uniform samplerBuffer materials;
+
+// Index of the material of the current draw in the material table
+uniform int materialIndex;
+
+struct Material
+{
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+	float shininess;
+
+	// Material colors times directional light colors, precomputed on the CPU
+	vec3 dirLightAmbient;
+	vec3 dirLightDiffuse;
+	vec3 dirLightSpecular;
+};
+
+// Material of the current draw, filled in by LoadMaterial
+Material material;
+
+void LoadMaterial()
+{
+	int base = materialIndex * 6;
+	vec4 ambientShininess = texelFetch(materials, base);
+	material.ambient = ambientShininess.rgb;
+	material.shininess = ambientShininess.w;
+	material.diffuse = texelFetch(materials, base + 1).rgb;
+	material.specular = texelFetch(materials, base + 2).rgb;
+	material.dirLightAmbient = texelFetch(materials, base + 3).rgb;
+	material.dirLightDiffuse = texelFetch(materials, base + 4).rgb;
+	material.dirLightSpecular = texelFetch(materials, base + 5).rgb;
+}
+)";
+
+// Surface colors of a material
+struct Material
+{
+	glm::vec3 ambient = glm::vec3(1.0f);
+	glm::vec3 diffuse = glm::vec3(1.0f);
+	glm::vec3 specular = glm::vec3(0.0f);
+	float shininess = 32.0f;
+};
+
+// Material as laid out in the material table
+struct GpuMaterial
+{
+	glm::vec3 ambient;
+	float shininess;
+	glm::vec3 diffuse;
+	float pad0;
+	glm::vec3 specular;
+	float pad1;
+	glm::vec3 dirLightAmbient;
+	float pad2;
+	glm::vec3 dirLightDiffuse;
+	float pad3;
+	glm::vec3 dirLightSpecular;
+	float pad4;
+};
+
+static_assert(sizeof(GpuMaterial) == TexelsPerMaterial * sizeof(glm::vec4), "GpuMaterial does not fill whole texels");
+
+// Registers the material table with the shaders.
+// Must be called before creating any shader program that uses it.
+void RegisterMaterials()
+{
+	RegisterShaderInclude("Materials.glsl", MaterialsSource);
+	RegisterSamplerBinding("materials", MaterialsTextureUnit);
+}
+
+// Table of every material in the scene, kept in a texture buffer that draws
+// index into with the materialIndex uniform. Terms that only depend on the
+// material and the directional light are computed here rather than per fragment,
+// and the table is only uploaded again when the materials or that light change.
+class MaterialTable
+{
+public:
+	std::vector<Material> materials;
+
+	void Create()
+	{
+		buffer.Create(GL_RGBA32F);
+	}
+
+	// Adds a material to the table
+	// @param	material	Material to add
+	// @return	Returns the index of the material
+	uint32_t Add(const Material& material)
+	{
+		materials.push_back(material);
+		return static_cast<uint32_t>(materials.size() - 1);
+	}
+
+	// Recomputes and uploads the table if the materials or the directional light changed
+	// @param	dirLight	Directional light of the frame
+	// @return	Returns true if the table was uploaded
+	bool Update(const DirectionalLightData& dirLight)
+	{
+		std::vector<GpuMaterial> table(materials.size());
+		for (size_t i = 0; i < materials.size(); ++i)
+		{
+			const Material& material = materials[i];
+			GpuMaterial& gpuMaterial = table[i];
+			gpuMaterial = GpuMaterial();
+			gpuMaterial.ambient = material.ambient;
+			gpuMaterial.shininess = material.shininess;
+			gpuMaterial.diffuse = material.diffuse;
+			gpuMaterial.specular = material.specular;
+			gpuMaterial.dirLightAmbient = dirLight.ambient * material.ambient;
+			gpuMaterial.dirLightDiffuse = dirLight.diffuse * material.diffuse;
+			gpuMaterial.dirLightSpecular = dirLight.specular * material.specular;
+		}
+
+		// The table is tiny, so comparing it is far cheaper than uploading it every frame
+		if (uploaded && table.size() == gpuMaterials.size()
+			&& std::memcmp(table.data(), gpuMaterials.data(), table.size() * sizeof(GpuMaterial)) == 0)
+		{
+			return false;
+		}
+		gpuMaterials.swap(table);
+		buffer.Upload(gpuMaterials.data(), gpuMaterials.size() * sizeof(GpuMaterial));
+		uploaded = true;
+		return true;
+	}
+
+	// Binds the table to its texture unit
+	void Bind() const
+	{
+		buffer.Bind(MaterialsTextureUnit);
+	}
+
+	void Destroy()
+	{
+		buffer.Destroy();
+		gpuMaterials.clear();
+		uploaded = false;
+	}
+
+private:
+	TextureBuffer buffer;
+	std::vector<GpuMaterial> gpuMaterials;
+	bool uploaded = false;
+};
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include "VertexFormats.h"
+
+// Level of detail of a mesh: the range of its indices drawing a simplified version of it
+struct MeshLod
+{
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+
+	// Error of the simplified surface against the full one (see SimplifyMesh), as a distance in the mesh's own units
+	float error = 0.0f;
+};
+
+static_assert(sizeof(MeshLod) == 12, "MeshLod is stored as is in mesh cache files");
+
+// Gets the smallest index type that can refer to every vertex of a mesh
+// @param	vertexCount	Number of vertices of the mesh
+// @return	Returns GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+GLenum GetIndexType(size_t vertexCount)
+{
+	return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+// Gets the size of an index of a type
+GLsizei GetIndexSize(GLenum indexType)
+{
+	return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// Encodes indices as a type
+// @param	indices		Indices to encode
+// @param	count		Number of indices
+// @param	indexType	GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, which must fit every index
+// @return	Returns count indices of GetIndexSize(indexType) bytes
+std::vector<char> EncodeIndices(const uint32_t* indices, size_t count, GLenum indexType)
+{
+	std::vector<char> encoded(count * GetIndexSize(indexType));
+	if (indexType == GL_UNSIGNED_SHORT)
+	{
+		uint16_t* shortIndices = reinterpret_cast<uint16_t*>(encoded.data());
+		for (size_t i = 0; i < count; ++i)
+		{
+			shortIndices[i] = static_cast<uint16_t>(indices[i]);
+		}
+	}
+	else if (count > 0)
+	{
+		std::memcpy(encoded.data(), indices, encoded.size());
+	}
+	return encoded;
+}
+
+// Interleaved vertices and triangle indices of a mesh, laid out as they are uploaded with glBufferData
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+
+	// Levels of detail from the most detailed on, empty if the mesh has none
+	std::vector<MeshLod> lods;
+
+	// Bounding sphere of the vertices, in the mesh's own space
+	glm::vec3 boundsCenter = glm::vec3(0.0f);
+	float boundsRadius = 0.0f;
+};
+
+// Mesh data owned by someone else, such as a mapped mesh cache file,
+// so that it can be uploaded without being copied first
+struct MeshView
+{
+	// Vertices in the given format
+	const void* vertices = nullptr;
+	size_t vertexCount = 0;
+	VertexFormat vertexFormat = VertexFormat::Float;
+
+	// Indices of the given type
+	const void* indices = nullptr;
+	size_t indexCount = 0;
+	GLenum indexType = GL_UNSIGNED_INT;
+
+	const MeshLod* lods = nullptr;
+	size_t lodCount = 0;
+
+	glm::vec3 boundsCenter = glm::vec3(0.0f);
+	float boundsRadius = 0.0f;
+};
+
+// Gets a view of a mesh, valid as long as the mesh is left unchanged
+// @param	mesh	Mesh to view, with its vertices in VertexFormat::Float and 32-bit indices
+// @return	Returns the view
+MeshView ViewMesh(const MeshData& mesh)
+{
+	MeshView view;
+	view.vertices = mesh.vertices.data();
+	view.vertexCount = mesh.vertices.size();
+	view.indices = mesh.indices.data();
+	view.indexCount = mesh.indices.size();
+	view.lods = mesh.lods.data();
+	view.lodCount = mesh.lods.size();
+	view.boundsCenter = mesh.boundsCenter;
+	view.boundsRadius = mesh.boundsRadius;
+	return view;
+}
+
+// Computes the bounding sphere of a mesh, centered on the middle of its bounding box
+// @param	mesh	Mesh whose bounds are set
+void ComputeMeshBounds(MeshData& mesh)
+{
+	if (mesh.vertices.empty())
+	{
+		mesh.boundsCenter = glm::vec3(0.0f);
+		mesh.boundsRadius = 0.0f;
+		return;
+	}
+
+	glm::vec3 boundsMin(mesh.vertices[0].x, mesh.vertices[0].y, mesh.vertices[0].z);
+	glm::vec3 boundsMax = boundsMin;
+	for (const Vertex& vertex : mesh.vertices)
+	{
+		glm::vec3 position(vertex.x, vertex.y, vertex.z);
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+
+	mesh.boundsCenter = (boundsMin + boundsMax) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (const Vertex& vertex : mesh.vertices)
+	{
+		glm::vec3 offset = glm::vec3(vertex.x, vertex.y, vertex.z) - mesh.boundsCenter;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	mesh.boundsRadius = std::sqrt(radiusSquared);
+}
+
+// Moves and scales a mesh so that its bounding sphere becomes the given one,
+// letting any mesh take the place of another in a scene
+// @param	mesh	Mesh to fit, with its bounds computed
+// @param	center	Center of the sphere to fit the mesh in
+// @param	radius	Radius of the sphere to fit the mesh in
+void FitMeshToSphere(MeshData& mesh, const glm::vec3& center, float radius)
+{
+	float scale = mesh.boundsRadius > 0.0f ? radius / mesh.boundsRadius : 1.0f;
+	for (Vertex& vertex : mesh.vertices)
+	{
+		glm::vec3 position = (glm::vec3(vertex.x, vertex.y, vertex.z) - mesh.boundsCenter) * scale + center;
+		vertex.x = position.x;
+		vertex.y = position.y;
+		vertex.z = position.z;
+	}
+	mesh.boundsCenter = center;
+	mesh.boundsRadius = mesh.boundsRadius > 0.0f ? radius : 0.0f;
+}
+
+// Builds the cube spanning -1 to 1 on every axis, with a flat normal and a color per face
+// @return	Returns the cube mesh
+MeshData CreateCubeMesh()
+{
+	// Vertices of the cube.
+	// Convention for each face: lower-left, lower-right, upper-right, upper-left
+	const Vertex cubeVertices[] =
+	{
+		// Front
+		{ -1.0f, -1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	255, 0, 0, 255 },
+		{ 1.0f, -1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	255, 0, 0, 255 },
+		{ 1.0f, 1.0f, 1.0f,		0.0f, 0.0f, 1.0f,	255, 0, 0, 255 },
+		{ -1.0f, 1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	255, 0, 0, 255 },
+
+		// Back
+		{ 1.0f, -1.0f, -1.0f,	0.0f, 0.0f, -1.0f,	0, 255, 0, 255 },
+		{ -1.0f, -1.0f, -1.0f,	0.0f, 0.0f, -1.0f,	0, 255, 0, 255 },
+		{ -1.0f, 1.0f, -1.0f,	0.0f, 0.0f, -1.0f,	0, 255, 0, 255 },
+		{ 1.0f, 1.0f, -1.0f,	0.0f, 0.0f, -1.0f,	0, 255, 0, 255 },
+
+		// Left
+		{ -1.0f, -1.0f, -1.0f,	-1.0f, 0.0f, 0.0f,	0, 0, 255, 255 },
+		{ -1.0f, -1.0f, 1.0f,	-1.0f, 0.0f, 0.0f,	0, 0, 255, 255 },
+		{ -1.0f, 1.0f, 1.0f,	-1.0f, 0.0f, 0.0f,	0, 0, 255, 255 },
+		{ -1.0f, 1.0f, -1.0f,	-1.0f, 0.0f, 0.0f,	0, 0, 255, 255 },
+
+		// Right
+		{ 1.0f, -1.0f, 1.0f,	1.0f, 0.0f, 0.0f,	255, 255, 0, 255 },
+		{ 1.0f, -1.0f, -1.0f,	1.0f, 0.0f, 0.0f,	255, 255, 0, 255 },
+		{ 1.0f, 1.0f, -1.0f,	1.0f, 0.0f, 0.0f,	255, 255, 0, 255 },
+		{ 1.0f, 1.0f, 1.0f,		1.0f, 0.0f, 0.0f,	255, 255, 0, 255 },
+
+		// Top
+		{ -1.0f, 1.0f, 1.0f,	0.0f, 1.0f, 0.0f,	255, 0, 255, 255 },
+		{ 1.0f, 1.0f, 1.0f,		0.0f, 1.0f, 0.0f,	255, 0, 255, 255 },
+		{ 1.0f, 1.0f, -1.0f,	0.0f, 1.0f, 0.0f,	255, 0, 255, 255 },
+		{ -1.0f, 1.0f, -1.0f,	0.0f, 1.0f, 0.0f,	255, 0, 255, 255 },
+
+		// Bottom
+		{ -1.0f, -1.0f, -1.0f,	0.0f, -1.0f, 0.0f,	0, 255, 255, 255 },
+		{ 1.0f, -1.0f, -1.0f,	0.0f, -1.0f, 0.0f,	0, 255, 255, 255 },
+		{ 1.0f, -1.0f, 1.0f,	0.0f, -1.0f, 0.0f,	0, 255, 255, 255 },
+		{ -1.0f, -1.0f, 1.0f,	0.0f, -1.0f, 0.0f,	0, 255, 255, 255 }
+	};
+
+	// Vertex indices for the cube
+	const uint32_t cubeIndices[] =
+	{
+		// Front
+		0, 1, 2, 2, 3, 0,
+
+		// Back
+		4, 5, 6, 6, 7, 4,
+
+		// Left
+		8, 9, 10, 10, 11, 8,
+
+		// Right
+		12, 13, 14, 14, 15, 12,
+
+		// Top
+		16, 17, 18, 18, 19, 16,
+
+		// Bottom
+		20, 21, 22, 22, 23, 20
+	};
+
+	MeshData mesh;
+	mesh.vertices.assign(std::begin(cubeVertices), std::end(cubeVertices));
+	mesh.indices.assign(std::begin(cubeIndices), std::end(cubeIndices));
+	ComputeMeshBounds(mesh);
+	return mesh;
+}
+
+// Vertex and index buffers of a mesh on the GPU, with a VAO feeding the
+// position, normal and color attributes (locations 0, 1 and 2)
+class GpuMesh
+{
+public:
+	// Uploads a mesh and sets up its VAO, with 16-bit indices if the mesh has few enough vertices
+	// @param	mesh			Mesh to upload
+	// @param	vertexFormat	Format to encode the vertices to
+	void Create(const MeshData& mesh, VertexFormat vertexFormat = VertexFormat::Float)
+	{
+		MeshView view = ViewMesh(mesh);
+		std::vector<char> encodedVertices;
+		if (vertexFormat != VertexFormat::Float)
+		{
+			encodedVertices = EncodeVertices(mesh.vertices.data(), mesh.vertices.size(), vertexFormat);
+			view.vertices = encodedVertices.data();
+			view.vertexFormat = vertexFormat;
+		}
+		std::vector<char> encodedIndices;
+		if (GetIndexType(mesh.vertices.size()) != GL_UNSIGNED_INT)
+		{
+			view.indexType = GetIndexType(mesh.vertices.size());
+			encodedIndices = EncodeIndices(mesh.indices.data(), mesh.indices.size(), view.indexType);
+			view.indices = encodedIndices.data();
+		}
+		Create(view);
+	}
+
+	// Uploads a mesh straight from where it is kept and sets up its VAO
+	// @param	mesh	Mesh to upload, which is no longer needed afterwards
+	void Create(const MeshView& mesh)
+	{
+		lods.assign(mesh.lods, mesh.lods + mesh.lodCount);
+		indexCount = static_cast<GLsizei>(lods.empty() ? mesh.indexCount : lods[0].indexCount);
+		indexType = mesh.indexType;
+		vertexFormat = mesh.vertexFormat;
+		boundsRadius = mesh.boundsRadius;
+
+		// Construct VBO for the mesh
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * GetVertexStride(mesh.vertexFormat), mesh.vertices, GL_STATIC_DRAW);
+
+		// Construct EBO (Element Buffer Object) for the mesh
+		glGenBuffers(1, &ebo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexCount * GetIndexSize(mesh.indexType), mesh.indices, GL_STATIC_DRAW);
+
+		// Construct VAO for the mesh
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		SetupVertexAttributes(vertexFormat);
+	}
+
+	void Destroy()
+	{
+		glDeleteVertexArrays(1, &vao);
+		glDeleteBuffers(1, &vbo);
+		glDeleteBuffers(1, &ebo);
+		vao = vbo = ebo = 0;
+		indexCount = 0;
+		lods.clear();
+	}
+
+	GLuint vbo = 0;
+	GLuint ebo = 0;
+	GLuint vao = 0;
+
+	// Number of indices of the full detail, which the index buffer starts with
+	GLsizei indexCount = 0;
+	GLenum indexType = GL_UNSIGNED_INT;
+	VertexFormat vertexFormat = VertexFormat::Float;
+
+	// Levels of detail in the index buffer, empty if the mesh has none
+	std::vector<MeshLod> lods;
+	float boundsRadius = 0.0f;
+};
+
+// Picks the coarsest level of detail of a mesh whose error, projected on the screen, stays under a threshold.
+// The error scales with the object from the mesh's bounds to its world bounds, and is projected at the
+// nearest point of the world bounds, so a level is never picked for an object closer than its error allows.
+// @param	lods			Levels of detail of the mesh, from the most detailed on
+// @param	boundsRadius	Bounding radius of the mesh, in its own space
+// @param	worldBounds		Bounding sphere of the object in world space, with the radius in w
+// @param	eyePosition		Position of the camera in world space
+// @param	projMatrix		Projection of the camera
+// @param	viewportHeight	Height of the viewport, in pixels
+// @param	maxPixelError	Largest error allowed, in pixels
+// @return	Returns the index of the level, 0 if the mesh has no levels
+uint32_t SelectMeshLod(const std::vector<MeshLod>& lods, float boundsRadius, const glm::vec4& worldBounds, const glm::vec3& eyePosition,
+	const glm::mat4& projMatrix, int viewportHeight, float maxPixelError)
+{
+	const float distance = glm::length(glm::vec3(worldBounds) - eyePosition) - worldBounds.w;
+	if (lods.size() < 2 || distance <= 0.0f || boundsRadius <= 0.0f)
+	{
+		return 0;
+	}
+
+	// projMatrix[1][1] is the cotangent of half the vertical field of view: a world unit at distance d spans
+	// projMatrix[1][1] / d of the half-height of the viewport. The mesh's units are scaled to the world's on top.
+	const float pixelsPerUnit = projMatrix[1][1] * viewportHeight * 0.5f / distance * (worldBounds.w / boundsRadius);
+	for (size_t i = lods.size() - 1; i > 0; --i)
+	{
+		if (lods[i].error * pixelsPerUnit <= maxPixelError)
+		{
+			return static_cast<uint32_t>(i);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,703 @@
+#pragma once
+
+#ifdef _WIN32
+// windows.h defines APIENTRY the same way glad does, and would complain about the redefinition
+#undef APIENTRY
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ObjLoader.h"
+
+// Version of the mesh cache format. Bump it whenever the layout of the file or
+// what the import makes of a source changes, so that older caches get rebuilt.
+const uint32_t MeshCacheVersion = 4;
+
+// Alignment of the streams in a mesh cache file, from the start of the file
+const size_t MeshCacheAlignment = 64;
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Unmaps the file, so that a load that throws doesn't leave it mapped
+	~MappedFile()
+	{
+		Close();
+	}
+
+	// Maps a file
+	// @param	path	Path of the file
+	// @return	Returns true if the file was mapped
+	bool Open(const std::string& path)
+	{
+		Close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize))
+		{
+			CloseHandle(file);
+			return false;
+		}
+		size = static_cast<size_t>(fileSize.QuadPart);
+
+		// Empty files can't be mapped, but there is nothing to read from them anyway
+		if (size > 0)
+		{
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping)
+			{
+				data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				CloseHandle(mapping);
+			}
+		}
+
+		// The view keeps the file open
+		CloseHandle(file);
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			return false;
+		}
+		struct stat info;
+		if (fstat(file, &info) != 0)
+		{
+			close(file);
+			return false;
+		}
+		size = static_cast<size_t>(info.st_size);
+
+		// Empty files can't be mapped, but there is nothing to read from them anyway
+		if (size > 0)
+		{
+			void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+			data = mapping != MAP_FAILED ? static_cast<const char*>(mapping) : nullptr;
+		}
+
+		// The mapping keeps the file open
+		close(file);
+#endif
+
+		if (size > 0 && !data)
+		{
+			size = 0;
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		if (data)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(data);
+#else
+			munmap(const_cast<char*>(data), size);
+#endif
+		}
+		data = nullptr;
+		size = 0;
+	}
+
+	const char* GetData() const
+	{
+		return data;
+	}
+
+	size_t GetSize() const
+	{
+		return size;
+	}
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+};
+
+// Gets the size and modification time of a file
+// @param	path	Path of the file
+// @param	size	Receives the size of the file in bytes
+// @param	time	Receives the modification time of the file
+// @return	Returns true if the file exists
+bool GetFileStamp(const std::string& path, uint64_t& size, int64_t& time)
+{
+#ifdef _WIN32
+	// The 64-bit version, since meshes can be larger than 2 GB
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0)
+	{
+		return false;
+	}
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+	{
+		return false;
+	}
+#endif
+	size = static_cast<uint64_t>(info.st_size);
+	time = static_cast<int64_t>(info.st_mtime);
+	return true;
+}
+
+// Hashes a block of memory 8 bytes at a time, fast enough to hash multi-gigabyte
+// sources on every load where they might have changed. Not byte order independent,
+// which doesn't matter for caches that stay on the machine that wrote them.
+// @param	data	Bytes to hash
+// @param	size	Number of bytes
+// @param	hash	Hash to continue from
+// @return	Returns the hash of the bytes
+uint64_t HashMemory64(const char* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const uint64_t prime = 1099511628211ull;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; ++i)
+	{
+		hash = (hash ^ static_cast<uint8_t>(data[i])) * prime;
+	}
+	return hash ^ size;
+}
+
+// How a source mesh is turned into the mesh that is cached. Everything in it
+// is part of the cache key, so changing any setting rebuilds the cache.
+struct MeshImportSettings
+{
+	// Whether to move and scale the mesh into the sphere below (see FitMeshToSphere)
+	bool fitToSphere = false;
+	glm::vec3 fitCenter = glm::vec3(0.0f);
+	float fitRadius = 1.0f;
+
+	// Format the vertices are stored in, ready to be uploaded as they are
+	VertexFormat vertexFormat = VertexFormat::Float;
+
+	// Whether to generate levels of detail (see GenerateMeshLods)
+	bool generateLods = true;
+
+	// Whether to reorder the triangles and vertices for the vertex caches (see OptimizeMesh)
+	bool optimize = true;
+
+	// Gets the hash of the settings
+	uint64_t GetHash() const
+	{
+		const float values[] = { fitToSphere ? 1.0f : 0.0f, fitCenter.x, fitCenter.y, fitCenter.z, fitRadius,
+			static_cast<float>(vertexFormat), generateLods ? 1.0f : 0.0f, optimize ? 1.0f : 0.0f };
+		return HashMemory64(reinterpret_cast<const char*>(values), sizeof(values));
+	}
+};
+
+// Turns the contents of an OBJ source into the mesh to draw
+// @param	text			Contents of the source
+// @param	size			Size of the contents in bytes
+// @param	settings		How to import the mesh
+// @param	loadStats		Receives the counters and timings of the parse, unless null
+// @param	lodStats		Receives the levels of detail generated, unless null
+// @param	optimizeStats	Receives the counters of the optimization, unless null
+// @return	Returns the mesh, with its bounds computed
+MeshData ImportObjMesh(const char* text, size_t size, const MeshImportSettings& settings, MeshLoadStats* loadStats = nullptr,
+	MeshLodStats* lodStats = nullptr, MeshOptimizeStats* optimizeStats = nullptr)
+{
+	MeshData mesh = ParseObjMesh(text, size, 0, loadStats);
+	if (settings.fitToSphere)
+	{
+		FitMeshToSphere(mesh, settings.fitCenter, settings.fitRadius);
+	}
+
+	// The levels of detail come before the optimization, which orders the triangles of each of them
+	if (settings.generateLods)
+	{
+		GenerateMeshLods(mesh, 8, 0.1f, lodStats);
+	}
+	if (settings.optimize)
+	{
+		OptimizeMesh(mesh, optimizeStats);
+	}
+	return mesh;
+}
+
+// Counters and timings of a mesh load through the cache
+struct MeshCacheStats
+{
+	// Whether the mesh came from the cache, and why not otherwise
+	bool hit = false;
+	std::string missReason;
+
+	// Whether the source had to be hashed because its size or time changed
+	bool sourceHashed = false;
+
+	size_t cacheBytes = 0;
+
+	// Time spent hashing the source, mapping the cache, converting the source and writing the cache
+	double hashMs = 0.0;
+	double mapMs = 0.0;
+	double convertMs = 0.0;
+	double writeMs = 0.0;
+	double totalMs = 0.0;
+
+	// Counters of the conversion, on a miss
+	MeshLoadStats convert;
+	bool lodsGenerated = false;
+	MeshLodStats lods;
+	bool optimized = false;
+	MeshOptimizeStats optimize;
+
+	// Prints the counters and timings
+	void Print(std::ostream& out) const
+	{
+		out << std::fixed << std::setprecision(2);
+		if (hit)
+		{
+			out << "Mesh cache hit: " << cacheBytes / 1048576.0 << " MB mapped in " << mapMs << " ms";
+		}
+		else
+		{
+			out << "Mesh cache miss (" << missReason << "): converted in " << convertMs << " ms";
+			if (cacheBytes > 0)
+			{
+				out << ", wrote " << cacheBytes / 1048576.0 << " MB in " << writeMs << " ms";
+			}
+		}
+		if (sourceHashed)
+		{
+			out << ", source hashed in " << hashMs << " ms";
+		}
+		out << ", " << totalMs << " ms in total" << std::defaultfloat << std::endl;
+		if (!hit)
+		{
+			convert.Print(out);
+			if (lodsGenerated)
+			{
+				lods.Print(out);
+			}
+			if (optimized)
+			{
+				optimize.Print(out);
+			}
+		}
+	}
+};
+
+// Mesh loaded through a binary cache file kept next to its source (<source>.meshcache).
+// The first load of a source converts it and writes the cache; later loads map the
+// cache and hand its streams straight to glBufferData, without parsing or copying.
+// A cache is used as long as it has the current version, was imported with the
+// same settings and matches the contents of the source: when the size or time of
+// the source changed, the source is hashed again and compared to the hash the
+// cache was built from.
+//
+// Layout of a cache file: the header, then the vertex, index and LOD streams, each
+// starting at a multiple of MeshCacheAlignment. Streams hold their elements exactly
+// as they are in memory, so a cache only works on the kind of machine that wrote it.
+class CachedMesh
+{
+public:
+	// Loads a mesh, from its cache if it is valid, from its source otherwise
+	// @param	sourcePath	Path of the OBJ source
+	// @param	settings	How to import the mesh
+	// @param	useCache	Whether to use the cache, or always convert the source and write nothing
+	void Load(const std::string& sourcePath, const MeshImportSettings& settings, bool useCache = true)
+	{
+		using Clock = std::chrono::steady_clock;
+		auto elapsedMs = [](Clock::time_point since) { return std::chrono::duration<double, std::milli>(Clock::now() - since).count(); };
+		auto start = Clock::now();
+
+		Close();
+		stats = MeshCacheStats();
+		cachePath = sourcePath + ".meshcache";
+
+		uint64_t sourceSize = 0;
+		int64_t sourceTime = 0;
+		if (!GetFileStamp(sourcePath, sourceSize, sourceTime))
+		{
+			throw std::runtime_error("Cannot open mesh file " + sourcePath);
+		}
+		const uint64_t settingsHash = settings.GetHash();
+
+		// The source is only mapped if it has to be hashed or converted
+		MappedFile source;
+		uint64_t sourceHash = 0;
+		bool sourceHashed = false;
+		auto hashSource = [&]()
+		{
+			if (!sourceHashed)
+			{
+				auto hashStart = Clock::now();
+				if (!source.Open(sourcePath))
+				{
+					throw std::runtime_error("Cannot open mesh file " + sourcePath);
+				}
+				sourceHash = HashMemory64(source.GetData(), source.GetSize());
+				sourceHashed = true;
+				stats.sourceHashed = true;
+				stats.hashMs = elapsedMs(hashStart);
+			}
+		};
+
+		if (!useCache)
+		{
+			stats.missReason = "cache off";
+		}
+		else
+		{
+			auto mapStart = Clock::now();
+			const char* reason = MapCache(settingsHash, settings.vertexFormat);
+			if (!reason)
+			{
+				const FileHeader& header = GetHeader();
+				if (header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+				{
+					hashSource();
+					if (sourceHash == header.sourceHash)
+					{
+						// Same contents with a new time, e.g. after a checkout. Stamp the cache with it
+						// once it is unmapped, so the next load doesn't hash the source again.
+						restamp = true;
+						restampSize = sourceSize;
+						restampTime = sourceTime;
+					}
+					else
+					{
+						reason = "source changed";
+					}
+				}
+			}
+
+			if (!reason)
+			{
+				stats.hit = true;
+				stats.cacheBytes = cache.GetSize();
+				stats.mapMs = elapsedMs(mapStart) - stats.hashMs;
+				stats.totalMs = elapsedMs(start);
+				return;
+			}
+			stats.missReason = reason;
+			cache.Close();
+		}
+
+		// Convert the source, and keep the mesh in memory rather than mapping the cache just written
+		hashSource();
+		auto convertStart = Clock::now();
+		try
+		{
+			converted = ImportObjMesh(source.GetData(), source.GetSize(), settings, &stats.convert, &stats.lods, &stats.optimize);
+			stats.lodsGenerated = settings.generateLods;
+			stats.optimized = settings.optimize;
+		}
+		catch (const std::exception& e)
+		{
+			throw std::runtime_error(sourcePath + ": " + e.what());
+		}
+		source.Close();
+		view = ViewMesh(converted);
+		if (settings.vertexFormat != VertexFormat::Float)
+		{
+			encodedVertices = EncodeVertices(converted.vertices.data(), converted.vertices.size(), settings.vertexFormat);
+			converted.vertices = std::vector<Vertex>();
+			view.vertices = encodedVertices.data();
+			view.vertexFormat = settings.vertexFormat;
+		}
+		if (GetIndexType(view.vertexCount) != GL_UNSIGNED_INT)
+		{
+			view.indexType = GetIndexType(view.vertexCount);
+			encodedIndices = EncodeIndices(converted.indices.data(), converted.indices.size(), view.indexType);
+			converted.indices = std::vector<uint32_t>();
+			view.indices = encodedIndices.data();
+		}
+		stats.convertMs = elapsedMs(convertStart);
+
+		if (useCache)
+		{
+			auto writeStart = Clock::now();
+			FileHeader header = CreateHeader(sourceHash, sourceSize, sourceTime, settingsHash);
+			if (WriteCache(header))
+			{
+				stats.cacheBytes = static_cast<size_t>(header.fileSize);
+			}
+			stats.writeMs = elapsedMs(writeStart);
+		}
+		stats.totalMs = elapsedMs(start);
+	}
+
+	// Gets the loaded mesh, valid until Close
+	const MeshView& GetView() const
+	{
+		return view;
+	}
+
+	const MeshCacheStats& GetStats() const
+	{
+		return stats;
+	}
+
+	// Releases the loaded mesh, once it has been uploaded
+	void Close()
+	{
+		cache.Close();
+		converted = MeshData();
+		encodedVertices = std::vector<char>();
+		encodedIndices = std::vector<char>();
+		view = MeshView();
+
+		// Only write to the cache file once it is no longer mapped
+		if (restamp)
+		{
+			std::fstream file(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+			file.seekp(offsetof(FileHeader, sourceSize));
+			file.write(reinterpret_cast<const char*>(&restampSize), sizeof(restampSize));
+			file.write(reinterpret_cast<const char*>(&restampTime), sizeof(restampTime));
+			restamp = false;
+		}
+	}
+
+private:
+	// Kinds of stream in a cache file
+	enum StreamKind
+	{
+		VertexStream,
+		IndexStream,
+		LodStream,
+		StreamCount
+	};
+
+	// Where a stream is in the file, and the size of its elements, which must match those of this build
+	struct Stream
+	{
+		uint64_t offset;
+		uint64_t size;
+		uint32_t elementSize;
+		uint32_t pad;
+	};
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t fileSize;
+
+		// What the mesh was built from
+		uint64_t sourceHash;
+		uint64_t settingsHash;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+
+		float boundsCenter[3];
+		float boundsRadius;
+
+		Stream streams[StreamCount];
+	};
+
+	const FileHeader& GetHeader() const
+	{
+		return *reinterpret_cast<const FileHeader*>(cache.GetData());
+	}
+
+	// Maps the cache file and checks that it can be used, apart from matching the source
+	// @param	settingsHash	Hash of the import settings
+	// @param	vertexFormat	Format of the vertices the settings ask for
+	// @return	Returns null if the cache can be used, or why it can't
+	const char* MapCache(uint64_t settingsHash, VertexFormat vertexFormat)
+	{
+		if (!cache.Open(cachePath))
+		{
+			return "no cache";
+		}
+		if (cache.GetSize() < sizeof(FileHeader) || std::memcmp(GetHeader().magic, "MSHC", sizeof(GetHeader().magic)) != 0)
+		{
+			return "not a mesh cache";
+		}
+
+		const FileHeader& header = GetHeader();
+		if (header.version != MeshCacheVersion)
+		{
+			return "old version";
+		}
+		if (header.fileSize != cache.GetSize())
+		{
+			return "truncated";
+		}
+		if (header.settingsHash != settingsHash)
+		{
+			return "import settings changed";
+		}
+
+		// Meshes with few enough vertices have 16-bit indices
+		const uint32_t vertexStride = static_cast<uint32_t>(GetVertexStride(vertexFormat));
+		const uint64_t vertexCount = header.streams[VertexStream].size / vertexStride;
+		const GLenum indexType = GetIndexType(static_cast<size_t>(vertexCount));
+		const uint32_t elementSizes[StreamCount] = { vertexStride, static_cast<uint32_t>(GetIndexSize(indexType)), sizeof(MeshLod) };
+		for (int i = 0; i < StreamCount; ++i)
+		{
+			const Stream& stream = header.streams[i];
+			if (stream.elementSize != elementSizes[i] || stream.offset % MeshCacheAlignment != 0 || stream.size % stream.elementSize != 0
+				|| stream.offset > header.fileSize || stream.size > header.fileSize - stream.offset)
+			{
+				return "bad stream";
+			}
+		}
+
+		view = MeshView();
+		view.vertices = GetStream(VertexStream, view.vertexCount);
+		view.vertexFormat = vertexFormat;
+		view.indices = GetStream(IndexStream, view.indexCount);
+		view.indexType = indexType;
+		view.lods = GetStream<MeshLod>(LodStream, view.lodCount);
+
+		// The levels of detail are drawn straight from the index buffer, so each one must be whole
+		// triangles inside it, and there must be at least the full mesh
+		if (view.lodCount == 0 || view.lods[0].indexCount == 0)
+		{
+			return "bad stream";
+		}
+		for (size_t i = 0; i < view.lodCount; ++i)
+		{
+			const MeshLod& lod = view.lods[i];
+			if (static_cast<uint64_t>(lod.firstIndex) + lod.indexCount > view.indexCount || lod.indexCount % 3 != 0)
+			{
+				return "bad stream";
+			}
+		}
+
+		view.boundsCenter = glm::vec3(header.boundsCenter[0], header.boundsCenter[1], header.boundsCenter[2]);
+		view.boundsRadius = header.boundsRadius;
+		return nullptr;
+	}
+
+	// Gets where the elements of a stream are in the mapped file, and how many there are
+	template <typename T = char>
+	const T* GetStream(StreamKind kind, size_t& count) const
+	{
+		const Stream& stream = GetHeader().streams[kind];
+		count = static_cast<size_t>(stream.size / stream.elementSize);
+		return reinterpret_cast<const T*>(cache.GetData() + stream.offset);
+	}
+
+	// Lays out the cache file of the converted mesh
+	FileHeader CreateHeader(uint64_t sourceHash, uint64_t sourceSize, int64_t sourceTime, uint64_t settingsHash) const
+	{
+		FileHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, "MSHC", sizeof(header.magic));
+		header.version = MeshCacheVersion;
+		header.sourceHash = sourceHash;
+		header.settingsHash = settingsHash;
+		header.sourceSize = sourceSize;
+		header.sourceTime = sourceTime;
+		header.boundsCenter[0] = view.boundsCenter.x;
+		header.boundsCenter[1] = view.boundsCenter.y;
+		header.boundsCenter[2] = view.boundsCenter.z;
+		header.boundsRadius = view.boundsRadius;
+
+		const uint32_t elementSizes[StreamCount] = { static_cast<uint32_t>(GetVertexStride(view.vertexFormat)),
+			static_cast<uint32_t>(GetIndexSize(view.indexType)), sizeof(MeshLod) };
+		const size_t counts[StreamCount] = { view.vertexCount, view.indexCount, view.lodCount };
+		uint64_t offset = sizeof(FileHeader);
+		for (int i = 0; i < StreamCount; ++i)
+		{
+			offset = (offset + MeshCacheAlignment - 1) / MeshCacheAlignment * MeshCacheAlignment;
+			header.streams[i].offset = offset;
+			header.streams[i].size = static_cast<uint64_t>(counts[i]) * elementSizes[i];
+			header.streams[i].elementSize = elementSizes[i];
+			offset += header.streams[i].size;
+		}
+		header.fileSize = offset;
+		return header;
+	}
+
+	// Writes the converted mesh to the cache file
+	// @param	header	Layout of the file
+	// @return	Returns true if the cache was written
+	bool WriteCache(const FileHeader& header) const
+	{
+		const char* streamData[StreamCount] =
+		{
+			reinterpret_cast<const char*>(view.vertices),
+			reinterpret_cast<const char*>(view.indices),
+			reinterpret_cast<const char*>(view.lods)
+		};
+
+		// Write to a temporary file first, so a crash never leaves a truncated cache behind
+		std::string tempPath = cachePath + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (file.fail())
+			{
+				return false;
+			}
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			uint64_t written = sizeof(header);
+			const char padding[MeshCacheAlignment] = {};
+			for (int i = 0; i < StreamCount; ++i)
+			{
+				file.write(padding, static_cast<std::streamsize>(header.streams[i].offset - written));
+				file.write(streamData[i], static_cast<std::streamsize>(header.streams[i].size));
+				written = header.streams[i].offset + header.streams[i].size;
+			}
+			if (file.fail())
+			{
+				return false;
+			}
+		}
+		std::remove(cachePath.c_str());
+		return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+	}
+
+	std::string cachePath;
+	MappedFile cache;
+	MeshData converted;
+	std::vector<char> encodedVertices;
+	std::vector<char> encodedIndices;
+	MeshView view;
+	MeshCacheStats stats;
+
+	// Stamp to write to the cache on Close, when it was found valid for a source with a new time
+	bool restamp = false;
+	uint64_t restampSize = 0;
+	int64_t restampTime = 0;
+};
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+
+// Post-transform vertex cache efficiency of an index buffer
+struct VertexCacheStats
+{
+	size_t triangleCount = 0;
+
+	// Vertices referenced by the indices
+	size_t vertexCount = 0;
+
+	// Vertices the vertex shader runs on, counting every cache miss
+	size_t transformedCount = 0;
+
+	// Average cache miss ratio: vertices transformed per triangle, from 3 down to about 0.5 at best
+	double GetAcmr() const
+	{
+		return triangleCount > 0 ? static_cast<double>(transformedCount) / triangleCount : 0.0;
+	}
+
+	// Average transform to vertex ratio: how many times each vertex is transformed, 1 at best
+	double GetAtvr() const
+	{
+		return vertexCount > 0 ? static_cast<double>(transformedCount) / vertexCount : 0.0;
+	}
+};
+
+// Simulates drawing triangles through a FIFO post-transform cache, the model most GPUs come close to
+// @param	indices		Triangle indices
+// @param	indexCount	Number of indices
+// @param	vertexCount	Number of vertices the indices refer to
+// @param	cacheSize	Number of vertices the cache holds
+// @return	Returns the cache efficiency of the triangles
+VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize = 16)
+{
+	VertexCacheStats stats;
+	stats.triangleCount = indexCount / 3;
+
+	// Time each vertex entered the cache, so that a vertex is cached if it entered within the last cacheSize misses
+	std::vector<size_t> entryTimes(vertexCount, 0);
+	size_t time = cacheSize + 1;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		size_t& entryTime = entryTimes[indices[i]];
+		if (entryTime == 0)
+		{
+			++stats.vertexCount;
+		}
+		if (time - entryTime > cacheSize)
+		{
+			entryTime = time++;
+			++stats.transformedCount;
+		}
+	}
+	return stats;
+}
+
+// Reorders triangles so that consecutive ones share vertices while those are still in the
+// post-transform cache, with Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+// Vertices are scored by their position in a simulated LRU cache and by how many triangles
+// still use them, and the triangle whose vertices score highest is drawn next.
+// @param	indices		Triangle indices to reorder in place
+// @param	indexCount	Number of indices
+// @param	vertexCount	Number of vertices the indices refer to
+void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2)
+	{
+		return;
+	}
+
+	// Scores of Forsyth's article
+	const int cacheSize = 32;
+	const float cacheDecayPower = 1.5f;
+	const float lastTriangleScore = 0.75f;
+	const float valenceBoostScale = 2.0f;
+	const float valenceBoostPower = 0.5f;
+
+	float cacheScores[cacheSize];
+	for (int i = 0; i < cacheSize; ++i)
+	{
+		cacheScores[i] = i < 3 ? lastTriangleScore : std::pow(1.0f - (i - 3) / static_cast<float>(cacheSize - 3), cacheDecayPower);
+	}
+	const int maxValence = 64;
+	float valenceScores[maxValence];
+	for (int i = 0; i < maxValence; ++i)
+	{
+		valenceScores[i] = i > 0 ? valenceBoostScale * std::pow(static_cast<float>(i), -valenceBoostPower) : 0.0f;
+	}
+	auto scoreVertex = [&](int cachePosition, uint32_t liveCount)
+	{
+		if (liveCount == 0)
+		{
+			return -1.0f;
+		}
+		float score = cachePosition >= 0 ? cacheScores[cachePosition] : 0.0f;
+		return score + (liveCount < static_cast<uint32_t>(maxValence) ? valenceScores[liveCount]
+			: valenceBoostScale * std::pow(static_cast<float>(liveCount), -valenceBoostPower));
+	};
+
+	// Triangles of every vertex, the ones not drawn yet first
+	std::vector<uint32_t> liveCounts(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+	{
+		++liveCounts[indices[i]];
+	}
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveCounts[v];
+	}
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	{
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+		{
+			adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		vertexScores[v] = scoreVertex(-1, liveCounts[v]);
+	}
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<char> drawn(triangleCount, 0);
+	size_t bestTriangle = 0;
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+		if (triangleScores[t] > triangleScores[bestTriangle])
+		{
+			bestTriangle = t;
+		}
+	}
+
+	std::vector<uint32_t> output(triangleCount * 3);
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> newCache;
+	cache.reserve(cacheSize + 3);
+	newCache.reserve(cacheSize + 3);
+	size_t scanCursor = 0;
+	for (size_t drawnCount = 0; drawnCount < triangleCount; ++drawnCount)
+	{
+		// Nothing in the cache leads anywhere, so start over from the first triangle not drawn yet
+		if (bestTriangle == triangleCount)
+		{
+			while (drawn[scanCursor])
+			{
+				++scanCursor;
+			}
+			bestTriangle = scanCursor;
+		}
+
+		const uint32_t* triangle = indices + bestTriangle * 3;
+		std::copy(triangle, triangle + 3, output.begin() + drawnCount * 3);
+		drawn[bestTriangle] = 1;
+
+		// Move the triangle out of the live part of its vertices' lists
+		for (int i = 0; i < 3; ++i)
+		{
+			uint32_t v = triangle[i];
+			uint32_t* begin = adjacency.data() + adjacencyOffsets[v];
+			uint32_t* end = begin + liveCounts[v];
+			std::iter_swap(std::find(begin, end, static_cast<uint32_t>(bestTriangle)), end - 1);
+			--liveCounts[v];
+		}
+
+		// The triangle's vertices go to the front of the cache, pushing the others back
+		newCache.assign(triangle, triangle + 3);
+		for (uint32_t v : cache)
+		{
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				newCache.push_back(v);
+			}
+		}
+		cache.swap(newCache);
+
+		// Rescore the vertices whose cache position or triangle count changed, and their remaining triangles
+		float bestScore = -1.0f;
+		bestTriangle = triangleCount;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			uint32_t v = cache[i];
+			int position = i < static_cast<size_t>(cacheSize) ? static_cast<int>(i) : -1;
+			cachePositions[v] = position;
+			float score = scoreVertex(position, liveCounts[v]);
+			float delta = score - vertexScores[v];
+			vertexScores[v] = score;
+
+			const uint32_t* live = adjacency.data() + adjacencyOffsets[v];
+			for (uint32_t j = 0; j < liveCounts[v]; ++j)
+			{
+				float& triangleScore = triangleScores[live[j]];
+				triangleScore += delta;
+				if (position >= 0 && triangleScore > bestScore)
+				{
+					bestScore = triangleScore;
+					bestTriangle = live[j];
+				}
+			}
+		}
+
+		// Vertices past the cache size have been evicted and were rescored above
+		if (cache.size() > static_cast<size_t>(cacheSize))
+		{
+			cache.resize(cacheSize);
+		}
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+// Reorders the vertices in the order the triangles first use them, so that the vertex
+// fetches of consecutive triangles hit the same cache lines. Vertices no triangle uses are dropped.
+// @param	mesh	Mesh whose vertices and indices are reordered
+void OptimizeVertexFetch(MeshData& mesh)
+{
+	const uint32_t unused = ~0u;
+	std::vector<uint32_t> remap(mesh.vertices.size(), unused);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (uint32_t& index : mesh.indices)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh.vertices.swap(vertices);
+}
+
+// Counters of a mesh optimization
+struct MeshOptimizeStats
+{
+	VertexCacheStats before;
+	VertexCacheStats after;
+
+	// Index type the mesh can be drawn with
+	GLenum indexType = GL_UNSIGNED_INT;
+	double optimizeMs = 0.0;
+
+	void Print(std::ostream& out) const
+	{
+		out << std::fixed << std::setprecision(3)
+			<< "Mesh optimized in " << optimizeMs << " ms: ACMR " << before.GetAcmr() << " -> " << after.GetAcmr()
+			<< ", ATVR " << before.GetAtvr() << " -> " << after.GetAtvr()
+			<< ", " << (indexType == GL_UNSIGNED_SHORT ? 16 : 32) << "-bit indices" << std::defaultfloat << std::endl;
+	}
+};
+
+// Optimizes a mesh for drawing: orders the triangles of every level of detail for the
+// post-transform cache, then the vertices for fetch locality
+// @param	mesh	Mesh to optimize
+// @param	stats	Receives the cache efficiency before and after, unless null
+void OptimizeMesh(MeshData& mesh, MeshOptimizeStats* stats = nullptr)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// Efficiency of the most detailed level, which is what gets drawn up close
+	const size_t measuredCount = mesh.lods.empty() ? mesh.indices.size() : mesh.lods[0].indexCount;
+	const size_t measuredFirst = mesh.lods.empty() ? 0 : mesh.lods[0].firstIndex;
+	if (stats)
+	{
+		stats->before = AnalyzeVertexCache(mesh.indices.data() + measuredFirst, measuredCount, mesh.vertices.size());
+	}
+
+	// Levels of detail are drawn on their own, so each is ordered on its own
+	if (mesh.lods.empty())
+	{
+		OptimizeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	}
+	for (const MeshLod& lod : mesh.lods)
+	{
+		OptimizeVertexCache(mesh.indices.data() + lod.firstIndex, lod.indexCount, mesh.vertices.size());
+	}
+	OptimizeVertexFetch(mesh);
+
+	if (stats)
+	{
+		stats->after = AnalyzeVertexCache(mesh.indices.data() + measuredFirst, measuredCount, mesh.vertices.size());
+		stats->indexType = GetIndexType(mesh.vertices.size());
+		stats->optimizeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
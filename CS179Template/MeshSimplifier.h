@@ -0,0 +1,410 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "Mesh.h"
+
+// Sum of the squared distances to a set of planes, each weighted by the area of the
+// triangle it comes from (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics")
+struct Quadric
+{
+	// Symmetric matrix, vector and constant of the quadratic form
+	double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+	double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+	double c = 0.0;
+
+	// Total area of the planes
+	double weight = 0.0;
+
+	// Adds the plane of the points p such that dot(normal, p) + distance = 0
+	void AddPlane(const glm::dvec3& normal, double distance, double planeWeight)
+	{
+		a00 += planeWeight * normal.x * normal.x;
+		a01 += planeWeight * normal.x * normal.y;
+		a02 += planeWeight * normal.x * normal.z;
+		a11 += planeWeight * normal.y * normal.y;
+		a12 += planeWeight * normal.y * normal.z;
+		a22 += planeWeight * normal.z * normal.z;
+		b0 += planeWeight * normal.x * distance;
+		b1 += planeWeight * normal.y * distance;
+		b2 += planeWeight * normal.z * distance;
+		c += planeWeight * distance * distance;
+		weight += planeWeight;
+	}
+
+	void Add(const Quadric& other)
+	{
+		a00 += other.a00;
+		a01 += other.a01;
+		a02 += other.a02;
+		a11 += other.a11;
+		a12 += other.a12;
+		a22 += other.a22;
+		b0 += other.b0;
+		b1 += other.b1;
+		b2 += other.b2;
+		c += other.c;
+		weight += other.weight;
+	}
+
+	// Gets the weighted sum of the squared distances of a point to the planes
+	double Evaluate(const glm::dvec3& p) const
+	{
+		double r = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+			+ 2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+			+ 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+		return std::max(r, 0.0);
+	}
+};
+
+// Hash of the bytes of a position, for welding the vertices that share one
+struct PositionHash
+{
+	size_t operator()(const glm::vec3& position) const
+	{
+		// -0.0 equals 0.0 but has other bits, so it is turned into 0.0 first for the two to hash alike
+		glm::vec3 canonical = position + 0.0f;
+		uint32_t bits[3];
+		std::memcpy(bits, &canonical, sizeof(bits));
+		return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+	}
+};
+
+// Simplifies triangles by collapsing their edges, the one with the least quadric error first.
+// Edges collapse onto one of their vertices rather than a new one, so that the simplified
+// triangles index the same vertex buffer as the full ones. Vertices sharing a position (seams
+// of normals or colors) move together, and vertices on open borders stay in place so that
+// the outline of the mesh does not shrink.
+// @param	vertices			Vertices of the mesh
+// @param	indices				Triangles to simplify
+// @param	indexCount			Number of indices
+// @param	targetIndexCount	Number of indices to simplify down to
+// @param	maxError			Largest error allowed, as a distance in the mesh's units
+// @param	resultError			Receives the largest error of the collapses made, unless null
+// @return	Returns the indices of the simplified triangles
+std::vector<uint32_t> SimplifyMesh(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t indexCount,
+	size_t targetIndexCount, float maxError, float* resultError = nullptr)
+{
+	const size_t vertexCount = vertices.size();
+	std::vector<uint32_t> result(indices, indices + indexCount / 3 * 3);
+	float error = 0.0f;
+
+	// Vertices sharing a position are all moved as the first of them, and linked in a ring to pick from
+	std::vector<uint32_t> positionIds(vertexCount);
+	std::vector<uint32_t> nextWedges(vertexCount);
+	{
+		std::unordered_map<glm::vec3, uint32_t, PositionHash> firstVertices;
+		firstVertices.reserve(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+		{
+			uint32_t first = firstVertices.emplace(glm::vec3(vertices[v].x, vertices[v].y, vertices[v].z), v).first->second;
+			positionIds[v] = first;
+			nextWedges[v] = first == v ? v : nextWedges[first];
+			nextWedges[first] = v;
+		}
+	}
+	auto getPosition = [&](uint32_t v)
+	{
+		return glm::dvec3(vertices[v].x, vertices[v].y, vertices[v].z);
+	};
+
+	// Every position starts with the planes of the triangles around it
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		const uint32_t p0 = positionIds[result[i]], p1 = positionIds[result[i + 1]], p2 = positionIds[result[i + 2]];
+		glm::dvec3 normal = glm::cross(getPosition(p1) - getPosition(p0), getPosition(p2) - getPosition(p0));
+		double length = glm::length(normal);
+		if (length > 0.0)
+		{
+			normal /= length;
+			double distance = -glm::dot(normal, getPosition(p0));
+			quadrics[p0].AddPlane(normal, distance, length * 0.5);
+			quadrics[p1].AddPlane(normal, distance, length * 0.5);
+			quadrics[p2].AddPlane(normal, distance, length * 0.5);
+		}
+	}
+
+	// An edge that is not used exactly once each way is on an open border (or not manifold), and its vertices are locked
+	std::vector<char> locked(vertexCount, 0);
+	{
+		auto edgeKey = [](uint32_t a, uint32_t b) { return static_cast<uint64_t>(a) << 32 | b; };
+		std::unordered_map<uint64_t, uint32_t> edgeCounts;
+		edgeCounts.reserve(result.size());
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			size_t next = i % 3 == 2 ? i - 2 : i + 1;
+			++edgeCounts[edgeKey(positionIds[result[i]], positionIds[result[next]])];
+		}
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			size_t next = i % 3 == 2 ? i - 2 : i + 1;
+			uint32_t a = positionIds[result[i]], b = positionIds[result[next]];
+			auto reverse = edgeCounts.find(edgeKey(b, a));
+			if (edgeCounts[edgeKey(a, b)] != 1 || reverse == edgeCounts.end() || reverse->second != 1)
+			{
+				locked[a] = 1;
+				locked[b] = 1;
+			}
+		}
+	}
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		float error;
+	};
+	std::vector<Collapse> candidates;
+	std::vector<uint32_t> collapses(vertexCount);
+	std::vector<char> collapsed(vertexCount);
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+
+	// Collapsing an edge must not turn any of the remaining triangles around the moved vertex over
+	auto flipsTriangles = [&](uint32_t from, uint32_t to)
+	{
+		const glm::dvec3 toPosition = getPosition(to);
+		for (uint32_t i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; ++i)
+		{
+			const uint32_t* triangle = result.data() + adjacency[i] * 3;
+			uint32_t p[3];
+			int corner = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				p[k] = collapses[positionIds[triangle[k]]];
+				corner = p[k] == from ? k : corner;
+			}
+			if (p[0] == p[1] || p[1] == p[2] || p[0] == p[2] || p[0] == to || p[1] == to || p[2] == to)
+			{
+				continue;
+			}
+			const glm::dvec3 a = getPosition(p[(corner + 1) % 3]);
+			const glm::dvec3 b = getPosition(p[(corner + 2) % 3]);
+			glm::dvec3 before = glm::cross(a - getPosition(from), b - getPosition(from));
+			glm::dvec3 after = glm::cross(a - toPosition, b - toPosition);
+			if (glm::dot(before, after) <= 0.0)
+			{
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// A vertex moved to another position takes the vertex there whose normal and color are the closest to its own
+	auto pickWedge = [&](uint32_t vertex, uint32_t position)
+	{
+		const Vertex& source = vertices[vertex];
+		uint32_t best = position;
+		float bestScore = -FLT_MAX;
+		uint32_t wedge = position;
+		do
+		{
+			const Vertex& candidate = vertices[wedge];
+			float score = source.nx * candidate.nx + source.ny * candidate.ny + source.nz * candidate.nz;
+			if (source.r != candidate.r || source.g != candidate.g || source.b != candidate.b || source.a != candidate.a)
+			{
+				score -= 2.0f;
+			}
+			if (score > bestScore)
+			{
+				bestScore = score;
+				best = wedge;
+			}
+			wedge = nextWedges[wedge];
+		} while (wedge != position);
+		return best;
+	};
+
+	// Collapse in passes, each moving a vertex at most once since the errors around it are out of date after
+	while (result.size() > targetIndexCount)
+	{
+		// Triangles around every position
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (uint32_t v : result)
+		{
+			++adjacencyOffsets[positionIds[v] + 1];
+		}
+		for (size_t p = 0; p < vertexCount; ++p)
+		{
+			adjacencyOffsets[p + 1] += adjacencyOffsets[p];
+		}
+		adjacency.resize(result.size());
+		{
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < result.size(); ++i)
+			{
+				adjacency[fill[positionIds[result[i]]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		// Every edge can collapse either way, unless the vertex that would move is locked
+		candidates.clear();
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			size_t next = i % 3 == 2 ? i - 2 : i + 1;
+			uint32_t a = positionIds[result[i]], b = positionIds[result[next]];
+			if (a == b)
+			{
+				continue;
+			}
+			for (int direction = 0; direction < 2; ++direction)
+			{
+				uint32_t from = direction == 0 ? a : b;
+				uint32_t to = direction == 0 ? b : a;
+				if (!locked[from])
+				{
+					const Quadric& q0 = quadrics[from];
+					const Quadric& q1 = quadrics[to];
+					double weight = q0.weight + q1.weight;
+					double squaredError = weight > 0.0 ? (q0.Evaluate(getPosition(to)) + q1.Evaluate(getPosition(to))) / weight : 0.0;
+					candidates.push_back({ from, to, static_cast<float>(std::sqrt(squaredError)) });
+				}
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+		// A collapse removes about two triangles
+		for (size_t p = 0; p < vertexCount; ++p)
+		{
+			collapses[p] = static_cast<uint32_t>(p);
+		}
+		std::fill(collapsed.begin(), collapsed.end(), 0);
+		const size_t maxCollapseCount = (result.size() - targetIndexCount) / 6 + 1;
+		size_t collapseCount = 0;
+		for (const Collapse& candidate : candidates)
+		{
+			if (candidate.error > maxError || collapseCount >= maxCollapseCount)
+			{
+				break;
+			}
+			if (collapsed[candidate.from] || collapsed[candidate.to] || flipsTriangles(candidate.from, candidate.to))
+			{
+				continue;
+			}
+			collapses[candidate.from] = candidate.to;
+			collapsed[candidate.from] = 1;
+			collapsed[candidate.to] = 1;
+			quadrics[candidate.to].Add(quadrics[candidate.from]);
+			error = std::max(error, candidate.error);
+			++collapseCount;
+		}
+		if (collapseCount == 0)
+		{
+			break;
+		}
+
+		// Move the corners of the collapsed vertices, and drop the triangles left without area
+		size_t written = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t triangle[3];
+			uint32_t p[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t v = result[i + k];
+				p[k] = collapses[positionIds[v]];
+				triangle[k] = p[k] == positionIds[v] ? v : pickWedge(v, p[k]);
+			}
+			if (p[0] != p[1] && p[1] != p[2] && p[0] != p[2])
+			{
+				std::copy(triangle, triangle + 3, result.begin() + written);
+				written += 3;
+			}
+		}
+		result.resize(written);
+	}
+
+	if (resultError)
+	{
+		*resultError = error;
+	}
+	return result;
+}
+
+// Counters of a level of detail generation
+struct MeshLodStats
+{
+	std::vector<MeshLod> lods;
+	double generateMs = 0.0;
+
+	void Print(std::ostream& out) const
+	{
+		out << std::fixed << std::setprecision(3) << "Generated " << lods.size() << " levels of detail in " << generateMs << " ms:";
+		for (size_t i = 0; i < lods.size(); ++i)
+		{
+			out << (i > 0 ? ", " : " ") << lods[i].indexCount / 3 << " triangles";
+			if (i > 0)
+			{
+				out << " (error " << std::setprecision(4) << lods[i].error << std::setprecision(3) << ")";
+			}
+		}
+		out << std::defaultfloat << std::endl;
+	}
+};
+
+// Builds the levels of detail of a mesh, each with about half the triangles of the previous one,
+// and appends their indices to the mesh. Each level is simplified from the previous one, so its
+// error is the sum of the errors along the way.
+// @param	mesh		Mesh whose indices draw the full detail, which becomes level 0
+// @param	maxLodCount	Largest number of levels, level 0 included
+// @param	maxError	Largest error of a level, relative to the bounding radius of the mesh
+// @param	stats		Receives the levels and the time taken, unless null
+void GenerateMeshLods(MeshData& mesh, size_t maxLodCount = 8, float maxError = 0.1f, MeshLodStats* stats = nullptr)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// Levels under this many triangles do not save enough to be worth their own draws
+	const size_t minTriangleCount = 64;
+
+	mesh.lods.clear();
+	MeshLod full;
+	full.indexCount = static_cast<uint32_t>(mesh.indices.size());
+	mesh.lods.push_back(full);
+
+	const float errorLimit = maxError * mesh.boundsRadius;
+	while (mesh.lods.size() < maxLodCount)
+	{
+		const MeshLod previous = mesh.lods.back();
+		const size_t targetIndexCount = previous.indexCount / 6 * 3;
+		if (targetIndexCount / 3 < minTriangleCount || previous.error >= errorLimit)
+		{
+			break;
+		}
+
+		float lodError = 0.0f;
+		std::vector<uint32_t> simplified = SimplifyMesh(mesh.vertices, mesh.indices.data() + previous.firstIndex, previous.indexCount,
+			targetIndexCount, errorLimit - previous.error, &lodError);
+
+		// Stop once the simplification gets stuck, e.g. against the error limit or locked borders
+		if (simplified.size() > previous.indexCount / 4 * 3)
+		{
+			break;
+		}
+
+		MeshLod lod;
+		lod.firstIndex = static_cast<uint32_t>(mesh.indices.size());
+		lod.indexCount = static_cast<uint32_t>(simplified.size());
+		lod.error = previous.error + lodError;
+		mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+		mesh.lods.push_back(lod);
+	}
+
+	if (stats)
+	{
+		stats->lods = mesh.lods;
+		stats->generateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
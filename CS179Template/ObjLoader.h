@@ -0,0 +1,517 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Mesh.h"
+
+// Counters and timings of a mesh load
+struct MeshLoadStats
+{
+	size_t fileBytes = 0;
+	int threadCount = 0;
+
+	// Triangles after triangulating the faces, and their corners before and after deduplication
+	size_t triangleCount = 0;
+	size_t cornerCount = 0;
+	size_t vertexCount = 0;
+
+	// Time spent reading the file, parsing its chunks and merging them into a single mesh
+	double readMs = 0.0;
+	double parseMs = 0.0;
+	double mergeMs = 0.0;
+	double totalMs = 0.0;
+
+	// Gets the throughput of the whole load
+	double GetMegabytesPerSecond() const
+	{
+		return totalMs > 0.0 ? fileBytes / 1048576.0 / (totalMs / 1000.0) : 0.0;
+	}
+
+	double GetTrianglesPerSecond() const
+	{
+		return totalMs > 0.0 ? triangleCount / (totalMs / 1000.0) : 0.0;
+	}
+
+	// Prints the counters and throughput
+	void Print(std::ostream& out) const
+	{
+		out << std::fixed << std::setprecision(2)
+			<< "Loaded " << triangleCount << " triangles, " << vertexCount << " vertices (from " << cornerCount << " corners) in "
+			<< totalMs << " ms on " << threadCount << " threads (read " << readMs << " ms, parse " << parseMs
+			<< " ms, merge " << mergeMs << " ms): " << GetMegabytesPerSecond() << " MB/s, "
+			<< GetTrianglesPerSecond() / 1.0e6 << " M triangles/s" << std::defaultfloat << std::endl;
+	}
+};
+
+// Reference from a face to a position or normal. OBJ indices count from 1, and
+// negative ones count back from the last element read, so those are kept
+// relative to the chunk they appear in until the chunk offsets are known.
+struct ObjIndexRef
+{
+	int64_t index = -1;
+	bool relative = false;
+};
+
+// Corner of a triangle, as read from a face
+struct ObjCorner
+{
+	ObjIndexRef position;
+	ObjIndexRef normal;
+};
+
+// Part of an OBJ file parsed by one worker
+struct ObjChunk
+{
+	const char* begin = nullptr;
+	const char* end = nullptr;
+
+	// Elements declared in the chunk, and the corners of its triangles, three per triangle
+	std::vector<glm::vec3> positions;
+	std::vector<glm::u8vec4> colors;
+	std::vector<glm::vec3> normals;
+	std::vector<ObjCorner> corners;
+
+	// Where the chunk's positions and normals start in the whole file
+	size_t positionOffset = 0;
+	size_t normalOffset = 0;
+
+	// Deduplicated vertices of the chunk, and its triangles indexing them
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+
+	// First error met by the worker, if any
+	std::string error;
+};
+
+// Skips spaces and tabs
+const char* SkipObjSpaces(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+	{
+		++p;
+	}
+	return p;
+}
+
+// Longest number the parser reads, terminator included. Longer ones are rejected.
+const size_t ObjTokenSize = 64;
+
+// Copies the token starting at p into a NUL-terminated buffer, since strtof and strtoll
+// would otherwise read on past the end of the line, which on the last line of a mapped
+// file is the end of the mapping
+// @param	token	Buffer of ObjTokenSize characters
+// @return	Returns false if the token is too long to fit
+bool CopyObjToken(const char* p, const char* lineEnd, char* token)
+{
+	size_t length = 0;
+	while (p + length < lineEnd && p[length] != ' ' && p[length] != '\t' && p[length] != '\r')
+	{
+		if (length + 1 == ObjTokenSize)
+		{
+			return false;
+		}
+		token[length] = p[length];
+		++length;
+	}
+	token[length] = '\0';
+	return true;
+}
+
+// Reads the floats of a line into values, stopping at the end of the line
+// @return	Returns the number of floats read
+int ParseObjFloats(const char* p, const char* lineEnd, float* values, int maxCount)
+{
+	int count = 0;
+	char token[ObjTokenSize];
+	while (count < maxCount)
+	{
+		p = SkipObjSpaces(p, lineEnd);
+		if (p >= lineEnd || !CopyObjToken(p, lineEnd, token))
+		{
+			break;
+		}
+		char* next = nullptr;
+		values[count] = std::strtof(token, &next);
+		if (next == token)
+		{
+			break;
+		}
+		p += next - token;
+		++count;
+	}
+	return count;
+}
+
+// Reads one OBJ index, turning it into a 0-based absolute index or a chunk-relative one
+// @param	localCount	Number of elements of that kind read so far in the chunk
+bool ParseObjIndex(const char*& p, const char* lineEnd, size_t localCount, ObjIndexRef& ref)
+{
+	char token[ObjTokenSize];
+	if (p >= lineEnd || !CopyObjToken(p, lineEnd, token))
+	{
+		return false;
+	}
+	char* next = nullptr;
+	long long value = std::strtoll(token, &next, 10);
+	if (next == token || value == 0)
+	{
+		return false;
+	}
+	p += next - token;
+	if (value > 0)
+	{
+		ref.index = value - 1;
+		ref.relative = false;
+	}
+	else
+	{
+		ref.index = static_cast<int64_t>(localCount) + value;
+		ref.relative = true;
+	}
+	return true;
+}
+
+// Parses the lines of a chunk: positions (with optional vertex colors), normals and faces.
+// Faces with more than three corners are split into a fan of triangles. Other lines are skipped.
+void ParseObjChunk(ObjChunk& chunk)
+{
+	const char* p = chunk.begin;
+	std::vector<ObjCorner> face;
+	while (p < chunk.end)
+	{
+		const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', chunk.end - p));
+		if (!lineEnd)
+		{
+			lineEnd = chunk.end;
+		}
+
+		p = SkipObjSpaces(p, lineEnd);
+		if (lineEnd - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			float values[6];
+			int valueCount = ParseObjFloats(p + 2, lineEnd, values, 6);
+			if (valueCount < 3)
+			{
+				chunk.error = "Bad vertex position";
+				return;
+			}
+			chunk.positions.push_back(glm::vec3(values[0], values[1], values[2]));
+
+			// Six values are a position followed by a color, anything else is a position (and maybe a weight) in white
+			glm::vec3 color = valueCount == 6 ? glm::clamp(glm::vec3(values[3], values[4], values[5]), 0.0f, 1.0f) : glm::vec3(1.0f);
+			chunk.colors.push_back(glm::u8vec4(glm::round(color * 255.0f), 255));
+		}
+		else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			float values[3];
+			if (ParseObjFloats(p + 3, lineEnd, values, 3) < 3)
+			{
+				chunk.error = "Bad vertex normal";
+				return;
+			}
+			chunk.normals.push_back(glm::vec3(values[0], values[1], values[2]));
+		}
+		else if (lineEnd - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			// Corners are v, v/vt, v//vn or v/vt/vn. Texture coordinates are skipped.
+			face.clear();
+			const char* q = SkipObjSpaces(p + 2, lineEnd);
+			while (q < lineEnd && *q != '\r' && *q != '#')
+			{
+				ObjCorner corner;
+				if (!ParseObjIndex(q, lineEnd, chunk.positions.size(), corner.position))
+				{
+					chunk.error = "Bad face index";
+					return;
+				}
+				if (q < lineEnd && *q == '/')
+				{
+					++q;
+					if (q < lineEnd && *q != '/')
+					{
+						ObjIndexRef texCoord;
+						if (!ParseObjIndex(q, lineEnd, 0, texCoord))
+						{
+							chunk.error = "Bad face texture coordinate index";
+							return;
+						}
+					}
+					if (q < lineEnd && *q == '/')
+					{
+						++q;
+						if (!ParseObjIndex(q, lineEnd, chunk.normals.size(), corner.normal))
+						{
+							chunk.error = "Bad face normal index";
+							return;
+						}
+					}
+				}
+				face.push_back(corner);
+				q = SkipObjSpaces(q, lineEnd);
+			}
+
+			for (size_t i = 2; i < face.size(); ++i)
+			{
+				chunk.corners.push_back(face[0]);
+				chunk.corners.push_back(face[i - 1]);
+				chunk.corners.push_back(face[i]);
+			}
+		}
+
+		p = lineEnd + 1;
+	}
+}
+
+// Builds the deduplicated vertices of a chunk's triangles. Corners without a
+// normal get the flat normal of their triangle.
+void BuildObjChunkVertices(ObjChunk& chunk, const std::vector<glm::vec3>& positions, const std::vector<glm::u8vec4>& colors,
+	const std::vector<glm::vec3>& normals)
+{
+	auto resolve = [](const ObjIndexRef& ref, size_t chunkOffset, size_t count, int64_t& index)
+	{
+		index = ref.relative ? static_cast<int64_t>(chunkOffset) + ref.index : ref.index;
+		return index >= 0 && index < static_cast<int64_t>(count);
+	};
+
+	std::unordered_map<Vertex, uint32_t, VertexHash> vertexIndices;
+	vertexIndices.reserve(chunk.corners.size() / 2);
+	chunk.indices.reserve(chunk.corners.size());
+	for (size_t triangle = 0; triangle + 2 < chunk.corners.size(); triangle += 3)
+	{
+		int64_t positionIndices[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			if (!resolve(chunk.corners[triangle + i].position, chunk.positionOffset, positions.size(), positionIndices[i]))
+			{
+				chunk.error = "Face refers to a missing vertex position";
+				return;
+			}
+		}
+
+		const glm::vec3& p0 = positions[positionIndices[0]];
+		glm::vec3 faceNormal = glm::cross(positions[positionIndices[1]] - p0, positions[positionIndices[2]] - p0);
+		float faceNormalLength = glm::length(faceNormal);
+		faceNormal = faceNormalLength > 0.0f ? faceNormal / faceNormalLength : glm::vec3(0.0f, 0.0f, 1.0f);
+
+		for (int i = 0; i < 3; ++i)
+		{
+			const ObjCorner& corner = chunk.corners[triangle + i];
+			glm::vec3 normal = faceNormal;
+			if (corner.normal.index >= 0 || corner.normal.relative)
+			{
+				int64_t normalIndex;
+				if (!resolve(corner.normal, chunk.normalOffset, normals.size(), normalIndex))
+				{
+					chunk.error = "Face refers to a missing vertex normal";
+					return;
+				}
+				normal = normals[normalIndex];
+			}
+
+			const glm::vec3& position = positions[positionIndices[i]];
+			const glm::u8vec4& color = colors[positionIndices[i]];
+			Vertex vertex = { position.x, position.y, position.z, normal.x, normal.y, normal.z, color.r, color.g, color.b, color.a };
+
+			auto inserted = vertexIndices.insert(std::make_pair(vertex, static_cast<uint32_t>(chunk.vertices.size())));
+			if (inserted.second)
+			{
+				chunk.vertices.push_back(vertex);
+			}
+			chunk.indices.push_back(inserted.first->second);
+		}
+	}
+}
+
+// Runs a function on every chunk, one worker thread per chunk, and rethrows the first error of any
+template <typename Function>
+void ForEachObjChunk(std::vector<ObjChunk>& chunks, Function function)
+{
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < chunks.size(); ++i)
+	{
+		workers.push_back(std::thread([&chunks, &function, i]() { function(chunks[i]); }));
+	}
+
+	// The calling thread takes the first chunk itself
+	function(chunks[0]);
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	for (const ObjChunk& chunk : chunks)
+	{
+		if (!chunk.error.empty())
+		{
+			throw std::runtime_error(chunk.error);
+		}
+	}
+}
+
+// Parses an OBJ file held in memory into an indexed mesh. The text is split
+// into chunks at line boundaries, which are parsed and turned into vertices
+// on worker threads. Each chunk deduplicates its own vertices, then the
+// chunks are merged and deduplicated against each other.
+// @param	text		Contents of the file, which need not be NUL-terminated (e.g. a mapping of it)
+// @param	size		Size of the contents in bytes
+// @param	threadCount	Number of threads to parse with, 0 for one per hardware thread
+// @param	stats		Receives the counters and timings of the load, unless null
+// @return	Returns the mesh, with its bounds computed
+MeshData ParseObjMesh(const char* text, size_t size, int threadCount = 0, MeshLoadStats* stats = nullptr)
+{
+	using Clock = std::chrono::steady_clock;
+	auto elapsedMs = [](Clock::time_point since) { return std::chrono::duration<double, std::milli>(Clock::now() - since).count(); };
+	auto start = Clock::now();
+
+	// Small files aren't worth the threads
+	const size_t minChunkBytes = 256 * 1024;
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount, size / minChunkBytes));
+
+	// Split the text into chunks of about the same size, ending each after a newline
+	std::vector<ObjChunk> chunks(chunkCount);
+	const char* begin = text;
+	const char* end = text + size;
+	const char* chunkBegin = begin;
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		const char* chunkEnd = i + 1 == chunkCount ? end : std::max(chunkBegin, begin + size * (i + 1) / chunkCount);
+		while (chunkEnd < end && chunkEnd[-1] != '\n')
+		{
+			++chunkEnd;
+		}
+		chunks[i].begin = chunkBegin;
+		chunks[i].end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	ForEachObjChunk(chunks, [](ObjChunk& chunk) { ParseObjChunk(chunk); });
+	double parseMs = elapsedMs(start);
+
+	// Gather the positions and normals of all chunks, which faces may refer to across chunks
+	auto mergeStart = Clock::now();
+	std::vector<glm::vec3> positions;
+	std::vector<glm::u8vec4> colors;
+	std::vector<glm::vec3> normals;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.positionOffset = positions.size();
+		chunk.normalOffset = normals.size();
+		positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+		colors.insert(colors.end(), chunk.colors.begin(), chunk.colors.end());
+		normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+	}
+	double gatherMs = elapsedMs(mergeStart);
+
+	auto buildStart = Clock::now();
+	ForEachObjChunk(chunks, [&](ObjChunk& chunk) { BuildObjChunkVertices(chunk, positions, colors, normals); });
+	parseMs += elapsedMs(buildStart);
+
+	// Merge the chunks, deduplicating the vertices shared between them
+	mergeStart = Clock::now();
+	MeshData mesh;
+	size_t cornerCount = 0;
+	if (chunks.size() == 1)
+	{
+		cornerCount = chunks[0].indices.size();
+		mesh.vertices.swap(chunks[0].vertices);
+		mesh.indices.swap(chunks[0].indices);
+	}
+	else
+	{
+		std::unordered_map<Vertex, uint32_t, VertexHash> vertexIndices;
+		std::vector<uint32_t> remap;
+		for (ObjChunk& chunk : chunks)
+		{
+			cornerCount += chunk.indices.size();
+			remap.resize(chunk.vertices.size());
+			for (size_t i = 0; i < chunk.vertices.size(); ++i)
+			{
+				auto inserted = vertexIndices.insert(std::make_pair(chunk.vertices[i], static_cast<uint32_t>(mesh.vertices.size())));
+				if (inserted.second)
+				{
+					mesh.vertices.push_back(chunk.vertices[i]);
+				}
+				remap[i] = inserted.first->second;
+			}
+			for (uint32_t index : chunk.indices)
+			{
+				mesh.indices.push_back(remap[index]);
+			}
+		}
+	}
+	ComputeMeshBounds(mesh);
+
+	if (stats)
+	{
+		stats->fileBytes = size;
+		stats->threadCount = static_cast<int>(chunkCount);
+		stats->triangleCount = mesh.indices.size() / 3;
+		stats->cornerCount = cornerCount;
+		stats->vertexCount = mesh.vertices.size();
+		stats->parseMs = parseMs;
+		stats->mergeMs = gatherMs + elapsedMs(mergeStart);
+		stats->totalMs = stats->readMs + elapsedMs(start);
+	}
+	return mesh;
+}
+
+MeshData ParseObjMesh(const std::string& text, int threadCount = 0, MeshLoadStats* stats = nullptr)
+{
+	return ParseObjMesh(text.data(), text.size(), threadCount, stats);
+}
+
+// Loads a mesh from an OBJ file (see ParseObjMesh)
+// @param	path		Path of the file
+// @param	threadCount	Number of threads to parse with, 0 for one per hardware thread
+// @param	stats		Receives the counters and timings of the load, unless null
+// @return	Returns the mesh, with its bounds computed
+MeshData LoadObjMesh(const std::string& path, int threadCount = 0, MeshLoadStats* stats = nullptr)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	std::ifstream file(path, std::ios::binary);
+	if (file.fail())
+	{
+		throw std::runtime_error("Cannot open mesh file " + path);
+	}
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	std::string text = contents.str();
+
+	MeshLoadStats loadStats;
+	loadStats.readMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	try
+	{
+		MeshData mesh = ParseObjMesh(text, threadCount, &loadStats);
+		if (stats)
+		{
+			*stats = loadStats;
+		}
+		return mesh;
+	}
+	catch (const std::exception& e)
+	{
+		throw std::runtime_error(path + ": " + e.what());
+	}
+}
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ClusteredLighting.h"
+#include "GLUtils.h"
+
+// Texture units of the per-object light lists
+const GLint ObjectLightRangesTextureUnit = 9;
+const GLint ObjectLightIndicesTextureUnit = 10;
+
+// GLSL side of the per-object light lists, pulled into fragment shaders with
+// #include "ObjectLights.glsl". Expects "Materials.glsl" to be included already.
+const char* const ObjectLightsSource = R"(
+#include "LocalLights.glsl"
+
+// Per drawn object, in instance buffer order: offset and count of the lights reaching it in objectLightIndices
+uniform usamplerBuffer objectLightRanges;
+
+uniform usamplerBuffer objectLightIndices;
+
+// Sums the contributions of the point and spot lights reaching an object
+// (instanceSlot: position of the object in the instance buffer)
+vec3 ShadeObjectLights(uint instanceSlot, vec3 fragPos, vec3 normal, vec3 viewDir)
+{
+	uvec2 objectLights = texelFetch(objectLightRanges, int(instanceSlot)).xy;
+
+	vec3 result = vec3(0.0);
+	for (uint i = 0u; i < objectLights.y; ++i)
+	{
+		int lightIndex = int(texelFetch(objectLightIndices, int(objectLights.x + i)).x);
+		result += ShadeLocalLight(lightIndex, fragPos, normal, viewDir,
+			material.ambient, material.diffuse, material.specular, material.shininess);
+	}
+	return result;
+}
+)";
+
+// Registers the per-object light lists with the shaders.
+// Must be called before creating any shader program that uses them.
+void RegisterObjectLights()
+{
+	RegisterShaderInclude("ObjectLights.glsl", ObjectLightsSource);
+	RegisterSamplerBinding("objectLightRanges", ObjectLightRangesTextureUnit);
+	RegisterSamplerBinding("objectLightIndices", ObjectLightIndicesTextureUnit);
+}
+
+// Uniform grid over light bounding spheres, answering which lights may reach a
+// sphere without testing every light. Every light is stored in each cell its
+// bounding box overlaps; lights that never fade out (see MaxLightRange) are
+// kept aside and returned by every query, rather than stretching the grid.
+class LightGrid
+{
+public:
+	// Upper bound on the number of cells, however small the lights are
+	static const size_t MaxCellCount = 1 << 18;
+
+	// Sorts the lights into the grid
+	// @param	spheres		Position and range of every light
+	void Build(const std::vector<glm::vec4>& spheres)
+	{
+		lightSpheres = &spheres;
+		unboundedLights.clear();
+		cellRanges.clear();
+		cellLights.clear();
+		queryStamps.assign(spheres.size(), 0);
+		queryStamp = 0;
+
+		// Bounds of the lights that fade out, and their average radius
+		boundsMin = glm::vec3(FLT_MAX);
+		glm::vec3 boundsMax(-FLT_MAX);
+		double radiusSum = 0.0;
+		size_t boundedCount = 0;
+		for (size_t i = 0; i < spheres.size(); ++i)
+		{
+			const glm::vec4& sphere = spheres[i];
+			if (sphere.w >= MaxLightRange)
+			{
+				unboundedLights.push_back(static_cast<uint32_t>(i));
+				continue;
+			}
+			boundsMin = glm::min(boundsMin, glm::vec3(sphere) - sphere.w);
+			boundsMax = glm::max(boundsMax, glm::vec3(sphere) + sphere.w);
+			radiusSum += sphere.w;
+			++boundedCount;
+		}
+		if (boundedCount == 0)
+		{
+			dims = glm::ivec3(0);
+			return;
+		}
+
+		// Cells about as wide as a light, so that a light covers a handful of them
+		glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(1e-3f));
+		cellSize = std::max(static_cast<float>(2.0 * radiusSum / boundedCount), 1e-3f);
+		while (true)
+		{
+			dims = glm::max(glm::ivec3(glm::ceil(extent / cellSize)), glm::ivec3(1));
+			if (static_cast<size_t>(dims.x) * dims.y * dims.z <= MaxCellCount)
+			{
+				break;
+			}
+			cellSize *= 2.0f;
+		}
+
+		// Counting sort of the (cell, light) pairs into per-cell lists
+		cellRanges.assign(static_cast<size_t>(dims.x) * dims.y * dims.z + 1, 0);
+		ForEachBoundedLight(spheres, [&](uint32_t, size_t cell) { ++cellRanges[cell + 1]; });
+		for (size_t cell = 1; cell < cellRanges.size(); ++cell)
+		{
+			cellRanges[cell] += cellRanges[cell - 1];
+		}
+		cellLights.resize(cellRanges.back());
+		std::vector<uint32_t> cellFill(cellRanges.begin(), cellRanges.end() - 1);
+		ForEachBoundedLight(spheres, [&](uint32_t light, size_t cell) { cellLights[cellFill[cell]++] = light; });
+	}
+
+	// Finds the lights whose sphere overlaps a sphere, each listed once
+	// @param	sphere	Center and radius of the sphere
+	// @param	lights	Receives the indices of the lights, appended to what it holds
+	void Query(const glm::vec4& sphere, std::vector<uint32_t>& lights)
+	{
+		lights.insert(lights.end(), unboundedLights.begin(), unboundedLights.end());
+		if (dims.x == 0)
+		{
+			return;
+		}
+
+		++queryStamp;
+		glm::vec3 center(sphere);
+		glm::ivec3 minCell;
+		glm::ivec3 maxCell;
+		if (!GetCellRange(center - sphere.w, center + sphere.w, minCell, maxCell))
+		{
+			return;
+		}
+
+		const std::vector<glm::vec4>& spheres = *lightSpheres;
+		for (int z = minCell.z; z <= maxCell.z; ++z)
+		{
+			for (int y = minCell.y; y <= maxCell.y; ++y)
+			{
+				for (int x = minCell.x; x <= maxCell.x; ++x)
+				{
+					size_t cell = GetCellIndex(x, y, z);
+					for (uint32_t i = cellRanges[cell]; i < cellRanges[cell + 1]; ++i)
+					{
+						// A light spanning several cells is only tested once per query
+						uint32_t light = cellLights[i];
+						if (queryStamps[light] == queryStamp)
+						{
+							continue;
+						}
+						queryStamps[light] = queryStamp;
+
+						glm::vec3 d = glm::vec3(spheres[light]) - center;
+						float reach = spheres[light].w + sphere.w;
+						if (glm::dot(d, d) <= reach * reach)
+						{
+							lights.push_back(light);
+						}
+					}
+				}
+			}
+		}
+	}
+
+private:
+	size_t GetCellIndex(int x, int y, int z) const
+	{
+		return (static_cast<size_t>(z) * dims.y + y) * dims.x + x;
+	}
+
+	// Gets the cells a box overlaps, clamped to the grid
+	// @return	Returns false if the box misses the grid
+	bool GetCellRange(const glm::vec3& boxMin, const glm::vec3& boxMax, glm::ivec3& minCell, glm::ivec3& maxCell) const
+	{
+		glm::vec3 first = glm::floor((boxMin - boundsMin) / cellSize);
+		glm::vec3 last = glm::floor((boxMax - boundsMin) / cellSize);
+		if (glm::any(glm::lessThan(last, glm::vec3(0.0f))) || glm::any(glm::greaterThanEqual(first, glm::vec3(dims))))
+		{
+			return false;
+		}
+		minCell = glm::max(glm::ivec3(first), glm::ivec3(0));
+		maxCell = glm::min(glm::ivec3(last), dims - 1);
+		return true;
+	}
+
+	// Calls a function for every cell the bounding box of each light that fades out overlaps
+	template <typename Function>
+	void ForEachBoundedLight(const std::vector<glm::vec4>& spheres, Function function) const
+	{
+		for (size_t i = 0; i < spheres.size(); ++i)
+		{
+			const glm::vec4& sphere = spheres[i];
+			glm::ivec3 minCell;
+			glm::ivec3 maxCell;
+			if (sphere.w >= MaxLightRange || !GetCellRange(glm::vec3(sphere) - sphere.w, glm::vec3(sphere) + sphere.w, minCell, maxCell))
+			{
+				continue;
+			}
+			for (int z = minCell.z; z <= maxCell.z; ++z)
+			{
+				for (int y = minCell.y; y <= maxCell.y; ++y)
+				{
+					for (int x = minCell.x; x <= maxCell.x; ++x)
+					{
+						function(static_cast<uint32_t>(i), GetCellIndex(x, y, z));
+					}
+				}
+			}
+		}
+	}
+
+	const std::vector<glm::vec4>* lightSpheres = nullptr;
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	float cellSize = 1.0f;
+	glm::ivec3 dims = glm::ivec3(0);
+
+	// Per cell: offset of its lights in cellLights, with one extra entry for the end of the last cell
+	std::vector<uint32_t> cellRanges;
+	std::vector<uint32_t> cellLights;
+	std::vector<uint32_t> unboundedLights;
+
+	// Query each light was last tested in
+	std::vector<uint32_t> queryStamps;
+	uint32_t queryStamp = 0;
+};
+
+// Counters of the last per-object light list update
+struct ObjectLightStats
+{
+	// Objects that got a light list, and the lights that could reach them
+	size_t objectCount = 0;
+	size_t lightCount = 0;
+
+	// Sum and maximum of the list lengths
+	size_t lightIndexCount = 0;
+	size_t maxLightsPerObject = 0;
+
+	double updateMs = 0.0;
+};
+
+// Per-object light lists. Every frame, each drawn object gets the list of the
+// point and spot lights whose range reaches its bounding sphere, found through
+// a LightGrid query. The lists are uploaded into texture buffers like the
+// cluster lists, so that the lighting shader evaluates only the lights of its
+// object (see ShadeObjectLights).
+class ObjectLightLists
+{
+public:
+	void Create()
+	{
+		rangeBuffer.Create(GL_RG32UI);
+		indexBuffer.Create(GL_R32UI);
+	}
+
+	// Builds and uploads the light lists of the drawn objects, one per entry of objectIndices,
+	// so that the per-frame cost follows the drawn objects rather than the whole scene
+	// @param	objectBounds	World space bounding sphere of every object
+	// @param	objectIndices	Indices of the objects being drawn, in instance buffer order (see DrawQueue::GetObjectIndices)
+	// @param	lightSpheres	Position and range of every light
+	void Update(const std::vector<glm::vec4>& objectBounds, const std::vector<uint32_t>& objectIndices,
+		const std::vector<glm::vec4>& lightSpheres)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		grid.Build(lightSpheres);
+
+		objectRanges.resize(objectIndices.size());
+		lightIndices.clear();
+		stats = ObjectLightStats();
+		for (size_t slot = 0; slot < objectIndices.size(); ++slot)
+		{
+			uint32_t offset = static_cast<uint32_t>(lightIndices.size());
+			grid.Query(objectBounds[objectIndices[slot]], lightIndices);
+			uint32_t count = static_cast<uint32_t>(lightIndices.size()) - offset;
+			objectRanges[slot] = glm::uvec2(offset, count);
+			stats.maxLightsPerObject = std::max<size_t>(stats.maxLightsPerObject, count);
+		}
+
+		stats.objectCount = objectIndices.size();
+		stats.lightCount = lightSpheres.size();
+		stats.lightIndexCount = lightIndices.size();
+
+		rangeBuffer.Upload(objectRanges.data(), objectRanges.size() * sizeof(glm::uvec2));
+		indexBuffer.Upload(lightIndices.data(), lightIndices.size() * sizeof(uint32_t));
+
+		stats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Binds the light lists to their texture units
+	void Bind() const
+	{
+		rangeBuffer.Bind(ObjectLightRangesTextureUnit);
+		indexBuffer.Bind(ObjectLightIndicesTextureUnit);
+	}
+
+	// Gets the counters of the last update
+	const ObjectLightStats& GetStats() const
+	{
+		return stats;
+	}
+
+	void Destroy()
+	{
+		rangeBuffer.Destroy();
+		indexBuffer.Destroy();
+	}
+
+private:
+	TextureBuffer rangeBuffer;
+	TextureBuffer indexBuffer;
+	LightGrid grid;
+
+	std::vector<glm::uvec2> objectRanges;
+	std::vector<uint32_t> lightIndices;
+
+	ObjectLightStats stats;
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Enums and entry points of GL_ARB_get_program_binary (core since GL 4.1),
+// which the GL 3.3 loader doesn't provide
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+typedef void (APIENTRYP ProgramBinaryGetProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP ProgramBinaryLoadProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+// Hashes a string of bytes (64-bit FNV-1a), continuing from a previous hash
+// @param	bytes	Bytes to hash
+// @param	hash	Hash to continue from
+// @return	Returns the hash of the bytes
+uint64_t HashBytes64(const std::string& bytes, uint64_t hash = 14695981039346656037ull)
+{
+	for (char c : bytes)
+	{
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Counters of the program binary cache
+struct ProgramCacheStats
+{
+	// Programs loaded from a cached binary
+	size_t hits = 0;
+
+	// Programs built from source, because no usable binary was cached
+	size_t misses = 0;
+
+	// Cached binaries the driver rejected (e.g. after a driver update)
+	size_t rejected = 0;
+
+	// Binaries written to the cache
+	size_t stores = 0;
+
+	// Time spent loading cached binaries, and building programs from source
+	double loadMs = 0.0;
+	double buildMs = 0.0;
+
+	// Build time the hits would have cost, as recorded when their binaries were stored, minus their load time
+	double savedMs = 0.0;
+};
+
+// On-disk cache of linked program binaries, keyed by a hash of the expanded
+// shader sources (defines included) and of the driver's vendor, renderer and
+// version strings, so that a driver change never picks up a stale binary.
+// Needs GL_ARB_get_program_binary. Without it the cache stays off and programs
+// are always built from source.
+class ProgramBinaryCache
+{
+public:
+	// Prefix of the cache files (e.g. "cache/program_"), empty to leave the cache off.
+	// Any directory in it must already exist.
+	std::string pathPrefix;
+
+	// Checks for program binary support and loads its entry points.
+	// Must be called with a current context before creating programs.
+	// @param	load	Function looking up GL entry points by name
+	void Initialize(GLADloadproc load)
+	{
+		supported = false;
+
+		GLint major = 0;
+		GLint minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		bool hasExtension = major > 4 || (major == 4 && minor >= 1);
+
+		GLint extensionCount = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+		for (GLint i = 0; i < extensionCount && !hasExtension; ++i)
+		{
+			hasExtension = std::strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_get_program_binary") == 0;
+		}
+
+		// Some drivers expose the extension but no binary formats, which means no binaries
+		GLint formatCount = 0;
+		if (hasExtension)
+		{
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+		}
+
+		getProgramBinary = reinterpret_cast<ProgramBinaryGetProc>(load("glGetProgramBinary"));
+		programBinary = reinterpret_cast<ProgramBinaryLoadProc>(load("glProgramBinary"));
+		programParameteri = reinterpret_cast<ProgramParameteriProc>(load("glProgramParameteri"));
+		supported = hasExtension && formatCount > 0 && getProgramBinary && programBinary && programParameteri;
+
+		driverHash = 0;
+		const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+		for (GLenum name : driverStrings)
+		{
+			const GLubyte* value = glGetString(name);
+			driverHash = HashBytes64(value ? reinterpret_cast<const char*>(value) : "", driverHash ^ name);
+		}
+	}
+
+	// Whether the driver can hand out program binaries
+	bool IsSupported() const
+	{
+		return supported;
+	}
+
+	// Whether programs go through the cache
+	bool IsEnabled() const
+	{
+		return supported && !pathPrefix.empty();
+	}
+
+	// Computes the cache key of a program
+	// @param	vertexSource	Vertex shader source, with includes and defines expanded
+	// @param	fragmentSource	Fragment shader source, with includes and defines expanded
+	// @return	Returns the key
+	uint64_t ComputeKey(const std::string& vertexSource, const std::string& fragmentSource) const
+	{
+		// Hash the lengths too, so moving text from one stage to the other changes the key
+		uint64_t hash = HashBytes64(std::to_string(vertexSource.size()) + ":" + std::to_string(fragmentSource.size()), driverHash);
+		hash = HashBytes64(vertexSource, hash);
+		return HashBytes64(fragmentSource, hash);
+	}
+
+	// Loads a cached binary into a program object
+	// @param	key		Cache key of the program
+	// @param	program	Newly created program object without any shaders attached
+	// @return	Returns true if the program was loaded and linked from the cache
+	bool Load(uint64_t key, GLuint program)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		std::ifstream file(GetPath(key), std::ios::binary);
+		if (file.fail())
+		{
+			return false;
+		}
+
+		FileHeader header;
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (file.fail() || std::memcmp(header.magic, "PBC1", sizeof(header.magic)) != 0 || header.key != key)
+		{
+			return false;
+		}
+
+		std::vector<char> binary(header.length);
+		file.read(binary.data(), binary.size());
+		if (file.fail())
+		{
+			return false;
+		}
+
+		programBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+		GLint linkStatus = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+		if (linkStatus != GL_TRUE)
+		{
+			++stats.rejected;
+			return false;
+		}
+
+		double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		++stats.hits;
+		stats.loadMs += loadMs;
+		stats.savedMs += header.buildMs - loadMs;
+		return true;
+	}
+
+	// Asks the driver to keep the binary of a program retrievable.
+	// Must be called before linking a program that will be stored.
+	void PrepareForStore(GLuint program)
+	{
+		programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// Writes the binary of a freshly linked program to the cache
+	// @param	key		Cache key of the program
+	// @param	program	Linked program object
+	// @param	buildMs	Time it took to build the program from source
+	void Store(uint64_t key, GLuint program, double buildMs)
+	{
+		++stats.misses;
+		stats.buildMs += buildMs;
+
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+		{
+			return;
+		}
+
+		std::vector<char> binary(length);
+		FileHeader header;
+		std::memcpy(header.magic, "PBC1", sizeof(header.magic));
+		header.key = key;
+		header.buildMs = static_cast<float>(buildMs);
+		GLsizei written = 0;
+		getProgramBinary(program, length, &written, &header.binaryFormat, binary.data());
+		header.length = static_cast<uint32_t>(written);
+
+		// Write to a temporary file first, so a crash never leaves a truncated binary behind
+		std::string path = GetPath(key);
+		std::string tempPath = path + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (file.fail())
+			{
+				return;
+			}
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(binary.data(), written);
+			if (file.fail())
+			{
+				return;
+			}
+		}
+		std::remove(path.c_str());
+		if (std::rename(tempPath.c_str(), path.c_str()) == 0)
+		{
+			++stats.stores;
+		}
+	}
+
+	// Counts a program built from source while the cache is off
+	// @param	buildMs		Time it took to build the program
+	void RecordUncachedBuild(double buildMs)
+	{
+		++stats.misses;
+		stats.buildMs += buildMs;
+	}
+
+	const ProgramCacheStats& GetStats() const
+	{
+		return stats;
+	}
+
+	// Prints the counters of the cache
+	void Print(std::ostream& out) const
+	{
+		out << "Program cache: " << (IsEnabled() ? "on" : supported ? "off" : "unsupported")
+			<< ", " << stats.hits << " hits, " << stats.misses << " misses, " << stats.rejected << " rejected"
+			<< std::fixed << std::setprecision(2)
+			<< ", " << stats.loadMs << " ms loading, " << stats.buildMs << " ms building, "
+			<< stats.savedMs << " ms saved" << std::defaultfloat << std::endl;
+	}
+
+private:
+	// Header of a cache file, followed by the binary itself
+	struct FileHeader
+	{
+		char magic[4];
+		GLenum binaryFormat;
+		uint64_t key;
+		uint32_t length;
+		float buildMs;
+	};
+
+	std::string GetPath(uint64_t key) const
+	{
+		std::ostringstream path;
+		path << pathPrefix << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+		return path.str();
+	}
+
+	bool supported = false;
+	uint64_t driverHash = 0;
+	ProgramBinaryGetProc getProgramBinary = nullptr;
+	ProgramBinaryLoadProc programBinary = nullptr;
+	ProgramParameteriProc programParameteri = nullptr;
+	ProgramCacheStats stats;
+};
+
+// Gets the program binary cache used by every shader program created
+// @return	Returns the shared cache
+ProgramBinaryCache& ProgramCache()
+{
+	static ProgramBinaryCache cache;
+	return cache;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stdexcept>
+
+// Offscreen framebuffer with a color and a depth attachment, used to render
+// without a visible window (e.g. on build machines with no display)
+class RenderTarget
+{
+public:
+	// Creates the framebuffer and its attachments
+	// @param	targetWidth		Width of the framebuffer in pixels
+	// @param	targetHeight	Height of the framebuffer in pixels
+	void Create(int targetWidth, int targetHeight)
+	{
+		width = targetWidth;
+		height = targetHeight;
+
+		glGenRenderbuffers(1, &colorBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+		glGenRenderbuffers(1, &depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			throw std::runtime_error("offscreen framebuffer is incomplete");
+		}
+	}
+
+	// Makes the framebuffer the target of subsequent draws
+	void Bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, width, height);
+	}
+
+	void Destroy()
+	{
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteRenderbuffers(1, &colorBuffer);
+		glDeleteRenderbuffers(1, &depthBuffer);
+		fbo = colorBuffer = depthBuffer = 0;
+	}
+
+	GLuint fbo = 0;
+	GLuint colorBuffer = 0;
+	GLuint depthBuffer = 0;
+	int width = 0;
+	int height = 0;
+};
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "TransformStore.h"
+
+// How the objects of a generated scene are spread out
+enum class SceneLayout
+{
+	// Regular 3D grid
+	Grid,
+
+	// Gaussian blobs around random cluster centers
+	Clusters,
+
+	// Random positions no closer than the spacing to each other
+	PoissonDisk
+};
+
+// Parameters of a generated scene
+struct SceneDesc
+{
+	SceneLayout layout = SceneLayout::Grid;
+	size_t objectCount = 1000;
+	uint32_t seed = 1;
+
+	// Center of the scene in world space
+	glm::vec3 center = glm::vec3(0.0f, 0.0f, -6.0f);
+
+	// Typical distance between neighboring objects (the exact distance for grids,
+	// the minimum distance for Poisson-disk, the average distance within a cluster)
+	float spacing = 3.0f;
+
+	// Uniform scale of the cubes
+	float scale = 0.5f;
+};
+
+// Parses the name of a scene layout, as given on the command line
+// @param	name	One of "grid", "clusters" or "poisson"
+// @return	Returns the layout
+SceneLayout ParseSceneLayout(const std::string& name)
+{
+	if (name == "grid")
+	{
+		return SceneLayout::Grid;
+	}
+	if (name == "clusters")
+	{
+		return SceneLayout::Clusters;
+	}
+	if (name == "poisson")
+	{
+		return SceneLayout::PoissonDisk;
+	}
+	throw std::runtime_error("unknown scene layout " + name + " (expected grid, clusters or poisson)");
+}
+
+const char* GetSceneLayoutName(SceneLayout layout)
+{
+	switch (layout)
+	{
+	case SceneLayout::Grid:
+		return "grid";
+	case SceneLayout::Clusters:
+		return "clusters";
+	default:
+		return "poisson";
+	}
+}
+
+// Random numbers drawn straight from the engine bits, since the standard
+// distributions are allowed to give different results on different compilers
+// and scenes must come out the same for a given seed everywhere
+class SceneRandom
+{
+public:
+	explicit SceneRandom(uint32_t seed)
+		: engine(seed)
+	{
+	}
+
+	// Gets a uniform random number in [0, 1)
+	float Uniform()
+	{
+		return (engine() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Gets a uniform random number in [min, max)
+	float Uniform(float min, float max)
+	{
+		return min + (max - min) * Uniform();
+	}
+
+	// Gets a normally distributed random number with mean 0 and standard deviation 1 (Box-Muller)
+	float Gaussian()
+	{
+		float u = 1.0f - Uniform();
+		float v = Uniform();
+		return std::sqrt(-2.0f * std::log(u)) * std::cos(glm::two_pi<float>() * v);
+	}
+
+	// Gets a uniformly distributed random rotation
+	glm::quat Rotation()
+	{
+		glm::vec4 q(Gaussian(), Gaussian(), Gaussian(), Gaussian());
+		float length = glm::length(q);
+		if (length < 1.0e-6f)
+		{
+			return glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		}
+		q /= length;
+		return glm::quat(q.w, q.x, q.y, q.z);
+	}
+
+	// Gets a uniformly distributed random direction
+	glm::vec3 Direction()
+	{
+		glm::vec3 d(Gaussian(), Gaussian(), Gaussian());
+		float length = glm::length(d);
+		return length < 1.0e-6f ? glm::vec3(0.0f, 0.0f, 1.0f) : d / length;
+	}
+
+private:
+	std::mt19937 engine;
+};
+
+// Generates positions on a grid of ceil(cbrt(count)) objects per side
+void GenerateGridPositions(const SceneDesc& desc, std::vector<glm::vec3>& positions)
+{
+	size_t side = static_cast<size_t>(std::ceil(std::cbrt(static_cast<double>(desc.objectCount))));
+	glm::vec3 origin = desc.center - glm::vec3((side - 1) * desc.spacing * 0.5f);
+
+	for (size_t i = 0; i < desc.objectCount; ++i)
+	{
+		positions.push_back(origin + desc.spacing * glm::vec3(
+			static_cast<float>(i % side),
+			static_cast<float>((i / side) % side),
+			static_cast<float>(i / (side * side))));
+	}
+}
+
+// Generates positions in Gaussian clusters of about 1000 objects each,
+// around centers spread uniformly over a cube holding all of them
+void GenerateClusterPositions(const SceneDesc& desc, SceneRandom& random, std::vector<glm::vec3>& positions)
+{
+	const size_t objectsPerCluster = 1000;
+	size_t clusterCount = (desc.objectCount + objectsPerCluster - 1) / objectsPerCluster;
+
+	// Leave about as much empty space between clusters as they take up
+	float sceneExtent = desc.spacing * std::cbrt(static_cast<float>(desc.objectCount) * 2.0f);
+	float clusterRadius = desc.spacing * std::cbrt(static_cast<float>(objectsPerCluster)) * 0.5f;
+
+	std::vector<glm::vec3> clusterCenters(clusterCount);
+	for (glm::vec3& clusterCenter : clusterCenters)
+	{
+		clusterCenter = desc.center + glm::vec3(random.Uniform(-0.5f, 0.5f), random.Uniform(-0.5f, 0.5f), random.Uniform(-0.5f, 0.5f)) * sceneExtent;
+	}
+
+	for (size_t i = 0; i < desc.objectCount; ++i)
+	{
+		const glm::vec3& clusterCenter = clusterCenters[i % clusterCount];
+		positions.push_back(clusterCenter + glm::vec3(random.Gaussian(), random.Gaussian(), random.Gaussian()) * (clusterRadius * 0.5f));
+	}
+}
+
+// Generates positions at least the spacing apart with Bridson's algorithm,
+// growing outwards from the scene center until the object count is reached.
+// Points are bucketed into a grid of cells one spacing wide, so only the
+// 27 cells around a candidate have to be checked.
+void GeneratePoissonDiskPositions(const SceneDesc& desc, SceneRandom& random, std::vector<glm::vec3>& positions)
+{
+	// Number of candidates tried around a point before giving up on it
+	const int candidatesPerPoint = 30;
+
+	if (desc.objectCount == 0)
+	{
+		return;
+	}
+
+	const float minDistance = desc.spacing;
+	const uint32_t noPoint = UINT32_MAX;
+
+	// Random sequential packing reaches about 0.7 points per spacing^3, so this
+	// leaves plenty of room. If the domain still fills up, it is grown and filled again.
+	float extent = minDistance * (1.4f * std::cbrt(static_cast<float>(desc.objectCount)) + 2.0f);
+
+	size_t start = positions.size();
+	for (;;)
+	{
+		positions.resize(start);
+
+		int cellsPerSide = static_cast<int>(std::ceil(extent / minDistance));
+		glm::vec3 origin = desc.center - glm::vec3(extent * 0.5f);
+
+		// Points of every cell, as linked lists through nextInCell
+		std::vector<uint32_t> cellHeads(static_cast<size_t>(cellsPerSide) * cellsPerSide * cellsPerSide, noPoint);
+		std::vector<uint32_t> nextInCell;
+		std::vector<uint32_t> active;
+
+		auto cellCoord = [&](const glm::vec3& p)
+		{
+			return glm::clamp(glm::ivec3((p - origin) / minDistance), glm::ivec3(0), glm::ivec3(cellsPerSide - 1));
+		};
+		auto cellIndex = [&](const glm::ivec3& c)
+		{
+			return (static_cast<size_t>(c.z) * cellsPerSide + c.y) * cellsPerSide + c.x;
+		};
+		auto addPoint = [&](const glm::vec3& p)
+		{
+			uint32_t index = static_cast<uint32_t>(positions.size() - start);
+			size_t cell = cellIndex(cellCoord(p));
+			positions.push_back(p);
+			nextInCell.push_back(cellHeads[cell]);
+			cellHeads[cell] = index;
+			active.push_back(index);
+		};
+		auto isFarEnough = [&](const glm::vec3& p)
+		{
+			glm::ivec3 c = cellCoord(p);
+			glm::ivec3 lo = glm::max(c - 1, glm::ivec3(0));
+			glm::ivec3 hi = glm::min(c + 1, glm::ivec3(cellsPerSide - 1));
+			for (int z = lo.z; z <= hi.z; ++z)
+			{
+				for (int y = lo.y; y <= hi.y; ++y)
+				{
+					for (int x = lo.x; x <= hi.x; ++x)
+					{
+						for (uint32_t i = cellHeads[cellIndex(glm::ivec3(x, y, z))]; i != noPoint; i = nextInCell[i])
+						{
+							glm::vec3 d = positions[start + i] - p;
+							if (glm::dot(d, d) < minDistance * minDistance)
+							{
+								return false;
+							}
+						}
+					}
+				}
+			}
+			return true;
+		};
+
+		addPoint(desc.center);
+		while (!active.empty() && positions.size() - start < desc.objectCount)
+		{
+			size_t activeSlot = static_cast<size_t>(random.Uniform() * active.size());
+			glm::vec3 base = positions[start + active[activeSlot]];
+
+			bool placed = false;
+			for (int attempt = 0; attempt < candidatesPerPoint && !placed; ++attempt)
+			{
+				// Candidates lie in the shell between one and two spacings away
+				glm::vec3 candidate = base + random.Direction() * (minDistance * random.Uniform(1.0f, 2.0f));
+				glm::vec3 local = candidate - origin;
+				if (glm::any(glm::lessThan(local, glm::vec3(0.0f))) || glm::any(glm::greaterThanEqual(local, glm::vec3(extent))))
+				{
+					continue;
+				}
+				if (isFarEnough(candidate))
+				{
+					addPoint(candidate);
+					placed = true;
+				}
+			}
+
+			if (!placed)
+			{
+				active[activeSlot] = active.back();
+				active.pop_back();
+			}
+		}
+
+		if (positions.size() - start >= desc.objectCount)
+		{
+			return;
+		}
+		extent *= 1.25f;
+	}
+}
+
+// Fills a transform store with randomly rotated cubes
+// @param	desc	Parameters of the scene
+// @param	store	Transform store receiving the cubes (cleared first)
+void GenerateScene(const SceneDesc& desc, TransformStore& store)
+{
+	SceneRandom random(desc.seed);
+
+	std::vector<glm::vec3> positions;
+	positions.reserve(desc.objectCount);
+	switch (desc.layout)
+	{
+	case SceneLayout::Grid:
+		GenerateGridPositions(desc, positions);
+		break;
+	case SceneLayout::Clusters:
+		GenerateClusterPositions(desc, random, positions);
+		break;
+	case SceneLayout::PoissonDisk:
+		GeneratePoissonDiskPositions(desc, random, positions);
+		break;
+	}
+
+	store.Clear();
+	store.Reserve(desc.objectCount);
+	for (const glm::vec3& position : positions)
+	{
+		ObjectTransform transform;
+		transform.position = position;
+		transform.rotation = random.Rotation();
+		transform.scale = glm::vec3(desc.scale);
+
+		// The cube spans -1 to 1 on every axis, so it fits in a sphere of radius sqrt(3)
+		store.Add(transform, glm::vec3(0.0f), std::sqrt(3.0f));
+	}
+}
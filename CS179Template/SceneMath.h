@@ -0,0 +1,315 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Batched math on scene objects. Batches are processed four objects at a time
+// with SSE when the target supports it, with a scalar path for the remainder
+// (and for targets without SSE).
+#if !defined(GLM_FORCE_PURE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SCENE_MATH_SSE 1
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+// Relative tolerance used to decide whether a matrix only rotates and uniformly scales
+const float UniformScaleEpsilon = 1.0e-4f;
+
+// Checks whether the upper 3x3 part of a model matrix is a rotation
+// combined with a uniform scale (orthogonal columns of equal length)
+// @param	m	Upper 3x3 part of the model matrix
+// @return	Returns true if the matrix has uniform scale
+bool HasUniformScale(const glm::mat3& m)
+{
+	float len0 = glm::dot(m[0], m[0]);
+	float tolerance = UniformScaleEpsilon * len0;
+	return std::abs(glm::dot(m[0], m[1])) <= tolerance
+		&& std::abs(glm::dot(m[0], m[2])) <= tolerance
+		&& std::abs(glm::dot(m[1], m[2])) <= tolerance
+		&& std::abs(glm::dot(m[1], m[1]) - len0) <= tolerance
+		&& std::abs(glm::dot(m[2], m[2]) - len0) <= tolerance;
+}
+
+// Computes the matrix transforming normals of an object from model space to world space,
+// i.e. the inverse transpose of the upper 3x3 part of its model matrix.
+// For a rotation with uniform scale s, the inverse transpose is just the matrix
+// divided by s^2, so the inverse is skipped entirely.
+// @param	modelMatrix		Affine model matrix of the object
+// @return	Returns the normal matrix
+glm::mat3 ComputeNormalMatrix(const glm::mat4& modelMatrix)
+{
+	glm::mat3 upper(modelMatrix);
+	if (HasUniformScale(upper))
+	{
+		return upper * (1.0f / glm::dot(upper[0], upper[0]));
+	}
+	return glm::inverseTranspose(upper);
+}
+
+// Computes the normal matrices of a batch of objects (see ComputeNormalMatrix).
+// Each normal matrix is written as three vec4 columns (w set to 0), the layout
+// std140 blocks and RGBA texel fetches expect. Matrices are accessed with
+// a byte stride, so they can be read from and written to arrays of structs directly.
+// @param	modelMatrices	Pointer to the first model matrix
+// @param	modelStride		Byte distance between consecutive model matrices
+// @param	normalColumns	Pointer to the first column of the first normal matrix to write
+// @param	normalStride	Byte distance between consecutive normal matrices
+// @param	count			Number of objects
+void ComputeNormalMatrices(const glm::mat4* modelMatrices, size_t modelStride, glm::vec4* normalColumns, size_t normalStride, size_t count)
+{
+	const char* modelBytes = reinterpret_cast<const char*>(modelMatrices);
+	char* normalBytes = reinterpret_cast<char*>(normalColumns);
+
+	size_t i = 0;
+
+#ifdef SCENE_MATH_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		const glm::mat4* m[4];
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			m[lane] = reinterpret_cast<const glm::mat4*>(modelBytes + (i + lane) * modelStride);
+		}
+
+		// Transpose the upper 3x3 parts into structure-of-arrays form,
+		// c[column][row] holding that element of all four matrices
+		__m128 c[3][3];
+		for (int column = 0; column < 3; ++column)
+		{
+			for (int row = 0; row < 3; ++row)
+			{
+				c[column][row] = _mm_setr_ps((*m[0])[column][row], (*m[1])[column][row], (*m[2])[column][row], (*m[3])[column][row]);
+			}
+		}
+
+		auto dot = [](const __m128* a, const __m128* b)
+		{
+			return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+		};
+		auto abs = [](__m128 v)
+		{
+			return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+		};
+
+		// Uniform scale test for all four matrices at once
+		__m128 len0 = dot(c[0], c[0]);
+		__m128 tolerance = _mm_mul_ps(_mm_set1_ps(UniformScaleEpsilon), len0);
+		__m128 uniform = _mm_cmple_ps(abs(dot(c[0], c[1])), tolerance);
+		uniform = _mm_and_ps(uniform, _mm_cmple_ps(abs(dot(c[0], c[2])), tolerance));
+		uniform = _mm_and_ps(uniform, _mm_cmple_ps(abs(dot(c[1], c[2])), tolerance));
+		uniform = _mm_and_ps(uniform, _mm_cmple_ps(abs(_mm_sub_ps(dot(c[1], c[1]), len0)), tolerance));
+		uniform = _mm_and_ps(uniform, _mm_cmple_ps(abs(_mm_sub_ps(dot(c[2], c[2]), len0)), tolerance));
+
+		__m128 n[3][3];
+		if (_mm_movemask_ps(uniform) == 0xF)
+		{
+			// Fast path: scale the matrices by 1/s^2
+			__m128 invLen0 = _mm_div_ps(_mm_set1_ps(1.0f), len0);
+			for (int column = 0; column < 3; ++column)
+			{
+				for (int row = 0; row < 3; ++row)
+				{
+					n[column][row] = _mm_mul_ps(c[column][row], invLen0);
+				}
+			}
+		}
+		else
+		{
+			// General path: the inverse transpose of a 3x3 matrix with columns
+			// c0, c1, c2 has columns (c1 x c2, c2 x c0, c0 x c1) / det
+			auto cross = [](const __m128* a, const __m128* b, __m128* out)
+			{
+				out[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+				out[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+				out[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+			};
+			cross(c[1], c[2], n[0]);
+			cross(c[2], c[0], n[1]);
+			cross(c[0], c[1], n[2]);
+
+			__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), dot(c[0], n[0]));
+			for (int column = 0; column < 3; ++column)
+			{
+				for (int row = 0; row < 3; ++row)
+				{
+					n[column][row] = _mm_mul_ps(n[column][row], invDet);
+				}
+			}
+		}
+
+		// Transpose back and store
+		float lanes[3][3][4];
+		for (int column = 0; column < 3; ++column)
+		{
+			for (int row = 0; row < 3; ++row)
+			{
+				_mm_storeu_ps(lanes[column][row], n[column][row]);
+			}
+		}
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			glm::vec4* out = reinterpret_cast<glm::vec4*>(normalBytes + (i + lane) * normalStride);
+			for (int column = 0; column < 3; ++column)
+			{
+				out[column] = glm::vec4(lanes[column][0][lane], lanes[column][1][lane], lanes[column][2][lane], 0.0f);
+			}
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		const glm::mat4& modelMatrix = *reinterpret_cast<const glm::mat4*>(modelBytes + i * modelStride);
+		glm::mat3 normalMatrix = ComputeNormalMatrix(modelMatrix);
+
+		glm::vec4* out = reinterpret_cast<glm::vec4*>(normalBytes + i * normalStride);
+		for (int column = 0; column < 3; ++column)
+		{
+			out[column] = glm::vec4(normalMatrix[column], 0.0f);
+		}
+	}
+}
+
+// Planes of a view frustum, each stored as (normal, distance) with the normal
+// pointing into the frustum, so that dot(normal, p) + distance >= 0 for points inside
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+// Number of objects that passed and failed a culling test
+struct CullingStats
+{
+	size_t visible = 0;
+	size_t culled = 0;
+};
+
+// Extracts the six frustum planes from a view-projection matrix
+// (Gribb/Hartmann method), normalized so plane distances are in world units
+// @param	viewProjMatrix	Projection matrix multiplied by the view matrix
+// @return	Returns the frustum
+Frustum ExtractFrustum(const glm::mat4& viewProjMatrix)
+{
+	// Rows of the matrix (glm matrices are indexed by column)
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; ++row)
+	{
+		rows[row] = glm::vec4(viewProjMatrix[0][row], viewProjMatrix[1][row], viewProjMatrix[2][row], viewProjMatrix[3][row]);
+	}
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; // Left
+	frustum.planes[1] = rows[3] - rows[0]; // Right
+	frustum.planes[2] = rows[3] + rows[1]; // Bottom
+	frustum.planes[3] = rows[3] - rows[1]; // Top
+	frustum.planes[4] = rows[3] + rows[2]; // Near
+	frustum.planes[5] = rows[3] - rows[2]; // Far
+
+	for (glm::vec4& plane : frustum.planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+// Computes a world space bounding sphere of an object from its model matrix
+// @param	modelMatrix		Affine model matrix of the object
+// @param	localCenter		Center of the bounding sphere in model space
+// @param	localRadius		Radius of the bounding sphere in model space
+// @return	Returns the sphere as (center, radius)
+glm::vec4 ComputeBoundingSphere(const glm::mat4& modelMatrix, const glm::vec3& localCenter, float localRadius)
+{
+	glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(localCenter, 1.0f));
+	float maxScaleSq = glm::max(glm::dot(modelMatrix[0], modelMatrix[0]),
+		glm::max(glm::dot(modelMatrix[1], modelMatrix[1]), glm::dot(modelMatrix[2], modelMatrix[2])));
+	return glm::vec4(center, localRadius * std::sqrt(maxScaleSq));
+}
+
+// Checks whether a bounding sphere is at least partially inside a frustum
+// @param	frustum		Frustum to test against
+// @param	sphere		Sphere as (center, radius)
+// @return	Returns true if the sphere is not fully outside any of the planes
+bool IsSphereVisible(const Frustum& frustum, const glm::vec4& sphere)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		if (glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w < -sphere.w)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Tests a batch of bounding spheres against a frustum and lists the visible ones
+// @param	frustum			Frustum to test against
+// @param	spheres			Bounding spheres as (center, radius)
+// @param	count			Number of spheres
+// @param	visibleIndices	Receives the indices of the visible spheres, in order
+// @return	Returns the number of visible and culled spheres
+CullingStats CullSpheres(const Frustum& frustum, const glm::vec4* spheres, size_t count, std::vector<uint32_t>& visibleIndices)
+{
+	visibleIndices.clear();
+
+	size_t i = 0;
+
+#ifdef SCENE_MATH_SSE
+	// Broadcast every plane component once
+	__m128 planes[6][4];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int k = 0; k < 4; ++k)
+		{
+			planes[p][k] = _mm_set1_ps(frustum.planes[p][k]);
+		}
+	}
+
+	for (; i + 4 <= count; i += 4)
+	{
+		// Load four spheres and transpose them to x/y/z/r registers
+		__m128 x = _mm_loadu_ps(&spheres[i][0]);
+		__m128 y = _mm_loadu_ps(&spheres[i + 1][0]);
+		__m128 z = _mm_loadu_ps(&spheres[i + 2][0]);
+		__m128 r = _mm_loadu_ps(&spheres[i + 3][0]);
+		_MM_TRANSPOSE4_PS(x, y, z, r);
+
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), r);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+				_mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			if (mask & (1 << lane))
+			{
+				visibleIndices.push_back(static_cast<uint32_t>(i + lane));
+			}
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		if (IsSphereVisible(frustum, spheres[i]))
+		{
+			visibleIndices.push_back(static_cast<uint32_t>(i));
+		}
+	}
+
+	CullingStats stats;
+	stats.visible = visibleIndices.size();
+	stats.culled = count - stats.visible;
+	return stats;
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GLUtils.h"
+
+// Counts frames that take much longer than the recent ones, to check that
+// something (like a shader reload) doesn't cause hitches
+class FrameSpikeCounter
+{
+public:
+	// A frame is a spike if it takes this many times the average of the recent frames...
+	float spikeRatio = 2.0f;
+
+	// ...and at least this many milliseconds more, so that jitter of very short frames doesn't count
+	double minSpikeMs = 4.0;
+
+	// Records the duration of a frame
+	// @param	frameMs		Duration of the frame in milliseconds
+	// @param	tagged		Whether the frame did the work being watched
+	void RecordFrame(double frameMs, bool tagged)
+	{
+		// Let the average settle before judging frames against it
+		const size_t warmupFrames = 30;
+		bool isSpike = frameCount >= warmupFrames && frameMs > averageMs * spikeRatio && frameMs > averageMs + minSpikeMs;
+		if (isSpike)
+		{
+			++spikeCount;
+			if (tagged)
+			{
+				++taggedSpikeCount;
+			}
+		}
+		else
+		{
+			// Keep spikes out of the average, so one hitch doesn't hide the next
+			averageMs = frameCount == 0 ? frameMs : averageMs + (frameMs - averageMs) * 0.05;
+		}
+
+		++frameCount;
+		if (tagged)
+		{
+			++taggedFrameCount;
+		}
+	}
+
+	size_t frameCount = 0;
+	size_t spikeCount = 0;
+	size_t taggedFrameCount = 0;
+	size_t taggedSpikeCount = 0;
+	double averageMs = 0.0;
+};
+
+// Rebuilds shader variants when their fragment shader changes on disk, without
+// stalling the frame. The new variants are built while the old ones keep
+// rendering, and all of them are swapped in at once between two frames, once
+// the driver reports their builds done (GL_KHR_parallel_shader_compile). A
+// reload that fails to compile leaves the old variants in place.
+//
+// Only the fragment shader is reloaded. Vertex shaders are shared with other
+// programs (BasicLighting.vsh also builds the G-buffer program, and must compute
+// positions exactly like DepthOnly.vsh for the depth pre-pass), so changing one
+// under a single cache would break them; those take a restart.
+class ShaderHotReloader
+{
+public:
+	// How often to look at the modification times of the files
+	double pollIntervalMs = 250.0;
+
+	// Without GL_KHR_parallel_shader_compile, the frames to give the driver before checking the
+	// builds, in case it compiles in the background anyway. Checking them may still wait.
+	int fallbackFrameDelay = 3;
+
+	// Starts watching the fragment shader file of a variant cache
+	// @param	cache	Variant cache to rebuild when its fragment shader changes
+	void Watch(ShaderVariantCache& cache)
+	{
+		WatchedCache watched;
+		watched.cache = &cache;
+		watched.path = cache.GetFragmentShaderPath();
+		watched.modifiedTime = GetModifiedTime(watched.path);
+		watchedCaches.push_back(watched);
+	}
+
+	// Checks the files, advances the builds in flight and swaps in the ones that are done.
+	// Called once per frame, before any watched variant is used.
+	// @param	lastFrameMs		Duration of the previous frame in milliseconds, for the spike counter
+	void Update(double lastFrameMs)
+	{
+		spikes.RecordFrame(lastFrameMs, reloadActive);
+		reloadActive = false;
+
+		auto now = std::chrono::steady_clock::now();
+		bool poll = std::chrono::duration<double, std::milli>(now - lastPoll).count() >= pollIntervalMs;
+		if (poll)
+		{
+			lastPoll = now;
+		}
+
+		for (WatchedCache& watched : watchedCaches)
+		{
+			if (poll && HasFileChanged(watched))
+			{
+				BeginReload(watched);
+			}
+			if (!watched.pending.empty())
+			{
+				reloadActive = true;
+				TryFinishReload(watched);
+			}
+		}
+	}
+
+	// Gets the number of reloads swapped in, and of reloads that failed to compile
+	size_t GetReloadCount() const
+	{
+		return reloadCount;
+	}
+
+	size_t GetFailedReloadCount() const
+	{
+		return failedReloadCount;
+	}
+
+	// Gets the frame times recorded, tagged with whether a reload was in flight
+	const FrameSpikeCounter& GetFrameSpikes() const
+	{
+		return spikes;
+	}
+
+	// Prints the reload counts and the frame-time spikes
+	void Print(std::ostream& out) const
+	{
+		out << "Shader reloads: " << reloadCount << " (" << failedReloadCount << " failed), "
+			<< spikes.taggedSpikeCount << " frame-time spikes in " << spikes.taggedFrameCount << " reloading frames, "
+			<< spikes.spikeCount << " in " << spikes.frameCount << " frames overall" << std::endl;
+	}
+
+	// Deletes the builds still in flight. The watched caches stay with their owners.
+	void Destroy()
+	{
+		for (WatchedCache& watched : watchedCaches)
+		{
+			CancelReload(watched);
+		}
+		watchedCaches.clear();
+	}
+
+private:
+	// Variant cache being watched, along with the reload in flight
+	struct WatchedCache
+	{
+		ShaderVariantCache* cache = nullptr;
+		std::string path;
+		std::time_t modifiedTime = 0;
+
+		// Fragment shader source and variants of the reload in flight, if any
+		std::string fragmentSource;
+		std::unordered_map<uint32_t, PendingShaderProgram> pending;
+		int framesWaited = 0;
+	};
+
+	static std::time_t GetModifiedTime(const std::string& path)
+	{
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+	}
+
+	static bool HasFileChanged(WatchedCache& watched)
+	{
+		std::time_t modifiedTime = GetModifiedTime(watched.path);
+		if (modifiedTime == watched.modifiedTime)
+		{
+			return false;
+		}
+		watched.modifiedTime = modifiedTime;
+		return true;
+	}
+
+	void BeginReload(WatchedCache& watched)
+	{
+		// A newer change supersedes whatever is still building
+		CancelReload(watched);
+
+		// Editors may still be writing the file, in which case the next poll picks up the rest.
+		// ReadFile appends, so the source is read into a fresh string.
+		std::string fragmentSource;
+		if (!ReadFile(watched.path, fragmentSource))
+		{
+			return;
+		}
+		watched.fragmentSource = std::move(fragmentSource);
+
+		// Start the builds of every variant in use, without waiting for any of them
+		try
+		{
+			for (uint32_t mask : watched.cache->GetVariantMasks())
+			{
+				watched.pending[mask] = BeginShaderProgram(watched.cache->GetVertexShaderSource(), watched.fragmentSource, watched.cache->GetDefines(mask));
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "Failed to reload " << watched.path << ": " << e.what() << std::endl;
+			++failedReloadCount;
+			CancelReload(watched);
+			return;
+		}
+
+		// Without any variant in use yet, there is nothing to wait for
+		if (watched.pending.empty())
+		{
+			SwapIn(watched, std::unordered_map<uint32_t, ShaderProgram>());
+		}
+	}
+
+	void TryFinishReload(WatchedCache& watched)
+	{
+		if (HasParallelShaderCompile())
+		{
+			for (const auto& pending : watched.pending)
+			{
+				if (!IsShaderProgramReady(pending.second))
+				{
+					return;
+				}
+			}
+		}
+		else if (++watched.framesWaited < fallbackFrameDelay)
+		{
+			return;
+		}
+
+		// Every build is done, so checking them doesn't wait
+		std::unordered_map<uint32_t, ShaderProgram> variants;
+		try
+		{
+			for (auto& pending : watched.pending)
+			{
+				variants[pending.first] = FinishShaderProgram(pending.second);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "Failed to reload " << watched.path << ": " << e.what() << std::endl;
+			++failedReloadCount;
+			for (auto& variant : variants)
+			{
+				glDeleteProgram(variant.second.id);
+			}
+			CancelReload(watched);
+			return;
+		}
+
+		SwapIn(watched, std::move(variants));
+	}
+
+	void SwapIn(WatchedCache& watched, std::unordered_map<uint32_t, ShaderProgram>&& variants)
+	{
+		// Swap all variants at once, so no frame mixes old and new ones
+		watched.cache->ReplaceSources(watched.cache->GetVertexShaderSource(), std::move(watched.fragmentSource), std::move(variants));
+		watched.fragmentSource.clear();
+		watched.pending.clear();
+		watched.framesWaited = 0;
+		++reloadCount;
+		std::cout << "Reloaded " << watched.path << std::endl;
+	}
+
+	static void CancelReload(WatchedCache& watched)
+	{
+		for (auto& pending : watched.pending)
+		{
+			// Finished builds are reset to an empty program, which deletes nothing
+			CancelShaderProgram(pending.second);
+		}
+		watched.pending.clear();
+		watched.framesWaited = 0;
+		watched.fragmentSource.clear();
+	}
+
+	std::vector<WatchedCache> watchedCaches;
+	std::chrono::steady_clock::time_point lastPoll;
+	bool reloadActive = false;
+	size_t reloadCount = 0;
+	size_t failedReloadCount = 0;
+	FrameSpikeCounter spikes;
+};
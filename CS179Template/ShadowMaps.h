@@ -0,0 +1,582 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "ClusteredLighting.h"
+#include "GLUtils.h"
+#include "Instancing.h"
+#include "Mesh.h"
+#include "SceneMath.h"
+#include "UniformBlocks.h"
+#include "VertexFormats.h"
+
+// Texture unit of the shadow atlas
+const GLint ShadowAtlasTextureUnit = 11;
+
+// GLSL side of the shadow maps, pulled into shaders with #include "Shadows.glsl"
+const char* const ShadowsSource = R"(
+layout(std140) uniform Shadows
+{
+	// World space to tile space ([0, 1] texture coordinates and depth) of every cascade, then of the spot light
+	mat4 cascadeMatrices[3];
+	mat4 spotShadowMatrix;
+
+	// Rectangle of every cascade and of the spot light in the atlas, as (size, offset)
+	vec4 cascadeTiles[3];
+	vec4 spotShadowTile;
+
+	// View depth at which each cascade ends
+	vec4 cascadeEnds;
+
+	// x: index of the shadowed spot light (-1 for none), y: whether the directional light is shadowed
+	ivec4 shadowParams;
+};
+
+uniform sampler2DShadow shadowAtlas;
+
+// Compares a tile space position against one tile of the atlas, averaging 4 filtered taps
+// @return	Returns the fraction of light reaching the position
+float SampleShadowTile(vec3 tilePos, vec4 tile)
+{
+	// Nothing outside of the tile's frustum was drawn into it
+	if (any(lessThan(tilePos, vec3(0.0))) || any(greaterThan(tilePos, vec3(1.0))))
+	{
+		return 1.0;
+	}
+
+	// Keep the taps from reaching into the neighboring tiles
+	vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	vec2 tileMin = tile.zw + texel * 1.5;
+	vec2 tileMax = tile.zw + tile.xy - texel * 1.5;
+	vec2 uv = tilePos.xy * tile.xy + tile.zw;
+
+	float lit = 0.0;
+	lit += texture(shadowAtlas, vec3(clamp(uv + vec2(-0.5, -0.5) * texel, tileMin, tileMax), tilePos.z));
+	lit += texture(shadowAtlas, vec3(clamp(uv + vec2(0.5, -0.5) * texel, tileMin, tileMax), tilePos.z));
+	lit += texture(shadowAtlas, vec3(clamp(uv + vec2(-0.5, 0.5) * texel, tileMin, tileMax), tilePos.z));
+	lit += texture(shadowAtlas, vec3(clamp(uv + vec2(0.5, 0.5) * texel, tileMin, tileMax), tilePos.z));
+	return lit * 0.25;
+}
+
+// Gets the fraction of the directional light reaching a fragment
+// @param	viewDepth	Distance of the fragment from the camera plane, picking the cascade
+float DirectionalShadow(vec3 fragPos, float viewDepth)
+{
+	if (shadowParams.y == 0 || viewDepth >= cascadeEnds.z)
+	{
+		return 1.0;
+	}
+
+	int cascade = viewDepth < cascadeEnds.x ? 0 : (viewDepth < cascadeEnds.y ? 1 : 2);
+	vec4 tilePos = cascadeMatrices[cascade] * vec4(fragPos, 1.0);
+	return SampleShadowTile(tilePos.xyz, cascadeTiles[cascade]);
+}
+
+// Gets the fraction of a local light reaching a fragment. Only one spot light has a shadow map.
+float SpotShadow(int lightIndex, vec3 fragPos)
+{
+	if (lightIndex != shadowParams.x)
+	{
+		return 1.0;
+	}
+
+	vec4 tilePos = spotShadowMatrix * vec4(fragPos, 1.0);
+	if (tilePos.w <= 0.0)
+	{
+		return 1.0;
+	}
+	return SampleShadowTile(tilePos.xyz / tilePos.w, spotShadowTile);
+}
+)";
+
+// std140 mirror of the Shadows block
+struct ShadowsBlock
+{
+	glm::mat4 cascadeMatrices[3];
+	glm::mat4 spotShadowMatrix;
+	glm::vec4 cascadeTiles[3];
+	glm::vec4 spotShadowTile;
+	glm::vec4 cascadeEnds;
+	glm::ivec4 shadowParams;
+};
+
+static_assert(sizeof(ShadowsBlock) == 352, "ShadowsBlock does not match the std140 layout");
+
+// Registers the shadow block and atlas with the shaders.
+// Must be called before creating any shader program that uses them.
+void RegisterShadowMaps()
+{
+	RegisterShaderInclude("Shadows.glsl", ShadowsSource);
+	RegisterUniformBlockBinding("Shadows", ShadowsBlockBinding);
+	RegisterSamplerBinding("shadowAtlas", ShadowAtlasTextureUnit);
+}
+
+// Counters of the shadow maps
+struct ShadowStats
+{
+	// Tiles redrawn from the static casters during the last update
+	size_t redrawnTiles = 0;
+
+	// Whether the last update drew dynamic casters over a copy of the static maps
+	bool composited = false;
+
+	// Updates so far, and how many of them redrew any tile
+	size_t updateCount = 0;
+	size_t redrawUpdateCount = 0;
+
+	// CPU time of the last update
+	double updateMs = 0.0;
+};
+
+// Shadow maps of the directional light (in cascades) and of one spot light,
+// packed as tiles into a single depth atlas. The depth of the static casters is
+// cached per tile, and a tile is only redrawn when its light or the static
+// casters change, or for a cascade, when the camera leaves the area it covers.
+// Cascades are centered on the camera rather than fitted to the view, so that
+// turning the camera never invalidates them. Dynamic casters are drawn every
+// update over a copy of the cached atlas, and with none, the shaders read the
+// cached atlas directly, so a frame where nothing moves draws no shadows at all.
+class ShadowMaps
+{
+public:
+	static const int CascadeCount = 3;
+
+	// Size of a tile in texels. The atlas is 2x2 tiles: the cascades, then the spot light.
+	static const int TileSize = 1024;
+	static const int AtlasSize = 2 * TileSize;
+
+	// Whether to draw and sample the shadows. Can be changed between frames.
+	bool enabled = true;
+
+	// Fraction of a cascade's radius the camera can move before the cascade is redrawn
+	float cascadeMargin = 0.1f;
+
+	// Slope-scaled and constant depth offsets of the shadow casters, against shadow acne
+	float slopeBias = 2.0f;
+	float constantBias = 4.0f;
+
+	// Creates the atlas, the depth program and the VAO the casters are drawn with
+	// @param	mesh		Caster mesh, whose buffers the VAO reuses
+	// @param	programs	Batch to build the program in, which must be finished before the first update
+	void Create(const GpuMesh& mesh, ShaderProgramBatch& programs)
+	{
+		indexCount = mesh.indexCount;
+		indexType = mesh.indexType;
+		programs.Add(depthProgram, "ShadowDepth.vsh", "DepthOnly.fsh");
+
+		CreateAtlas(staticAtlas, staticFbo);
+		sampledAtlas = staticAtlas;
+
+		// The block starts out without shadows, so shaders drawn before the first update sample none
+		for (int i = 0; i < CascadeCount; ++i)
+		{
+			block.cascadeTiles[i] = GetTileRect(i);
+		}
+		block.spotShadowTile = GetTileRect(CascadeCount);
+		block.shadowParams = glm::ivec4(-1, 0, 0, 0);
+
+		glGenBuffers(1, &ubo);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowsBlock), &block, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, ShadowsBlockBinding, ubo);
+
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+		SetupVertexAttributes(mesh.vertexFormat, true);
+		casterInstances.Create(vao);
+		glBindVertexArray(0);
+
+		InvalidateStatic();
+	}
+
+	// Splits the view distance into the cascades. Must be called again whenever the projection changes.
+	// @param	fovY			Vertical field of view in radians
+	// @param	aspectRatio		Width of the view divided by its height
+	// @param	zNear			Distance of the near plane
+	// @param	zFar			Distance of the far plane, where the shadows end
+	void SetProjection(float fovY, float aspectRatio, float zNear, float zFar)
+	{
+		// Blend of logarithmic and uniform splits, favoring the logarithmic ones near the camera
+		const float logWeight = 0.75f;
+		float tanHalfFovY = std::tan(fovY * 0.5f);
+		float tanHalfFovX = tanHalfFovY * aspectRatio;
+		float cornerScale = std::sqrt(1.0f + tanHalfFovX * tanHalfFovX + tanHalfFovY * tanHalfFovY);
+		for (int i = 0; i < CascadeCount; ++i)
+		{
+			float t = (i + 1) * 1.0f / CascadeCount;
+			float logSplit = zNear * std::pow(zFar / zNear, t);
+			float uniformSplit = zNear + (zFar - zNear) * t;
+			float end = glm::mix(uniformSplit, logSplit, logWeight);
+			block.cascadeEnds[i] = end;
+
+			// The cascade covers everything up to its end in every direction around the camera
+			cascades[i].radius = end * cornerScale;
+		}
+		InvalidateStatic();
+	}
+
+	// Flags every tile for redrawing, e.g. after static casters moved
+	void InvalidateStatic()
+	{
+		for (Tile& cascade : cascades)
+		{
+			cascade.valid = false;
+		}
+		spotTile.valid = false;
+	}
+
+	// Brings the shadow maps up to date, redrawing only the tiles that changed.
+	// Expects the object transform buffer to be bound, and leaves the framebuffer, viewport, program and VAO as they were.
+	// @param	eyePosition		Position of the camera
+	// @param	dirLight		Directional light
+	// @param	spotLight		Spot light casting shadows, or nullptr for none
+	// @param	spotLightIndex	Index of that light in the light buffer
+	// @param	casterBounds	World space bounding sphere of every object
+	// @param	staticCasters	Indices of the objects that don't move
+	// @param	dynamicCasters	Indices of the objects that may move every frame
+	void Update(const glm::vec3& eyePosition, const DirectionalLightData& dirLight, const LocalLight* spotLight, int spotLightIndex,
+		const std::vector<glm::vec4>& casterBounds, const std::vector<uint32_t>& staticCasters, const std::vector<uint32_t>& dynamicCasters)
+	{
+		auto start = std::chrono::steady_clock::now();
+		stats.redrawnTiles = 0;
+		stats.composited = false;
+		++stats.updateCount;
+
+		bool hasDirectional = enabled && dirLight.diffuse + dirLight.specular != glm::vec3(0.0f);
+		bool hasSpot = enabled && spotLight != nullptr;
+		block.shadowParams = glm::ivec4(hasSpot ? spotLightIndex : -1, hasDirectional ? 1 : 0, 0, 0);
+
+		// The state of the context is only saved once something is drawn
+		bool stateSaved = false;
+		GLint savedFbo = 0;
+		GLint savedViewport[4];
+		GLint savedProgram = 0;
+		GLint savedVao = 0;
+		auto beginDrawing = [&]()
+		{
+			if (!stateSaved)
+			{
+				glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFbo);
+				glGetIntegerv(GL_VIEWPORT, savedViewport);
+				glGetIntegerv(GL_CURRENT_PROGRAM, &savedProgram);
+				glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &savedVao);
+				glUseProgram(depthProgram.id);
+				glBindVertexArray(vao);
+				glDepthMask(GL_TRUE);
+				glEnable(GL_SCISSOR_TEST);
+				glEnable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(slopeBias, constantBias);
+				stateSaved = true;
+			}
+		};
+
+		glm::vec4 casterSphere = ComputeCasterSphere(casterBounds, staticCasters, dynamicCasters);
+
+		if (hasDirectional)
+		{
+			glm::vec3 lightDir = glm::normalize(dirLight.direction);
+			for (int i = 0; i < CascadeCount; ++i)
+			{
+				Tile& cascade = cascades[i];
+				if (cascade.valid && lightDir == cascade.lightDir
+					&& glm::length(eyePosition - cascade.center) <= cascade.radius * cascadeMargin)
+				{
+					continue;
+				}
+
+				FitCascade(cascade, eyePosition, lightDir, casterSphere);
+				beginDrawing();
+				glBindFramebuffer(GL_FRAMEBUFFER, staticFbo);
+				DrawTile(i, cascade.viewProjMatrix, casterBounds, staticCasters);
+				cascade.valid = true;
+				++stats.redrawnTiles;
+			}
+		}
+
+		if (hasSpot)
+		{
+			if (!spotTile.valid || spotLight->position != spotTile.center || spotLight->direction != spotTile.lightDir
+				|| spotLight->cutOffAngle != spotTile.cutOffAngle || spotLight->range != spotTile.radius)
+			{
+				FitSpot(spotTile, *spotLight);
+				beginDrawing();
+				glBindFramebuffer(GL_FRAMEBUFFER, staticFbo);
+				DrawTile(CascadeCount, spotTile.viewProjMatrix, casterBounds, staticCasters);
+				spotTile.valid = true;
+				++stats.redrawnTiles;
+			}
+		}
+
+		// Draw the dynamic casters over a copy of the static depth, keeping the cache untouched
+		bool composite = (hasDirectional || hasSpot) && !dynamicCasters.empty();
+		if (composite)
+		{
+			if (compositeFbo == 0)
+			{
+				CreateAtlas(compositeAtlas, compositeFbo);
+			}
+			beginDrawing();
+			glDisable(GL_SCISSOR_TEST);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFbo);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, compositeFbo);
+			glBlitFramebuffer(0, 0, AtlasSize, AtlasSize, 0, 0, AtlasSize, AtlasSize, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+			glEnable(GL_SCISSOR_TEST);
+			glBindFramebuffer(GL_FRAMEBUFFER, compositeFbo);
+			for (int i = 0; hasDirectional && i < CascadeCount; ++i)
+			{
+				DrawTile(i, cascades[i].viewProjMatrix, casterBounds, dynamicCasters, false);
+			}
+			if (hasSpot)
+			{
+				DrawTile(CascadeCount, spotTile.viewProjMatrix, casterBounds, dynamicCasters, false);
+			}
+			stats.composited = true;
+		}
+		sampledAtlas = composite ? compositeAtlas : staticAtlas;
+
+		if (stateSaved)
+		{
+			glDisable(GL_POLYGON_OFFSET_FILL);
+			glDisable(GL_SCISSOR_TEST);
+			glBindFramebuffer(GL_FRAMEBUFFER, savedFbo);
+			glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+			glUseProgram(savedProgram);
+			glBindVertexArray(savedVao);
+		}
+		if (stats.redrawnTiles > 0)
+		{
+			++stats.redrawUpdateCount;
+		}
+
+		// Map from world space into each tile's texture coordinates and depth
+		const glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+		for (int i = 0; i < CascadeCount; ++i)
+		{
+			block.cascadeMatrices[i] = bias * cascades[i].viewProjMatrix;
+		}
+		block.spotShadowMatrix = bias * spotTile.viewProjMatrix;
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShadowsBlock), &block);
+
+		stats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Tells the shaders to sample no shadows, for the frames Update is skipped on while disabled.
+	// The deferred shaders always include the shadow lookups, so they would otherwise keep the last ones.
+	void Disable()
+	{
+		block.shadowParams = glm::ivec4(-1, 0, 0, 0);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, offsetof(ShadowsBlock, shadowParams), sizeof(block.shadowParams), &block.shadowParams);
+		Bind();
+	}
+
+	// Binds the atlas the shaders should sample to its texture unit
+	void Bind() const
+	{
+		glActiveTexture(GL_TEXTURE0 + ShadowAtlasTextureUnit);
+		glBindTexture(GL_TEXTURE_2D, sampledAtlas);
+	}
+
+	// Gets the counters of the last update
+	const ShadowStats& GetStats() const
+	{
+		return stats;
+	}
+
+	void Destroy()
+	{
+		glDeleteFramebuffers(1, &staticFbo);
+		glDeleteFramebuffers(1, &compositeFbo);
+		glDeleteTextures(1, &staticAtlas);
+		glDeleteTextures(1, &compositeAtlas);
+		glDeleteBuffers(1, &ubo);
+		glDeleteVertexArrays(1, &vao);
+		casterInstances.Destroy();
+		glDeleteProgram(depthProgram.id);
+		staticFbo = compositeFbo = staticAtlas = compositeAtlas = sampledAtlas = ubo = vao = 0;
+		depthProgram.id = 0;
+	}
+
+private:
+	// Light view and the state it was fitted for, to tell when the cached depth is stale
+	struct Tile
+	{
+		glm::mat4 viewProjMatrix = glm::mat4(1.0f);
+		bool valid = false;
+
+		// Cascades: center and radius of the covered sphere, and the light direction.
+		// Spot light: position, range, direction and cutoff angle of the light.
+		glm::vec3 center = glm::vec3(0.0f);
+		float radius = 0.0f;
+		glm::vec3 lightDir = glm::vec3(0.0f);
+		float cutOffAngle = 0.0f;
+	};
+
+	static void CreateAtlas(GLuint& texture, GLuint& fbo)
+	{
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, AtlasSize, AtlasSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+
+		// Hardware depth comparison, with bilinear filtering of the results
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			throw std::runtime_error("shadow atlas framebuffer is incomplete");
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// Gets the rectangle of a tile in atlas texture coordinates, as (size, offset)
+	static glm::vec4 GetTileRect(int tile)
+	{
+		return glm::vec4(0.5f, 0.5f, (tile % 2) * 0.5f, (tile / 2) * 0.5f);
+	}
+
+	// Gets a sphere around all casters, for how far back the light views must start
+	static glm::vec4 ComputeCasterSphere(const std::vector<glm::vec4>& bounds, const std::vector<uint32_t>& staticCasters,
+		const std::vector<uint32_t>& dynamicCasters)
+	{
+		glm::vec3 boundsMin(FLT_MAX);
+		glm::vec3 boundsMax(-FLT_MAX);
+		for (const std::vector<uint32_t>* casters : { &staticCasters, &dynamicCasters })
+		{
+			for (uint32_t index : *casters)
+			{
+				boundsMin = glm::min(boundsMin, glm::vec3(bounds[index]) - bounds[index].w);
+				boundsMax = glm::max(boundsMax, glm::vec3(bounds[index]) + bounds[index].w);
+			}
+		}
+		if (boundsMin.x > boundsMax.x)
+		{
+			return glm::vec4(0.0f);
+		}
+		return glm::vec4((boundsMin + boundsMax) * 0.5f, glm::length(boundsMax - boundsMin) * 0.5f);
+	}
+
+	// Fits an orthographic light view around the camera, extended towards the light to take in every caster
+	void FitCascade(Tile& cascade, const glm::vec3& eyePosition, const glm::vec3& lightDir, const glm::vec4& casterSphere) const
+	{
+		float radius = cascade.radius * (1.0f + cascadeMargin);
+		glm::vec3 up = std::abs(lightDir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::vec3 right = glm::normalize(glm::cross(lightDir, up));
+		up = glm::cross(right, lightDir);
+
+		// Snap the center to whole texels across the light direction, so redrawing it doesn't make edges crawl
+		float texelSize = 2.0f * radius / TileSize;
+		glm::vec3 center = right * (std::floor(glm::dot(eyePosition, right) / texelSize) * texelSize)
+			+ up * (std::floor(glm::dot(eyePosition, up) / texelSize) * texelSize)
+			+ lightDir * glm::dot(eyePosition, lightDir);
+
+		float pullBack = radius + glm::length(glm::vec3(casterSphere) - center) + casterSphere.w;
+		glm::mat4 viewMatrix = glm::lookAt(center - lightDir * pullBack, center, up);
+		glm::mat4 projMatrix = glm::ortho(-radius, radius, -radius, radius, 0.0f, pullBack + radius);
+
+		cascade.viewProjMatrix = projMatrix * viewMatrix;
+		cascade.center = eyePosition;
+		cascade.lightDir = lightDir;
+	}
+
+	// Fits a perspective light view to the cone of a spot light
+	static void FitSpot(Tile& tile, const LocalLight& light)
+	{
+		glm::vec3 dir = glm::normalize(light.direction);
+		glm::vec3 up = std::abs(dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		float fov = std::min(2.0f * light.cutOffAngle + glm::radians(2.0f), glm::radians(170.0f));
+		float nearPlane = std::max(light.range * 0.001f, 0.05f);
+
+		glm::mat4 viewMatrix = glm::lookAt(light.position, light.position + dir, up);
+		glm::mat4 projMatrix = glm::perspective(fov, 1.0f, nearPlane, std::max(light.range, nearPlane * 2.0f));
+
+		tile.viewProjMatrix = projMatrix * viewMatrix;
+		tile.center = light.position;
+		tile.radius = light.range;
+		tile.lightDir = light.direction;
+		tile.cutOffAngle = light.cutOffAngle;
+	}
+
+	// Draws the casters in a tile's light view into the bound framebuffer
+	// @param	clear	Whether to clear the tile first
+	void DrawTile(int tile, const glm::mat4& viewProjMatrix, const std::vector<glm::vec4>& casterBounds,
+		const std::vector<uint32_t>& casters, bool clear = true)
+	{
+		int x = (tile % 2) * TileSize;
+		int y = (tile / 2) * TileSize;
+		glViewport(x, y, TileSize, TileSize);
+		glScissor(x, y, TileSize, TileSize);
+		if (clear)
+		{
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+
+		// Only the casters inside the light view are drawn
+		Frustum frustum = ExtractFrustum(viewProjMatrix);
+		visibleCasters.clear();
+		for (uint32_t index : casters)
+		{
+			if (IsSphereVisible(frustum, casterBounds[index]))
+			{
+				visibleCasters.push_back(index);
+			}
+		}
+		if (visibleCasters.empty())
+		{
+			return;
+		}
+
+		glUniformMatrix4fv(depthProgram.GetUniformLocation(LightViewProjHash), 1, GL_FALSE, glm::value_ptr(viewProjMatrix));
+		casterInstances.Upload(visibleCasters);
+		glDrawElementsInstanced(GL_TRIANGLES, indexCount, indexType, 0, static_cast<GLsizei>(visibleCasters.size()));
+	}
+
+	// Hash of the light view-projection uniform, looked up by hash since the program is built in a batch
+	static constexpr uint32_t LightViewProjHash = HashName("lightViewProjMatrix");
+
+	ShaderProgram depthProgram;
+	GLuint vao = 0;
+	GLsizei indexCount = 0;
+	GLenum indexType = GL_UNSIGNED_INT;
+	InstanceBuffer casterInstances;
+	std::vector<uint32_t> visibleCasters;
+
+	// The cached depth of the static casters, and the copy the dynamic casters are drawn over
+	GLuint staticAtlas = 0;
+	GLuint staticFbo = 0;
+	GLuint compositeAtlas = 0;
+	GLuint compositeFbo = 0;
+	GLuint sampledAtlas = 0;
+
+	Tile cascades[CascadeCount];
+	Tile spotTile;
+
+	GLuint ubo = 0;
+	ShadowsBlock block = {};
+	ShadowStats stats;
+};
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "GLUtils.h"
+#include "SceneMath.h"
+
+// Texture unit the object transform buffer is bound to
+const GLint ObjectTransformsTextureUnit = 0;
+
+// Number of RGBA32F texels taken up by one object in the transform buffer
+const GLint TexelsPerObjectTransform = 7;
+
+// GLSL helpers for reading object transforms from the transform buffer,
+// pulled into shaders with #include "ObjectTransforms.glsl"
+const char* const ObjectTransformsSource = R"(
+uniform samplerBuffer objectTransforms;
+
+mat4 FetchModelMatrix(uint objectIndex)
+{
+	int base = int(objectIndex) * 7;
+	return mat4(
+		texelFetch(objectTransforms, base),
+		texelFetch(objectTransforms, base + 1),
+		texelFetch(objectTransforms, base + 2),
+		texelFetch(objectTransforms, base + 3));
+}
+
+mat3 FetchNormalMatrix(uint objectIndex)
+{
+	int base = int(objectIndex) * 7 + 4;
+	return mat3(
+		texelFetch(objectTransforms, base).xyz,
+		texelFetch(objectTransforms, base + 1).xyz,
+		texelFetch(objectTransforms, base + 2).xyz);
+}
+)";
+
+// Registers the object transform buffer with the shaders, so that they can
+// include the fetch helpers and get the buffer's texture unit assigned.
+// Must be called before creating any shader program that uses them.
+void RegisterObjectTransforms()
+{
+	RegisterShaderInclude("ObjectTransforms.glsl", ObjectTransformsSource);
+	RegisterSamplerBinding("objectTransforms", ObjectTransformsTextureUnit);
+}
+
+// Position, rotation and scale of a scene object
+struct ObjectTransform
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
+};
+
+// Transform of an object as laid out in the transform buffer.
+// Columns of the normal matrix are padded to vec4 to fill whole texels.
+struct GpuTransform
+{
+	glm::mat4 modelMatrix;
+	glm::vec4 normalMatrix[3];
+};
+
+static_assert(sizeof(GpuTransform) == TexelsPerObjectTransform * sizeof(glm::vec4), "GpuTransform does not fill whole texels");
+
+// Range [first, first + count) of object indices
+struct ObjectRange
+{
+	uint32_t first;
+	uint32_t count;
+};
+
+// Keeps the transforms of all scene objects, along with their cached model
+// matrices, normal matrices and world space bounding spheres. Only objects
+// whose transform changed since the last update are recomputed, so that
+// per-frame cost follows the number of changed objects rather than the total.
+class TransformStore
+{
+public:
+	// Objects whose indices are at most this far apart get merged into
+	// a single updated range, trading a bit of extra upload for fewer calls
+	uint32_t rangeMergeGap = 16;
+
+	// Adds an object to the store
+	// @param	transform		Initial transform of the object
+	// @param	localCenter		Center of the object's bounding sphere in model space
+	// @param	localRadius		Radius of the object's bounding sphere in model space
+	// @return	Returns the index of the object
+	uint32_t Add(const ObjectTransform& transform, const glm::vec3& localCenter, float localRadius)
+	{
+		uint32_t index = static_cast<uint32_t>(transforms.size());
+		transforms.push_back(transform);
+		localBounds.push_back(glm::vec4(localCenter, localRadius));
+		gpuTransforms.emplace_back();
+		worldBounds.emplace_back();
+		dirtyFlags.push_back(0);
+		MarkDirty(index);
+		return index;
+	}
+
+	// Removes all objects
+	void Clear()
+	{
+		transforms.clear();
+		localBounds.clear();
+		gpuTransforms.clear();
+		worldBounds.clear();
+		dirtyFlags.clear();
+		dirtyList.clear();
+		updatedRanges.clear();
+	}
+
+	// Preallocates room for a number of objects
+	// @param	count	Number of objects
+	void Reserve(size_t count)
+	{
+		transforms.reserve(count);
+		localBounds.reserve(count);
+		gpuTransforms.reserve(count);
+		worldBounds.reserve(count);
+		dirtyFlags.reserve(count);
+		dirtyList.reserve(count);
+	}
+
+	// Replaces the transform of an object and flags it for recomputation
+	// @param	index		Index of the object
+	// @param	transform	New transform of the object
+	void Set(uint32_t index, const ObjectTransform& transform)
+	{
+		transforms[index] = transform;
+		MarkDirty(index);
+	}
+
+	const ObjectTransform& Get(uint32_t index) const
+	{
+		return transforms[index];
+	}
+
+	// Recomputes the model matrices, normal matrices and bounds of all objects
+	// flagged dirty, and collects the ranges of objects that were updated
+	// @return	Returns the number of objects that were recomputed
+	size_t Update()
+	{
+		updatedRanges.clear();
+		if (dirtyList.empty())
+		{
+			return 0;
+		}
+
+		std::sort(dirtyList.begin(), dirtyList.end());
+
+		for (uint32_t index : dirtyList)
+		{
+			// Compose translate * rotate * scale directly, without going through glm::translate/rotate/scale
+			const ObjectTransform& transform = transforms[index];
+			glm::mat3 rotation = glm::mat3_cast(transform.rotation);
+
+			glm::mat4& modelMatrix = gpuTransforms[index].modelMatrix;
+			modelMatrix[0] = glm::vec4(rotation[0] * transform.scale.x, 0.0f);
+			modelMatrix[1] = glm::vec4(rotation[1] * transform.scale.y, 0.0f);
+			modelMatrix[2] = glm::vec4(rotation[2] * transform.scale.z, 0.0f);
+			modelMatrix[3] = glm::vec4(transform.position, 1.0f);
+
+			worldBounds[index] = ComputeBoundingSphere(modelMatrix, glm::vec3(localBounds[index]), localBounds[index].w);
+			dirtyFlags[index] = 0;
+
+			// Merge into the previous range when close enough
+			if (!updatedRanges.empty() && index - (updatedRanges.back().first + updatedRanges.back().count) <= rangeMergeGap)
+			{
+				updatedRanges.back().count = index - updatedRanges.back().first + 1;
+			}
+			else
+			{
+				updatedRanges.push_back({ index, 1 });
+			}
+		}
+
+		// Normal matrices are computed in batches over each updated range
+		for (const ObjectRange& range : updatedRanges)
+		{
+			GpuTransform* first = &gpuTransforms[range.first];
+			ComputeNormalMatrices(&first->modelMatrix, sizeof(GpuTransform), first->normalMatrix, sizeof(GpuTransform), range.count);
+		}
+
+		size_t updatedCount = dirtyList.size();
+		dirtyList.clear();
+		return updatedCount;
+	}
+
+	// Gets the number of objects in the store
+	size_t Size() const
+	{
+		return transforms.size();
+	}
+
+	// Gets the cached transforms of all objects, as laid out in the transform buffer
+	const std::vector<GpuTransform>& GetGpuTransforms() const
+	{
+		return gpuTransforms;
+	}
+
+	// Gets the cached world space bounding spheres of all objects, as (center, radius)
+	const std::vector<glm::vec4>& GetWorldBounds() const
+	{
+		return worldBounds;
+	}
+
+	// Gets the ranges of objects recomputed by the last update, in ascending order
+	const std::vector<ObjectRange>& GetUpdatedRanges() const
+	{
+		return updatedRanges;
+	}
+
+	// Gets the number of bytes allocated by the store
+	size_t GetMemoryBytes() const
+	{
+		return transforms.capacity() * sizeof(ObjectTransform)
+			+ localBounds.capacity() * sizeof(glm::vec4)
+			+ gpuTransforms.capacity() * sizeof(GpuTransform)
+			+ worldBounds.capacity() * sizeof(glm::vec4)
+			+ dirtyFlags.capacity() * sizeof(uint8_t)
+			+ dirtyList.capacity() * sizeof(uint32_t)
+			+ updatedRanges.capacity() * sizeof(ObjectRange);
+	}
+
+private:
+	void MarkDirty(uint32_t index)
+	{
+		if (!dirtyFlags[index])
+		{
+			dirtyFlags[index] = 1;
+			dirtyList.push_back(index);
+		}
+	}
+
+	std::vector<ObjectTransform> transforms;
+	std::vector<glm::vec4> localBounds;
+	std::vector<GpuTransform> gpuTransforms;
+	std::vector<glm::vec4> worldBounds;
+	std::vector<uint8_t> dirtyFlags;
+	std::vector<uint32_t> dirtyList;
+	std::vector<ObjectRange> updatedRanges;
+};
+
+// Texture buffer holding the transforms of all objects on the GPU.
+// Shaders read it through the helpers in ObjectTransforms.glsl.
+class ObjectTransformBuffer
+{
+public:
+	void Create()
+	{
+		glGenBuffers(1, &tbo);
+		glGenTextures(1, &texture);
+	}
+
+	// Uploads the objects recomputed by the last update of the store,
+	// one glBufferSubData per updated range. The whole buffer is reallocated
+	// and uploaded when the store has grown past its capacity.
+	// @param	store	Transform store to upload from
+	void Upload(const TransformStore& store)
+	{
+		const std::vector<GpuTransform>& transforms = store.GetGpuTransforms();
+		glBindBuffer(GL_TEXTURE_BUFFER, tbo);
+
+		if (transforms.size() > capacity)
+		{
+			GLint maxTexels = 0;
+			glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+			if (transforms.size() * TexelsPerObjectTransform > static_cast<size_t>(maxTexels))
+			{
+				std::cout << "Warning: " << transforms.size() << " object transforms exceed the maximum texture buffer size" << std::endl;
+			}
+
+			capacity = transforms.size();
+			glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(GpuTransform), transforms.data(), GL_DYNAMIC_DRAW);
+
+			// Re-attach the texture to the newly allocated storage
+			glBindTexture(GL_TEXTURE_BUFFER, texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, tbo);
+			return;
+		}
+
+		for (const ObjectRange& range : store.GetUpdatedRanges())
+		{
+			glBufferSubData(GL_TEXTURE_BUFFER, range.first * sizeof(GpuTransform), range.count * sizeof(GpuTransform), &transforms[range.first]);
+		}
+	}
+
+	// Gets the size of the buffer storage in bytes
+	size_t GetSizeBytes() const
+	{
+		return capacity * sizeof(GpuTransform);
+	}
+
+	// Binds the transform buffer to its texture unit
+	void Bind() const
+	{
+		glActiveTexture(GL_TEXTURE0 + ObjectTransformsTextureUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+	}
+
+	void Destroy()
+	{
+		glDeleteTextures(1, &texture);
+		glDeleteBuffers(1, &tbo);
+		texture = 0;
+		tbo = 0;
+		capacity = 0;
+	}
+
+private:
+	GLuint tbo = 0;
+	GLuint texture = 0;
+	size_t capacity = 0;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "GLUtils.h"
+
+// Uniform blocks shared by every shader program. The C++ structs below mirror
+// the std140 layout of the GLSL declarations in UniformBlocksSource, which
+// shaders pull in with #include "UniformBlocks.glsl".
+
+// Fixed uniform buffer binding points of the shared blocks
+enum UniformBlockBinding : GLuint
+{
+	CameraBlockBinding = 0,
+	LightsBlockBinding = 1,
+	ClusterGridBlockBinding = 3,
+	ShadowsBlockBinding = 4
+};
+
+// GLSL declaration of the shared uniform blocks
+const char* const UniformBlocksSource = R"(
+layout(std140) uniform Camera
+{
+	mat4 projMatrix;
+	mat4 viewMatrix;
+	vec3 eyePos;
+};
+
+struct DirectionalLight
+{
+	vec3 direction;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+// Point and spot lights are lit through the cluster grid instead (see ClusteredLighting.h)
+layout(std140) uniform Lights
+{
+	DirectionalLight dirLight;
+};
+)";
+
+// std140 mirror of the Camera block
+struct CameraBlock
+{
+	glm::mat4 projMatrix;
+	glm::mat4 viewMatrix;
+	glm::vec3 eyePos;
+	float pad0;
+};
+
+// std140 mirror of the DirectionalLight struct
+struct DirectionalLightData
+{
+	glm::vec3 direction;
+	float pad0;
+
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+
+// std140 mirror of the Lights block
+struct LightsBlock
+{
+	DirectionalLightData dirLight;
+};
+
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock does not match the std140 layout");
+static_assert(sizeof(DirectionalLightData) == 64, "DirectionalLightData does not match the std140 layout");
+
+// Registers the shared uniform blocks, so that shaders can include their
+// declarations and get them bound to the fixed binding points.
+// Must be called before creating any shader program that uses them.
+void RegisterUniformBlocks()
+{
+	RegisterShaderInclude("UniformBlocks.glsl", UniformBlocksSource);
+	RegisterUniformBlockBinding("Camera", CameraBlockBinding);
+	RegisterUniformBlockBinding("Lights", LightsBlockBinding);
+}
+
+// A single uniform buffer holding the contents of every shared block.
+// Each block lives in its own range of the buffer, bound once to the block's
+// binding point, so the whole buffer can be refreshed with one glBufferSubData.
+class SharedUniformBuffer
+{
+public:
+	CameraBlock camera;
+	LightsBlock lights;
+
+	// Creates the buffer and binds each block's range to its binding point
+	void Create()
+	{
+		// Ranges bound to a binding point must start at a multiple of this alignment
+		GLint alignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+		cameraOffset = 0;
+		lightsOffset = AlignUp(cameraOffset + sizeof(CameraBlock), alignment);
+		staging.assign(lightsOffset + sizeof(LightsBlock), 0);
+
+		glGenBuffers(1, &ubo);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferData(GL_UNIFORM_BUFFER, staging.size(), nullptr, GL_DYNAMIC_DRAW);
+
+		glBindBufferRange(GL_UNIFORM_BUFFER, CameraBlockBinding, ubo, cameraOffset, sizeof(CameraBlock));
+		glBindBufferRange(GL_UNIFORM_BUFFER, LightsBlockBinding, ubo, lightsOffset, sizeof(LightsBlock));
+	}
+
+	// Uploads the current contents of all blocks to the GPU
+	void Upload()
+	{
+		std::memcpy(staging.data() + cameraOffset, &camera, sizeof(CameraBlock));
+		std::memcpy(staging.data() + lightsOffset, &lights, sizeof(LightsBlock));
+
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+	}
+
+	void Destroy()
+	{
+		glDeleteBuffers(1, &ubo);
+		ubo = 0;
+	}
+
+private:
+	static size_t AlignUp(size_t value, GLint alignment)
+	{
+		return alignment > 0 ? (value + alignment - 1) / alignment * alignment : value;
+	}
+
+	GLuint ubo = 0;
+	size_t cameraOffset = 0;
+	size_t lightsOffset = 0;
+	std::vector<unsigned char> staging;
+};
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "GLUtils.h"
+
+// Struct containing vertex info
+struct Vertex
+{
+	// Position
+	float x, y, z;
+
+	// Normal
+	float nx, ny, nz;
+
+	// Vertex Color
+	GLubyte r, g, b, a;
+};
+
+static_assert(sizeof(Vertex) == 28, "Vertex must not have any padding, since it is hashed and compared as bytes");
+
+// Vertices are equal when all their bytes are, matching VertexHash
+bool operator==(const Vertex& a, const Vertex& b)
+{
+	return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+}
+
+// Hash of all the bytes of a vertex (FNV-1a), for deduplicating vertices in hash maps
+struct VertexHash
+{
+	size_t operator()(const Vertex& vertex) const
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&vertex);
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < sizeof(Vertex); ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+};
+
+// How vertices are laid out in vertex buffers. Meshes are kept as Vertex on
+// the CPU and encoded into the format in use when they are uploaded or cached.
+enum class VertexFormat
+{
+	// Vertex as is: float position and normal, RGBA8 color (28 bytes)
+	Float,
+
+	// Half float position, normal packed to 10 bits per component (16 bytes)
+	Half,
+
+	// 16-bit position quantized to a power of two step, normal packed to 10 bits per component (16 bytes)
+	Quantized,
+
+	// 16-bit quantized position, octahedral normal with 16 bits per component (16 bytes)
+	Octahedral
+};
+
+// Vertex of the compact formats. How the position and normal bits are read depends on the format.
+struct CompactVertex
+{
+	// Half floats, or 16-bit integers followed by the exponent of their step
+	uint16_t position[4];
+
+	// GL_INT_2_10_10_10_REV, or two snorm16 octahedral coordinates
+	uint32_t normal;
+
+	GLubyte r, g, b, a;
+};
+
+static_assert(sizeof(CompactVertex) == 16, "CompactVertex must not have any padding");
+
+// Parses the name of a vertex format, as given on the command line
+// @param	name	One of "float", "half", "quantized" or "octahedral"
+// @return	Returns the format
+VertexFormat ParseVertexFormat(const std::string& name)
+{
+	if (name == "float")
+	{
+		return VertexFormat::Float;
+	}
+	if (name == "half")
+	{
+		return VertexFormat::Half;
+	}
+	if (name == "quantized")
+	{
+		return VertexFormat::Quantized;
+	}
+	if (name == "octahedral")
+	{
+		return VertexFormat::Octahedral;
+	}
+	throw std::runtime_error("unknown vertex format " + name + " (expected float, half, quantized or octahedral)");
+}
+
+const char* GetVertexFormatName(VertexFormat format)
+{
+	switch (format)
+	{
+	case VertexFormat::Float:
+		return "float";
+	case VertexFormat::Half:
+		return "half";
+	case VertexFormat::Quantized:
+		return "quantized";
+	default:
+		return "octahedral";
+	}
+}
+
+// Gets the size of a vertex in a format
+GLsizei GetVertexStride(VertexFormat format)
+{
+	return format == VertexFormat::Float ? sizeof(Vertex) : sizeof(CompactVertex);
+}
+
+// Registers the vertex decoding of a format with the shaders, which read positions
+// and normals through DecodeVertexPosition and DecodeVertexNormal of
+// #include "VertexFormat.glsl". Must be called before creating any shader program,
+// and every mesh must then be uploaded in this format.
+// @param	format	Format of every vertex buffer
+void RegisterVertexFormat(VertexFormat format)
+{
+	std::string source;
+	if (format == VertexFormat::Quantized || format == VertexFormat::Octahedral)
+	{
+		source += "#define QUANTIZED_POSITIONS\n";
+	}
+	if (format == VertexFormat::Octahedral)
+	{
+		source += "#define OCTAHEDRAL_NORMALS\n";
+	}
+	source += R"(
+// Position attribute to model space. Quantized positions are integers in xyz,
+// counting steps of the power of two whose exponent is in w.
+vec3 DecodeVertexPosition(vec4 position)
+{
+#ifdef QUANTIZED_POSITIONS
+	return position.xyz * exp2(position.w);
+#else
+	return position.xyz;
+#endif
+}
+
+// Normal attribute to a unit normal
+vec3 DecodeVertexNormal(vec4 normal)
+{
+#ifdef OCTAHEDRAL_NORMALS
+	// Unfold the octahedron: the lower half was folded over the diagonals of the upper half
+	vec3 n = vec3(normal.xy, 1.0 - abs(normal.x) - abs(normal.y));
+	float fold = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -fold : fold;
+	n.y += n.y >= 0.0 ? -fold : fold;
+	return normalize(n);
+#else
+	return normal.xyz;
+#endif
+}
+)";
+	RegisterShaderInclude("VertexFormat.glsl", source);
+}
+
+// Sets up the vertex attributes of the bound vertex buffer in the bound VAO:
+// position, normal and color at locations 0, 1 and 2
+// @param	format			Format of the buffer
+// @param	positionOnly	Whether to only set up the position, for passes that need no more
+void SetupVertexAttributes(VertexFormat format, bool positionOnly = false)
+{
+	const GLsizei stride = GetVertexStride(format);
+
+	// Vertex position attribute
+	glEnableVertexAttribArray(0);
+	switch (format)
+	{
+	case VertexFormat::Float:
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+		break;
+	case VertexFormat::Half:
+		glVertexAttribPointer(0, 4, GL_HALF_FLOAT, GL_FALSE, stride, 0);
+		break;
+	default:
+		// Not normalized, so the shader gets the integers and the exponent as they are
+		glVertexAttribPointer(0, 4, GL_SHORT, GL_FALSE, stride, 0);
+		break;
+	}
+	if (positionOnly)
+	{
+		return;
+	}
+
+	// Vertex normal attribute
+	glEnableVertexAttribArray(1);
+	switch (format)
+	{
+	case VertexFormat::Float:
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, nx));
+		break;
+	case VertexFormat::Octahedral:
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+		break;
+	default:
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+		break;
+	}
+
+	// Vertex color attribute
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+		format == VertexFormat::Float ? (void*)offsetof(Vertex, r) : (void*)offsetof(CompactVertex, r));
+}
+
+// Encodes a unit vector to octahedral coordinates in [-1, 1]
+glm::vec2 EncodeOctahedral(const glm::vec3& normal)
+{
+	glm::vec3 n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+	glm::vec2 e(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		// Fold the lower half over the diagonals
+		e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return e;
+}
+
+// Decodes octahedral coordinates to a unit vector, exactly like DecodeVertexNormal
+glm::vec3 DecodeOctahedral(const glm::vec2& e)
+{
+	glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	float fold = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -fold : fold;
+	n.y += n.y >= 0.0f ? -fold : fold;
+	return glm::normalize(n);
+}
+
+// Gets the exponent of the power of two step that positions are quantized to,
+// the smallest that still lets 16-bit integers reach every position
+// @param	vertices	Vertices to quantize
+// @param	count		Number of vertices
+int GetPositionExponent(const Vertex* vertices, size_t count)
+{
+	float maxAbs = 0.0f;
+	for (size_t i = 0; i < count; ++i)
+	{
+		maxAbs = std::max(maxAbs, std::max(std::abs(vertices[i].x), std::max(std::abs(vertices[i].y), std::abs(vertices[i].z))));
+	}
+	if (maxAbs == 0.0f)
+	{
+		return 0;
+	}
+	int exponent = static_cast<int>(std::ceil(std::log2(maxAbs / 32767.0f)));
+
+	// log2 may round either way
+	while (std::ldexp(32767.0f, exponent) < maxAbs)
+	{
+		++exponent;
+	}
+	return exponent;
+}
+
+// Encodes vertices into a format
+// @param	vertices	Vertices to encode
+// @param	count		Number of vertices
+// @param	format		Format to encode to
+// @return	Returns count vertices of GetVertexStride(format) bytes
+std::vector<char> EncodeVertices(const Vertex* vertices, size_t count, VertexFormat format)
+{
+	std::vector<char> encoded(count * GetVertexStride(format));
+	if (format == VertexFormat::Float)
+	{
+		if (count > 0)
+		{
+			std::memcpy(encoded.data(), vertices, encoded.size());
+		}
+		return encoded;
+	}
+
+	const int exponent = GetPositionExponent(vertices, count);
+	CompactVertex* compact = reinterpret_cast<CompactVertex*>(encoded.data());
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Vertex& vertex = vertices[i];
+		CompactVertex& out = compact[i];
+		glm::vec3 position(vertex.x, vertex.y, vertex.z);
+		glm::vec3 normal(vertex.nx, vertex.ny, vertex.nz);
+
+		if (format == VertexFormat::Half)
+		{
+			glm::uint64 half = glm::packHalf4x16(glm::vec4(position, 1.0f));
+			std::memcpy(out.position, &half, sizeof(out.position));
+		}
+		else
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				float steps = std::round(std::ldexp(position[c], -exponent));
+				out.position[c] = static_cast<uint16_t>(static_cast<int16_t>(glm::clamp(steps, -32767.0f, 32767.0f)));
+			}
+			out.position[3] = static_cast<uint16_t>(static_cast<int16_t>(exponent));
+		}
+
+		float length = glm::length(normal);
+		normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+		out.normal = format == VertexFormat::Octahedral ? glm::packSnorm2x16(EncodeOctahedral(normal))
+			: glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+
+		out.r = vertex.r;
+		out.g = vertex.g;
+		out.b = vertex.b;
+		out.a = vertex.a;
+	}
+	return encoded;
+}
+
+// Decodes a vertex the way the vertex shader sees it, for measuring the error of a format
+// @param	encoded		Vertex encoded by EncodeVertices
+// @param	format		Format of the vertex
+// @return	Returns the decoded vertex
+Vertex DecodeVertex(const char* encoded, VertexFormat format)
+{
+	Vertex vertex;
+	if (format == VertexFormat::Float)
+	{
+		std::memcpy(&vertex, encoded, sizeof(Vertex));
+		return vertex;
+	}
+
+	CompactVertex compact;
+	std::memcpy(&compact, encoded, sizeof(compact));
+	glm::vec3 position;
+	if (format == VertexFormat::Half)
+	{
+		glm::uint64 half;
+		std::memcpy(&half, compact.position, sizeof(half));
+		position = glm::vec3(glm::unpackHalf4x16(half));
+	}
+	else
+	{
+		int exponent = static_cast<int16_t>(compact.position[3]);
+		for (int c = 0; c < 3; ++c)
+		{
+			position[c] = std::ldexp(static_cast<float>(static_cast<int16_t>(compact.position[c])), exponent);
+		}
+	}
+
+	glm::vec3 normal = format == VertexFormat::Octahedral ? DecodeOctahedral(glm::unpackSnorm2x16(compact.normal))
+		: glm::vec3(glm::unpackSnorm3x10_1x2(compact.normal));
+
+	vertex.x = position.x;
+	vertex.y = position.y;
+	vertex.z = position.z;
+	vertex.nx = normal.x;
+	vertex.ny = normal.y;
+	vertex.nz = normal.z;
+	vertex.r = compact.r;
+	vertex.g = compact.g;
+	vertex.b = compact.b;
+	vertex.a = compact.a;
+	return vertex;
+}